@@ -0,0 +1,126 @@
+#include "4DUtils.h"
+
+// Sanity checks in the camera math below run per eye per frame, so they are compiled in only
+// when FOURD_VALIDATION is nonzero: by default in builds without NDEBUG. A failed check throws
+// std::runtime_error; with the checks compiled out nothing here allocates or throws.
+#ifndef FOURD_VALIDATION
+#ifdef NDEBUG
+#define FOURD_VALIDATION 0
+#else
+#define FOURD_VALIDATION 1
+#endif
+#endif
+
+#if FOURD_VALIDATION
+#define FOURD_CHECK(condition, message) do { if (!(condition)) { throw std::runtime_error(message); } } while (0)
+#else
+#define FOURD_CHECK(condition, message) ((void)0)
+#endif
+
+void rotate4DSinglePlaneSpecificAngle(vec4 fromVector, vec4 toVector, float angle, std::initializer_list<vec4*> vectorsToRotate) {
+	FOURD_CHECK(abs(length(fromVector) - 1) <= 0.0001, "rotate4DSinglePlane: fromVector is not normalized");
+	FOURD_CHECK(abs(length(toVector) - 1) <= 0.0001, "rotate4DSinglePlane: toVector is not normalized");
+
+	fromVector = normalize(fromVector);
+	toVector = normalize(toVector);
+
+	float rotationAngle = angle;
+
+	if (abs(rotationAngle) < radians(0.00001)) {
+		//from and to are likely the same, so just return
+		return;
+	}
+
+	vec4 non_norm_proj = toVector - dot(toVector, fromVector) * fromVector;
+	float non_norm_length = length(non_norm_proj);
+	if (non_norm_length < 0.00001) {
+		//from and to are likely the same, so just return
+		return;
+	}
+	vec4 perp_toVector = non_norm_proj / non_norm_length;
+
+	FOURD_CHECK(!any(isnan(perp_toVector)), "rotate4DSinglePlane: rotation plane is degenerate");
+	FOURD_CHECK(abs(dot(perp_toVector, fromVector)) <= 0.0001, "rotate4DSinglePlane: rotation plane is not orthonormal");
+
+	// Same for every vector, so only done once
+	// Note: rotates CCW (pos x-axis -> pos y-axis)
+	float cosAngle = cos(rotationAngle);
+	float sinAngle = sin(rotationAngle);
+
+	for (vec4* p_v : vectorsToRotate) {
+		vec4 orig_vec = *p_v;
+
+		float from_scalar_component = dot(orig_vec, fromVector);
+		float to_scalar_component = dot(orig_vec, perp_toVector);
+
+		// The component orthogonal to the plane stays as it is, so only the difference in the
+		// in-plane component is added
+		float rotated_from = cosAngle * from_scalar_component - sinAngle * to_scalar_component;
+		float rotated_to = sinAngle * from_scalar_component + cosAngle * to_scalar_component;
+		*p_v = orig_vec + ((rotated_from - from_scalar_component) * fromVector + (rotated_to - to_scalar_component) * perp_toVector);
+
+		FOURD_CHECK(abs(length(*p_v) - length(orig_vec)) <= 0.0001, "rotate4DSinglePlane: rotation changed a length");
+	}
+}
+
+void rotate4DSinglePlane(vec4 fromVector, vec4 toVector, std::initializer_list<vec4*> vectorsToRotate) {
+	FOURD_CHECK(abs(length(fromVector) - 1) <= 0.0001, "rotate4DSinglePlane: fromVector is not normalized");
+	FOURD_CHECK(abs(length(toVector) - 1) <= 0.0001, "rotate4DSinglePlane: toVector is not normalized");
+
+	fromVector = normalize(fromVector);
+	toVector = normalize(toVector);
+
+	// Clamp for cases where a vector is *slightly* longer than 1
+	float rotationAngle = acos(clamp(dot(fromVector, toVector), -1.0f, 1.0f));
+	rotate4DSinglePlaneSpecificAngle(fromVector, toVector, rotationAngle, vectorsToRotate);
+}
+
+void changeByMatrixDifference(const mat4& fromMat, const mat4& toMat, float movement_scale, CurvedWorldPosAndRot* posAndRot) {
+	//T = toMat = a matrix that translates the origin to the new camera center and rotates forward to be the new lookat
+	//F = fromMat = a matrix that translates the origin to the old camera center and rotates forward to be the old lookat
+	//C = changeMat = a matrix that translates the old camera center to the new camera center and same for the lookat
+	//v = some vector
+	//
+	//F^-1 * T * v = C * v
+	//
+	//With F = [Rf tf] and T = [Rt tt], C = [Rf^T Rt, Rf^T (tt - tf)].
+
+	mat3 fromRotationInverse = transpose(mat3(fromMat));
+	mat3 changeMat_rotation = fromRotationInverse * mat3(toMat);
+	vec3 changeMat_translation = fromRotationInverse * (vec3(toMat[3]) - vec3(fromMat[3]));
+
+	FOURD_CHECK(abs(length(vec3(toMat[3] - fromMat[3])) - length(changeMat_translation)) <= 0.0001,
+		"changeByMatrixDifference: matrices are not rigid transforms");
+
+	// Move position in virtual world
+	float translationLength = length(changeMat_translation);
+	float moveAmount = movement_scale * translationLength;
+	if (translationLength > 0.0f) {
+		vec4 moveDirection = normalize(
+			(posAndRot->rightDir * changeMat_translation.x) +
+			(posAndRot->upDir * changeMat_translation.y) +
+			(posAndRot->forwardDir * changeMat_translation.z));
+
+		rotate4DSinglePlaneSpecificAngle(posAndRot->pos, moveDirection, moveAmount,
+			{ &(posAndRot->pos), &(posAndRot->rightDir), &(posAndRot->upDir), &(posAndRot->forwardDir) });
+	}
+
+	// Rotate view in virtual world. The rotated x/y/z axes are just the columns of the rotation.
+	mat3x4 matWithDirsAsBases(posAndRot->rightDir, posAndRot->upDir, posAndRot->forwardDir);
+
+	posAndRot->rightDir = matWithDirsAsBases * changeMat_rotation[0];
+	posAndRot->upDir = matWithDirsAsBases * changeMat_rotation[1];
+	posAndRot->forwardDir = matWithDirsAsBases * changeMat_rotation[2];
+
+	// Do some checks to make sure rotation and position didn't mess anything up
+	FOURD_CHECK(abs(dot(posAndRot->pos, posAndRot->forwardDir)) <= 0.0001, "changeByMatrixDifference: forward is not orthogonal to pos");
+	FOURD_CHECK(abs(dot(posAndRot->pos, posAndRot->upDir)) <= 0.0001, "changeByMatrixDifference: up is not orthogonal to pos");
+	FOURD_CHECK(abs(dot(posAndRot->pos, posAndRot->rightDir)) <= 0.0001, "changeByMatrixDifference: right is not orthogonal to pos");
+	FOURD_CHECK(abs(dot(posAndRot->rightDir, posAndRot->upDir)) <= 0.0001, "changeByMatrixDifference: right is not orthogonal to up");
+	FOURD_CHECK(abs(dot(posAndRot->upDir, posAndRot->forwardDir)) <= 0.0001, "changeByMatrixDifference: up is not orthogonal to forward");
+	FOURD_CHECK(abs(dot(posAndRot->forwardDir, posAndRot->rightDir)) <= 0.0001, "changeByMatrixDifference: forward is not orthogonal to right");
+}
+
+bool isFourDValidationEnabled() {
+	return FOURD_VALIDATION != 0;
+}
@@ -0,0 +1,319 @@
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "CPURaytracer.h"
+#include "RayPacket.h"
+#include "SphereBVH.h"
+#include "TestSupport.h"
+#include "ViewConstants.h"
+
+/**
+ * Tests of the closest-hit and any-hit queries, run by ctest. The bounding-cap hierarchy has to
+ * find exactly what the linear loop over every sphere finds, right after build() and after every
+ * frame of refit() on spheres that keep moving, and the packet kernels have to agree with the
+ * scalar sphereHitDistance() except on rays that graze a sphere. See TestSupport.h for the
+ * command line; the iterations are random rays.
+ */
+
+/** Random scenes, rays, moves and cameras, all from one seed. */
+class RandomCases : public TestRandom {
+public:
+	explicit RandomCases(unsigned seed) : TestRandom(seed) {}
+
+	/** Rays that start anywhere on the 3-sphere, with tangent directions. */
+	std::vector<Ray> rays(int count) {
+		std::vector<Ray> rays;
+		for (int i = 0; i < count; i++) {
+			vec4 origin = unitVector();
+			rays.push_back({ origin, orthogonalTo(origin) });
+		}
+		return rays;
+	}
+};
+
+static std::vector<PackedSphere> packSpheres(const std::vector<Sphere>& spheres) {
+	std::vector<PackedSphere> packed;
+	for (const Sphere& sphere : spheres) {
+		packed.push_back(packSphere(sphere));
+	}
+	return packed;
+}
+
+/** Whether the ray passes within epsilon of the edge of the sphere, where float error decides hit or miss. */
+static bool grazes(const Sphere& sphere, const Ray& ray, double epsilon) {
+	double A = 0, B = 0;
+	for (int c = 0; c < 4; c++) {
+		A += (double)sphere.center[c] * ray.direction[c];
+		B += (double)sphere.center[c] * ray.origin[c];
+	}
+	double C = std::cos((double)sphere.radius);
+	return std::abs(std::abs(C) / std::sqrt(A * A + B * B) - 1.0) <= epsilon;
+}
+
+/**
+ * The packet kernel at each width against sphereHitDistance(). Their atan/asin differ in the
+ * last few bits, so a ray may pick another sphere only if it grazes one of the two, or if both
+ * are hit at nearly the same t.
+ */
+template<class V>
+static void testPacketKernel(const std::string& name, const std::vector<Sphere>& spheres, const std::vector<Ray>& rays) {
+	std::vector<PackedSphere> packed = packSpheres(spheres);
+	for (int i = 0; i < (int)rays.size(); i += V::width) {
+		int count = std::min((int)V::width, (int)rays.size() - i);
+		V closestT, closestIndex;
+		findClosestHitPacket(packed, 1, RayPacketT<V>::gather(&rays[i], count), closestT, closestIndex);
+		float packetTs[V::width], packetIndices[V::width];
+		closestT.store(packetTs);
+		closestIndex.store(packetIndices);
+
+		for (int lane = 0; lane < count; lane++) {
+			const Ray& ray = rays[i + lane];
+			Hit scalar = { 99999999999999.f, -1 };
+			for (int s = 1; s < (int)spheres.size(); s++) {
+				float t = sphereHitDistance(spheres[s], ray);
+				if (t >= 0.f && t < scalar.dist) {
+					scalar = { t, s };
+				}
+			}
+			int packetIndex = (int)packetIndices[lane];
+			if (packetIndex == scalar.objectIndex) {
+				expect(scalar.objectIndex < 0 || abs(packetTs[lane] - scalar.dist) <= 1e-3f, name + " found sphere "
+					+ std::to_string(packetIndex) + " at t " + std::to_string(packetTs[lane]) + " instead of " + std::to_string(scalar.dist));
+				continue;
+			}
+			bool explained = (packetIndex >= 0 && grazes(spheres[packetIndex], ray, 1e-4))
+				|| (scalar.objectIndex >= 0 && grazes(spheres[scalar.objectIndex], ray, 1e-4))
+				|| (packetIndex >= 0 && scalar.objectIndex >= 0 && abs(packetTs[lane] - scalar.dist) <= 1e-3f);
+			expect(explained, name + " picked sphere " + std::to_string(packetIndex) + " where the scalar loop picked "
+				+ std::to_string(scalar.objectIndex) + " (ray " + std::to_string(i + lane) + ")");
+		}
+	}
+}
+
+/**
+ * Every sphere in the hierarchy is in exactly one leaf reachable from the root, and inside the
+ * cap of that leaf and of every node above it.
+ */
+static void checkHierarchyStructure(const SphereBVH& bvh, const std::vector<Sphere>& spheres, const std::string& when) {
+	const std::vector<SphereBVH::Node>& nodes = bvh.getNodes();
+	const std::vector<int>& sphereIndices = bvh.getSphereIndices();
+	std::vector<int> timesFound(spheres.size(), 0);
+
+	struct Entry {
+		int node;
+		int depth;
+	};
+	std::vector<Entry> stack = { { 0, 0 } };
+	std::vector<int> path(SphereBVH::MAX_DEPTH + 1);
+	bool capsHold = true;
+	while (!stack.empty()) {
+		Entry entry = stack.back();
+		stack.pop_back();
+		if (!expect(entry.depth <= SphereBVH::MAX_DEPTH, "the hierarchy is deeper than MAX_DEPTH " + when)) {
+			return;
+		}
+		path[entry.depth] = entry.node;
+		const SphereBVH::Node& node = nodes[entry.node];
+		if (node.count == 0) {
+			stack.push_back({ node.first + 1, entry.depth + 1 });
+			stack.push_back({ node.first, entry.depth + 1 });
+			continue;
+		}
+
+		for (int i = node.first; i < node.first + node.count; i++) {
+			int sphereIndex = sphereIndices[i];
+			timesFound[sphereIndex]++;
+			const Sphere& sphere = spheres[sphereIndex];
+			for (int depth = 0; depth <= entry.depth && capsHold; depth++) {
+				const SphereBVH::Node& ancestor = nodes[path[depth]];
+				float distance = acos(clamp(dot(ancestor.center, normalize(sphere.center)), -1.0f, 1.0f));
+				// A cap of radius pi is the whole 3-sphere
+				capsHold = expect(ancestor.radius >= PI || distance + sphere.radius <= ancestor.radius + 1e-4f, "sphere " + std::to_string(sphereIndex)
+					+ " sticks out of the cap of node " + std::to_string(path[depth]) + " " + when);
+			}
+		}
+	}
+
+	for (int i = 1; i < (int)spheres.size(); i++) {
+		if (!expect(timesFound[i] == 1, "sphere " + std::to_string(i) + " is in " + std::to_string(timesFound[i]) + " leaves " + when)) {
+			return;
+		}
+	}
+}
+
+/**
+ * Closest hits and any-hits through the hierarchy against the linear loop. Both test spheres with
+ * the same kernel, so the closest t has to be exactly the same, and only a tie may pick another
+ * sphere.
+ */
+template<class V>
+static void checkHierarchyQueries(const SphereBVH& bvh, const std::vector<PackedSphere>& spheres, const std::vector<Ray>& rays,
+	RandomCases& random, const std::string& when) {
+	for (int i = 0; i < (int)rays.size(); i += V::width) {
+		int count = std::min((int)V::width, (int)rays.size() - i);
+		RayPacketT<V> packet = RayPacketT<V>::gather(&rays[i], count);
+
+		V linearT, linearIndex;
+		findClosestHitPacket(spheres, 1, packet, linearT, linearIndex);
+		V bvhT(99999999999999.f), bvhIndex(-1.0f);
+		bvh.findClosestHit(spheres, packet, bvhT, bvhIndex);
+
+		float linearTs[V::width], bvhTs[V::width], linearIndices[V::width], bvhIndices[V::width];
+		linearT.store(linearTs);
+		bvhT.store(bvhTs);
+		linearIndex.store(linearIndices);
+		bvhIndex.store(bvhIndices);
+		for (int lane = 0; lane < count; lane++) {
+			expect(bvhTs[lane] == linearTs[lane], "the hierarchy found sphere " + std::to_string((int)bvhIndices[lane]) + " at t "
+				+ std::to_string(bvhTs[lane]) + ", the linear loop sphere " + std::to_string((int)linearIndices[lane]) + " at t "
+				+ std::to_string(linearTs[lane]) + " (ray " + std::to_string(i + lane) + ") " + when);
+		}
+
+		// Any-hit, up to a random t and ignoring a random sphere (often the one hit first)
+		float tMaxes[V::width], ignored[V::width];
+		for (int lane = 0; lane < V::width; lane++) {
+			tMaxes[lane] = random.uniform() * TWO_PI;
+			ignored[lane] = random.uniform() < 0.5f ? linearIndices[lane] : (float)(int)(random.uniform() * spheres.size());
+		}
+		V tMax = V::load(tMaxes), ignoredIndex = V::load(ignored);
+		typename V::mask linearOccluded = V(0.0f) < V(0.0f);
+		for (int s = 1; s < (int)spheres.size(); s++) {
+			linearOccluded = linearOccluded | andnot(V((float)s) == ignoredIndex, anyHitSpherePacket(spheres[s], packet, tMax));
+		}
+		int expected = bits(linearOccluded) & ((1 << count) - 1);
+		int actual = bits(bvh.anyHit(spheres, packet, tMax, ignoredIndex)) & ((1 << count) - 1);
+		expect(actual == expected, "the hierarchy's any-hit disagrees with the linear loop on rays " + std::to_string(i) + "-"
+			+ std::to_string(i + count - 1) + " " + when);
+	}
+}
+
+/** Primary rays of a random camera, with the leaf spheres tested in the camera frame, against the linear loop. */
+static void checkCameraFrameQueries(const SphereBVH& bvh, const std::vector<PackedSphere>& spheres, RandomCases& random,
+	int numRays, const std::string& when) {
+	CurvedWorldPosAndRot view = random.camera();
+	ViewConstants viewConstants = makeViewConstants(view, perspective(radians(90.0f), 1.0f, 0.1f, 100.0f), 64.0f, 64.0f);
+	mat4 toCameraFrame = transpose(viewConstants.fromCameraFrame);
+
+	std::vector<CameraFrameSphere> cameraSpheres;
+	for (int s = 0; s < (int)spheres.size(); s++) {
+		cameraSpheres.push_back(makeCameraFrameSphere(spheres[s], s, toCameraFrame));
+	}
+
+	std::vector<vec3> directions;
+	std::vector<Ray> rays;
+	for (int i = 0; i < numRays; i++) {
+		directions.push_back(cameraRayDirectionAt(viewConstants, vec2(64.0f * random.uniform(), 64.0f * random.uniform())));
+		rays.push_back({ viewConstants.fromCameraFrame[0], viewConstants.fromCameraFrame * vec4(0, directions.back()) });
+	}
+
+	for (int i = 0; i < numRays; i += floatv::width) {
+		int count = std::min((int)floatv::width, numRays - i);
+		CameraRayPacketT<floatv> cameraPacket = CameraRayPacketT<floatv>::gather(&directions[i], count);
+
+		floatv linearT, linearIndex;
+		findClosestCameraFrameHitPacket(cameraSpheres, 1, cameraPacket, linearT, linearIndex);
+		floatv bvhT(99999999999999.f), bvhIndex(-1.0f);
+		bvh.findClosestHit(cameraSpheres, RayPacket::gather(&rays[i], count), cameraPacket, bvhT, bvhIndex);
+
+		float linearTs[floatv::width], bvhTs[floatv::width];
+		linearT.store(linearTs);
+		bvhT.store(bvhTs);
+		for (int lane = 0; lane < count; lane++) {
+			expect(bvhTs[lane] == linearTs[lane], "in the camera frame the hierarchy found t " + std::to_string(bvhTs[lane])
+				+ ", the linear loop t " + std::to_string(linearTs[lane]) + " (ray " + std::to_string(i + lane) + ") " + when);
+		}
+	}
+}
+
+static void testHierarchy(RandomCases& random, int numRays) {
+	for (int numSpheres : { 1, 7, 300, 3000 }) {
+		Scene scene = makeRandomScene(numSpheres, random.seed());
+		std::vector<PackedSphere> spheres = packSpheres(scene.spheres);
+		std::string when = "after building over " + std::to_string(numSpheres) + " spheres";
+
+		SphereBVH bvh;
+		bvh.build(scene.spheres, 1);
+		checkHierarchyStructure(bvh, scene.spheres, when);
+		std::vector<Ray> rays = random.rays(numRays);
+		checkHierarchyQueries<float1v>(bvh, spheres, rays, random, when + ", single rays");
+		checkHierarchyQueries<floatv>(bvh, spheres, rays, random, when + ", packets");
+		checkCameraFrameQueries(bvh, spheres, random, numRays, when);
+	}
+}
+
+/**
+ * Spheres moving along geodesics, some of them quickly enough to leave their neighbours, with
+ * the hierarchy refitted every frame for only the spheres that moved (and the odd one that
+ * changed size). Every frame has to answer like the linear loop, and over the run refit() has
+ * to have gone through its subtree and full rebuilds too.
+ */
+static void testRefit(RandomCases& random, int numRays) {
+	const int numFrames = 90;
+	const float frameTime = 1.0f / 30.0f;
+	const int checkEvery = 5;
+
+	Scene scene = makeRandomScene(2000, random.seed());
+	std::vector<SphereMotion> motions;
+	for (int i = 1; i < (int)scene.spheres.size(); i++) {
+		float kind = random.uniform();
+		if (kind < 0.7f) {
+			continue;
+		}
+		vec4 start = scene.spheres[i].center;
+		// Most drift; a few cross the 3-sphere within the run
+		float speed = kind < 0.97f ? 0.05f + 0.2f * random.uniform() : 1.0f + 2.0f * random.uniform();
+		motions.push_back({ i, start, random.orthogonalTo(start), speed });
+	}
+
+	SphereBVH bvh;
+	bvh.build(scene.spheres, 1);
+	int rebuiltSubtrees = 0, fullRebuilds = 0;
+	for (int frame = 1; frame <= numFrames; frame++) {
+		std::vector<int> moved;
+		for (const SphereMotion& motion : motions) {
+			// Some frames skip some spheres, so not every refit sees the same set
+			if (random.uniform() < 0.2f) {
+				continue;
+			}
+			scene.spheres[motion.sphereIndex].center = motion.centerAt(frame * frameTime);
+			moved.push_back(motion.sphereIndex);
+		}
+		for (int i = 0; i < 5; i++) {
+			int sphereIndex = 1 + (int)(random.uniform() * (scene.spheres.size() - 1));
+			scene.spheres[sphereIndex].radius *= 0.5f + random.uniform();
+			moved.push_back(sphereIndex);
+		}
+
+		SphereBVH::RefitStats stats = bvh.refit(scene.spheres, moved);
+		rebuiltSubtrees += stats.rebuiltSubtrees;
+		fullRebuilds += stats.fullRebuild;
+
+		if (frame % checkEvery == 0 || stats.rebuiltSubtrees > 0 || stats.fullRebuild) {
+			std::string when = "after refitting frame " + std::to_string(frame);
+			std::vector<PackedSphere> spheres = packSpheres(scene.spheres);
+			checkHierarchyStructure(bvh, scene.spheres, when);
+			checkHierarchyQueries<floatv>(bvh, spheres, random.rays(numRays), random, when);
+			checkCameraFrameQueries(bvh, spheres, random, numRays, when);
+		}
+	}
+	expect(rebuiltSubtrees > 0, "no subtree was rebuilt over " + std::to_string(numFrames) + " frames of refits");
+	expect(fullRebuilds > 0, "the tree was never rebuilt over " + std::to_string(numFrames) + " frames of refits");
+	std::cout << "refit: " << rebuiltSubtrees << " subtree and " << fullRebuilds << " full rebuilds over "
+		<< numFrames << " frames" << std::endl;
+}
+
+int main(int argc, char **argv) {
+	return runTests(argc, argv, "random rays", [](unsigned seed, int iterations) {
+		RandomCases random(seed);
+
+		Scene scene = makeRandomScene(300, random.seed());
+		std::vector<Ray> rays = random.rays(iterations);
+		testPacketKernel<float1v>("the single-ray kernel", scene.spheres, rays);
+		testPacketKernel<floatv>("the packet kernel", scene.spheres, rays);
+
+		testHierarchy(random, iterations);
+		testRefit(random, iterations);
+	});
+}
@@ -0,0 +1,1010 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <map>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "4DUtils.h"
+#include "CPURaytracer.h"
+#include "EventRecording.h"
+#include "PosePredictor.h"
+#include "RayPacket.h"
+#include "SO4.h"
+#include "SO4Batch.h"
+#include "SphereBVH.h"
+#include "ViewConstants.h"
+
+/**
+ * Throughput benchmark for the CPU raytracer: closest-hit queries with the scalar
+ * SphereHitDistance port against the SIMD packet kernel at every width this build supports,
+ * followed by full-frame renders (of scenes of each size, on 1 core up to all of them), shadow
+ * queries, the bounding-cap hierarchy and refitting it, and finally single-plane rotations and
+ * camera updates with four vectors against an SO4 rotor, batched SO4 rotations of many
+ * objects on 1 core up to all of them, and how far off head-pose prediction is on head traces
+ * (synthetic ones, and a recording from the VR app with --head-trace).
+ *
+ * --json saves every result; --compare reads such a file back, from a run with the same
+ * arguments, and exits with 2 if any result got worse by more than --threshold percent.
+ */
+
+typedef std::chrono::steady_clock Clock;
+
+static double secondsSince(Clock::time_point start) {
+	return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+/** A printed number, named by the section it was printed in and its label there. */
+struct BenchmarkResult {
+	std::string name;
+	double value;
+	std::string unit;
+	bool higherIsBetter;
+};
+
+static std::vector<BenchmarkResult> results;
+static std::string currentSection;
+
+static void beginSection(const std::string& title) {
+	currentSection = title;
+	std::cout << std::endl << title << std::endl;
+}
+
+static void recordResult(const std::string& label, double value, const std::string& unit, bool higherIsBetter) {
+	size_t start = label.find_first_not_of(' ');
+	std::string name = currentSection + " / " + (start == std::string::npos ? label : label.substr(start));
+	results.push_back({ name, value, unit, higherIsBetter });
+}
+
+static std::string formatNumber(double value) {
+	std::ostringstream out;
+	out << value;
+	return out.str();
+}
+
+/** 1, 2, 4, ... threads, and every core. */
+static std::vector<int> threadCounts() {
+	std::vector<int> counts;
+	int numCores = (int)std::max(1u, std::thread::hardware_concurrency());
+	for (int threads = 1; threads < numCores; threads *= 2) {
+		counts.push_back(threads);
+	}
+	counts.push_back(numCores);
+	return counts;
+}
+
+static std::string onThreads(int threads) {
+	return ", " + std::to_string(threads) + (threads == 1 ? " thread" : " threads");
+}
+
+/** Random unit rays; the origins are all on the 3-sphere and the directions are tangent to them. */
+static std::vector<Ray> makeRandomRays(int count, unsigned seed) {
+	std::mt19937 rng(seed);
+	std::normal_distribution<float> gaussian;
+	auto randomPoint = [&]() { return normalize(vec4(gaussian(rng), gaussian(rng), gaussian(rng), gaussian(rng))); };
+
+	std::vector<Ray> rays;
+	rays.reserve(count);
+	for (int i = 0; i < count; i++) {
+		vec4 origin = randomPoint();
+		vec4 direction = randomPoint();
+		direction = normalize(direction - dot(direction, origin) * origin);
+		rays.push_back({ origin, direction });
+	}
+	return rays;
+}
+
+static void report(const std::string& name, int numRays, double seconds, double baselineSeconds) {
+	recordResult(name, numRays / seconds / 1e6, "Mrays/s", true);
+	std::cout << std::left << std::setw(28) << name << std::right
+		<< std::setw(12) << std::fixed << std::setprecision(2) << numRays / seconds / 1e6 << " Mrays/s"
+		<< std::setw(10) << std::setprecision(2) << baselineSeconds / seconds << "x" << std::endl;
+}
+
+template<class V>
+static void benchmarkPacketWidth(const std::string& name, const CPURaytracer& raytracer, const std::vector<Ray>& rays,
+	const std::vector<int>& referenceIndices, double scalarSeconds) {
+	const std::vector<PackedSphere>& spheres = raytracer.getPackedSpheres();
+	int numRays = (int)rays.size();
+
+	int mismatches = 0;
+	float indices[V::width];
+	Clock::time_point start = Clock::now();
+	for (int i = 0; i < numRays; i += V::width) {
+		int count = std::min((int)V::width, numRays - i);
+		V closestT, closestIndex;
+		findClosestHitPacket(spheres, 1, RayPacketT<V>::gather(&rays[i], count), closestT, closestIndex);
+		closestIndex.store(indices);
+		for (int lane = 0; lane < count; lane++) {
+			mismatches += (int)indices[lane] != referenceIndices[i + lane];
+		}
+	}
+	double seconds = secondsSince(start);
+
+	report(name, numRays, seconds, scalarSeconds);
+	if (mismatches > 0) {
+		std::cout << "    (" << mismatches << " rays picked a different sphere than the scalar path)" << std::endl;
+	}
+}
+
+template<class V>
+static double timeBVHClosestHits(const SphereBVH& bvh, const std::vector<PackedSphere>& spheres, const std::vector<Ray>& rays,
+	std::vector<int>& indices) {
+	int numRays = (int)rays.size();
+	indices.resize(numRays);
+	float laneIndices[V::width];
+
+	Clock::time_point start = Clock::now();
+	for (int i = 0; i < numRays; i += V::width) {
+		int count = std::min((int)V::width, numRays - i);
+		V closestT(99999999999999.f), closestIndex(-1.0f);
+		bvh.findClosestHit(spheres, RayPacketT<V>::gather(&rays[i], count), closestT, closestIndex);
+		closestIndex.store(laneIndices);
+		for (int lane = 0; lane < count; lane++) {
+			indices[i + lane] = (int)laneIndices[lane];
+		}
+	}
+	return secondsSince(start);
+}
+
+/** Build time and closest-hit throughput of the bounding-cap hierarchy against the linear loop. */
+static void benchmarkBVH(int numSpheres, int numRays) {
+	Scene scene = makeRandomScene(numSpheres, 42);
+	std::vector<PackedSphere> spheres;
+	for (const Sphere& sphere : scene.spheres) {
+		spheres.push_back(packSphere(sphere));
+	}
+	std::vector<Ray> rays = makeRandomRays(numRays, 99);
+
+	beginSection("Bounding-cap hierarchy, " + std::to_string(scene.spheres.size()) + " spheres, " + std::to_string(numRays) + " random rays");
+
+	SphereBVH bvh;
+	Clock::time_point start = Clock::now();
+	bvh.build(scene.spheres, 1, 1);
+	double serialBuildSeconds = secondsSince(start);
+	start = Clock::now();
+	bvh.build(scene.spheres, 1);
+	double parallelBuildSeconds = secondsSince(start);
+	recordResult("build, 1 thread", serialBuildSeconds * 1000.0, "ms", false);
+	recordResult("build, all cores", parallelBuildSeconds * 1000.0, "ms", false);
+	std::cout << "  build " << std::setprecision(1) << serialBuildSeconds * 1000.0 << " ms on 1 thread, "
+		<< parallelBuildSeconds * 1000.0 << " ms on all cores, " << bvh.getNodes().size() << " nodes, SAH cost "
+		<< std::setprecision(2) << bvh.computeCost() << std::endl;
+
+	std::vector<int> scalarIndices, packetIndices;
+	double scalarSeconds = timeBVHClosestHits<float1v>(bvh, spheres, rays, scalarIndices);
+	double packetSeconds = timeBVHClosestHits<floatv>(bvh, spheres, rays, packetIndices);
+
+	// The linear loop gets slow quickly, so only compare against it on a subset
+	int numLinearRays = std::min(numRays, std::max(64, (int)(20000000LL / (long long)spheres.size())));
+	int mismatches = 0;
+	start = Clock::now();
+	for (int i = 0; i < numLinearRays; i++) {
+		float1v closestT, closestIndex;
+		findClosestHitPacket(spheres, 1, RayPacketT<float1v>::gather(&rays[i], 1), closestT, closestIndex);
+		mismatches += (int)closestIndex.v != scalarIndices[i];
+	}
+	double linearSeconds = secondsSince(start) * numRays / numLinearRays;
+
+	report("  linear loop", numRays, linearSeconds, linearSeconds);
+	report("  hierarchy, single rays", numRays, scalarSeconds, linearSeconds);
+	report("  hierarchy, packets", numRays, packetSeconds, linearSeconds);
+	if (mismatches > 0) {
+		std::cout << "    (" << mismatches << " of " << numLinearRays << " rays picked a different sphere than the linear loop)" << std::endl;
+	}
+}
+
+/**
+ * Random spheres moving along geodesics at 90 Hz: refitting the hierarchy for the spheres that
+ * moved against rebuilding it every frame, and how the tree's cost holds up.
+ */
+static void benchmarkBVHRefit(int numSpheres, int numRays) {
+	const int numFrames = 90;
+	const float frameTime = 1.0f / 90.0f;
+	Scene startScene = makeRandomScene(numSpheres, 42);
+	std::vector<Ray> rays = makeRandomRays(numRays, 5);
+	std::mt19937 rng(11);
+	std::normal_distribution<float> gaussian;
+	std::uniform_real_distribution<float> uniform;
+
+	beginSection("Refitting the hierarchy, " + std::to_string(startScene.spheres.size()) + " spheres, " + std::to_string(numFrames) + " frames at 90 Hz");
+	const std::string section = currentSection;
+
+	for (float movingFraction : { 0.01f, 0.1f, 1.0f }) {
+		Scene scene = startScene;
+		std::vector<SphereMotion> motions;
+		std::vector<int> movingSpheres;
+		for (int i = 1; i < (int)scene.spheres.size(); i++) {
+			if (uniform(rng) >= movingFraction) {
+				continue;
+			}
+			vec4 start = scene.spheres[i].center;
+			vec4 direction = vec4(gaussian(rng), gaussian(rng), gaussian(rng), gaussian(rng));
+			direction = normalize(direction - dot(direction, start) * start);
+			motions.push_back({ i, start, direction, 0.2f + 0.3f * uniform(rng) });
+			movingSpheres.push_back(i);
+		}
+
+		SphereBVH refitted, rebuilt;
+		refitted.build(scene.spheres, 1, 1);
+		double refitSeconds = 0, rebuildSeconds = 0;
+		int rebuiltSubtrees = 0, fullRebuilds = 0;
+		for (int frame = 1; frame <= numFrames; frame++) {
+			for (const SphereMotion& motion : motions) {
+				scene.spheres[motion.sphereIndex].center = motion.centerAt(frame * frameTime);
+			}
+			Clock::time_point start = Clock::now();
+			SphereBVH::RefitStats stats = refitted.refit(scene.spheres, movingSpheres);
+			refitSeconds += secondsSince(start);
+			rebuiltSubtrees += stats.rebuiltSubtrees;
+			fullRebuilds += stats.fullRebuild;
+
+			start = Clock::now();
+			rebuilt.build(scene.spheres, 1, 1);
+			rebuildSeconds += secondsSince(start);
+		}
+
+		currentSection = section + ", " + std::to_string((int)(movingFraction * 100)) + "% moving";
+		recordResult("refit", refitSeconds / numFrames * 1000.0, "ms/frame", false);
+		recordResult("rebuild", rebuildSeconds / numFrames * 1000.0, "ms/frame", false);
+		recordResult("SAH cost refitted", refitted.computeCost(), "", false);
+
+		std::cout << "  " << std::setw(3) << (int)(movingFraction * 100) << "% moving (" << movingSpheres.size() << "): refit "
+			<< std::setprecision(3) << refitSeconds / numFrames * 1000.0 << " ms/frame, rebuild " << rebuildSeconds / numFrames * 1000.0
+			<< " ms/frame (" << std::setprecision(1) << rebuildSeconds / refitSeconds << "x)" << std::endl;
+		std::cout << "      SAH cost refitted " << std::setprecision(2) << refitted.computeCost() << " (at last build "
+			<< refitted.getBuildCost() << "), rebuilt " << rebuilt.computeCost() << ", " << rebuiltSubtrees
+			<< " subtree and " << fullRebuilds << " full rebuilds" << std::endl;
+
+		// Both trees have to find the same spheres
+		std::vector<PackedSphere> spheres;
+		for (const Sphere& sphere : scene.spheres) {
+			spheres.push_back(packSphere(sphere));
+		}
+		std::vector<int> refittedIndices, rebuiltIndices;
+		double refittedSeconds = timeBVHClosestHits<floatv>(refitted, spheres, rays, refittedIndices);
+		double rebuiltSeconds = timeBVHClosestHits<floatv>(rebuilt, spheres, rays, rebuiltIndices);
+		int mismatches = 0;
+		for (int i = 0; i < numRays; i++) {
+			mismatches += refittedIndices[i] != rebuiltIndices[i];
+		}
+		report("      traversal, refitted", numRays, refittedSeconds, rebuiltSeconds);
+		if (mismatches > 0) {
+			std::cout << "    (" << mismatches << " rays picked a different sphere than the rebuilt tree)" << std::endl;
+		}
+	}
+}
+
+/** Closest-hit queries for one frame of primary rays, in world space against the camera frame. */
+static void benchmarkPrimaryRays(const CPURaytracer& raytracer, const CurvedWorldPosAndRot& view, const mat4& projectionMat,
+	int width, int height) {
+	const std::vector<PackedSphere>& spheres = raytracer.getPackedSpheres();
+	ViewConstants viewConstants = makeViewConstants(view, projectionMat, (float)width, (float)height);
+	mat4 toCameraFrame = cameraFrameRotation(view);
+
+	std::vector<Ray> rays;
+	std::vector<vec3> cameraDirs;
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			vec4 dir = normalize(rayDirectionAt(viewConstants, vec2(x + 0.5f, y + 0.5f)));
+			vec4 cameraDir = toCameraFrame * dir;
+			rays.push_back({ viewConstants.userPos, dir });
+			cameraDirs.push_back(normalize(vec3(cameraDir.y, cameraDir.z, cameraDir.w)));
+		}
+	}
+	int numRays = (int)rays.size();
+
+	std::vector<int> worldIndices(numRays);
+	float laneIndices[floatv::width];
+	Clock::time_point start = Clock::now();
+	for (int i = 0; i < numRays; i += floatv::width) {
+		int count = std::min((int)floatv::width, numRays - i);
+		floatv closestT, closestIndex;
+		findClosestHitPacket(spheres, 1, RayPacket::gather(&rays[i], count), closestT, closestIndex);
+		closestIndex.store(laneIndices);
+		std::copy(laneIndices, laneIndices + count, worldIndices.begin() + i);
+	}
+	double worldSeconds = secondsSince(start);
+
+	int mismatches = 0;
+	start = Clock::now();
+	std::vector<CameraFrameSphere> cameraSpheres;
+	for (int i = 0; i < (int)spheres.size(); i++) {
+		cameraSpheres.push_back(makeCameraFrameSphere(spheres[i], i, toCameraFrame));
+	}
+	for (int i = 0; i < numRays; i += floatv::width) {
+		int count = std::min((int)floatv::width, numRays - i);
+		floatv closestT, closestIndex;
+		findClosestCameraFrameHitPacket(cameraSpheres, 1, CameraRayPacketT<floatv>::gather(&cameraDirs[i], count), closestT, closestIndex);
+		closestIndex.store(laneIndices);
+		for (int lane = 0; lane < count; lane++) {
+			mismatches += (int)laneIndices[lane] != worldIndices[i + lane];
+		}
+	}
+	double cameraSeconds = secondsSince(start);
+
+	beginSection("Primary rays " + std::to_string(width) + "x" + std::to_string(height) + ", closest hit only, 1 thread");
+	report("  world space", numRays, worldSeconds, worldSeconds);
+	report("  camera frame", numRays, cameraSeconds, worldSeconds);
+	if (mismatches > 0) {
+		std::cout << "    (" << mismatches << " rays picked a different sphere)" << std::endl;
+	}
+}
+
+/** Full frames with shadow rays tested by a closest-hit search against the any-hit query. */
+static void benchmarkShadows(const std::string& name, const Scene& scene, int width, int height) {
+	RaytracerParams params;
+	params.reflectionCount = 4;
+	CPURaytracer raytracer(scene, params);
+
+	beginSection("Shadow rays, " + name + " (" + std::to_string(scene.spheres.size()) + " spheres), " + std::to_string(width) + "x"
+		+ std::to_string(height) + ", reflection count " + std::to_string(params.reflectionCount));
+
+	CurvedWorldPosAndRot view = { vec4(0,1,0,0), vec4(1,0,0,0), vec4(0,0,0,1), vec4(0,0,1,0) };
+	mat4 projectionMat = perspective(radians(90.0f), (float)width / height, 0.1f, 100.0f);
+	std::vector<vec3> closestHitPixels, anyHitPixels;
+
+	raytracer.setClosestHitShadows(true);
+	Clock::time_point start = Clock::now();
+	raytracer.render(view, projectionMat, width, height, closestHitPixels);
+	double closestHitSeconds = secondsSince(start);
+	report("  closest-hit shadows", width * height, closestHitSeconds, closestHitSeconds);
+
+	raytracer.setClosestHitShadows(false);
+	start = Clock::now();
+	raytracer.render(view, projectionMat, width, height, anyHitPixels);
+	report("  any-hit shadows", width * height, secondsSince(start), closestHitSeconds);
+
+	int differentPixels = 0;
+	for (size_t i = 0; i < anyHitPixels.size(); i++) {
+		differentPixels += anyHitPixels[i] != closestHitPixels[i];
+	}
+	if (differentPixels > 0) {
+		std::cout << "    (" << differentPixels << " pixels differ)" << std::endl;
+	}
+}
+
+/**
+ * Full frames of the default scene and of random scenes of each size, on 1 thread up to every
+ * core. The baseline is 1 thread.
+ */
+static void benchmarkFrameScaling(const std::vector<int>& sceneSizes, int width, int height) {
+	CurvedWorldPosAndRot view = { vec4(0,1,0,0), vec4(1,0,0,0), vec4(0,0,0,1), vec4(0,0,1,0) };
+	mat4 projectionMat = perspective(radians(90.0f), (float)width / height, 0.1f, 100.0f);
+	std::vector<vec3> pixels;
+
+	std::vector<int> sizes = { 0 };
+	sizes.insert(sizes.end(), sceneSizes.begin(), sceneSizes.end());
+	for (int numSpheres : sizes) {
+		Scene scene = numSpheres == 0 ? makeDefaultScene() : makeRandomScene(numSpheres, 42);
+		CPURaytracer raytracer(scene);
+		beginSection("Full frame " + std::to_string(width) + "x" + std::to_string(height) + ", "
+			+ (numSpheres == 0 ? "default scene" : "random scene") + " (" + std::to_string(scene.spheres.size()) + " spheres)");
+
+		double oneThreadSeconds = 0;
+		for (int threads : threadCounts()) {
+			Clock::time_point start = Clock::now();
+			raytracer.render(view, projectionMat, width, height, pixels, threads);
+			double seconds = secondsSince(start);
+			oneThreadSeconds = threads == 1 ? seconds : oneThreadSeconds;
+			report("  packet tracing" + onThreads(threads), width * height, seconds, oneThreadSeconds);
+		}
+
+		// Primary rays in world space instead of the camera frame, on 1 thread
+		raytracer.setCameraFramePrimaryRays(false);
+		Clock::time_point start = Clock::now();
+		raytracer.render(view, projectionMat, width, height, pixels, 1);
+		report("  world space" + onThreads(1), width * height, secondsSince(start), oneThreadSeconds);
+	}
+}
+
+/** How far pos, forwardDir, upDir and rightDir are from orthonormal (largest error of any dot product). */
+static float orthonormalityError(const CurvedWorldPosAndRot& posAndRot) {
+	vec4 axes[4] = { posAndRot.pos, posAndRot.forwardDir, posAndRot.upDir, posAndRot.rightDir };
+	float error = 0;
+	for (int i = 0; i < 4; i++) {
+		for (int j = 0; j <= i; j++) {
+			error = std::max(error, abs(dot(axes[i], axes[j]) - (i == j ? 1.0f : 0.0f)));
+		}
+	}
+	return error;
+}
+
+static void reportUpdates(const std::string& name, int numUpdates, double seconds, double baselineSeconds, float error) {
+	recordResult(name, seconds / numUpdates * 1e9, "ns/update", false);
+	std::cout << std::left << std::setw(28) << name << std::right
+		<< std::setw(12) << std::fixed << std::setprecision(1) << seconds / numUpdates * 1e9 << " ns/update"
+		<< std::setw(8) << std::setprecision(2) << baselineSeconds / seconds << "x"
+		<< "    drift " << std::scientific << std::setprecision(1) << error << std::fixed << std::endl;
+}
+
+/**
+ * A camera turned in random planes: the angle from rotate4DSinglePlane's arguments, a given
+ * angle with rotate4DSinglePlaneSpecificAngle, and the same rotation as an SO4 applied to
+ * each vector.
+ */
+static void benchmarkPlaneRotations(int numRotations) {
+	beginSection("Single-plane rotations of a camera, " + std::to_string(numRotations) + " random planes");
+
+	std::mt19937 rng(3);
+	std::normal_distribution<float> gaussian;
+	// Small turns, but not so small that from and to (below) are too close to give a plane
+	std::uniform_real_distribution<float> angles(0.02f, 0.1f);
+	auto randomPoint = [&]() { return normalize(vec4(gaussian(rng), gaussian(rng), gaussian(rng), gaussian(rng))); };
+	struct Plane {
+		vec4 from;
+		vec4 to;
+		float angle;
+	};
+	std::vector<Plane> planes(1024);
+	for (Plane& plane : planes) {
+		plane.from = randomPoint();
+		vec4 to = randomPoint();
+		plane.to = normalize(to - dot(to, plane.from) * plane.from);
+		plane.angle = (rng() & 1) ? angles(rng) : -angles(rng);
+	}
+
+	const CurvedWorldPosAndRot start = { vec4(0,1,0,0), vec4(1,0,0,0), vec4(0,0,0,1), vec4(0,0,1,0) };
+	CurvedWorldPosAndRot camera = start;
+	Clock::time_point startTime = Clock::now();
+	for (int i = 0; i < numRotations; i++) {
+		const Plane& plane = planes[i & 1023];
+		// Between from and a point angle along the plane, so it turns by the same angle as the others
+		vec4 to = cos(plane.angle) * plane.from + sin(plane.angle) * plane.to;
+		rotate4DSinglePlane(plane.from, to, { &camera.pos, &camera.forwardDir, &camera.upDir, &camera.rightDir });
+	}
+	double fromVectorsSeconds = secondsSince(startTime);
+	reportUpdates("  rotate4DSinglePlane", numRotations, fromVectorsSeconds, fromVectorsSeconds, orthonormalityError(camera));
+
+	camera = start;
+	startTime = Clock::now();
+	for (int i = 0; i < numRotations; i++) {
+		const Plane& plane = planes[i & 1023];
+		rotate4DSinglePlaneSpecificAngle(plane.from, plane.to, plane.angle, { &camera.pos, &camera.forwardDir, &camera.upDir, &camera.rightDir });
+	}
+	reportUpdates("  rotate4D...SpecificAngle", numRotations, secondsSince(startTime), fromVectorsSeconds, orthonormalityError(camera));
+
+	camera = start;
+	startTime = Clock::now();
+	for (int i = 0; i < numRotations; i++) {
+		const Plane& plane = planes[i & 1023];
+		SO4 rotation = planeRotation(plane.from, plane.to, plane.angle);
+		camera = { apply(rotation, camera.pos), apply(rotation, camera.forwardDir), apply(rotation, camera.upDir), apply(rotation, camera.rightDir) };
+	}
+	reportUpdates("  SO4 planeRotation", numRotations, secondsSince(startTime), fromVectorsSeconds, orthonormalityError(camera));
+}
+
+/**
+ * A random walk of head poses fed through changeByMatrixDifference, once on the four vectors
+ * of CurvedWorldPosAndRot and once on an SO4 (converted back every step, as it would be for
+ * upload). Drift is how far the final camera is from orthonormal.
+ */
+static void benchmarkCameraUpdates(int numUpdates) {
+	beginSection("Camera updates, " + std::to_string(numUpdates) + " random head moves");
+
+	std::mt19937 rng(99);
+	std::normal_distribution<float> gaussian;
+	// Each pose is built fresh from a normalized quaternion, like a tracker sample, so the
+	// inputs themselves are always rigid
+	std::vector<mat4> headMatrices(numUpdates + 1);
+	quat headRotation(1, 0, 0, 0);
+	vec3 headPosition(0);
+	for (mat4& headMatrix : headMatrices) {
+		headRotation = normalize(headRotation * quat(1.0f, 0.02f * gaussian(rng), 0.02f * gaussian(rng), 0.02f * gaussian(rng)));
+		headPosition += 0.01f * vec3(gaussian(rng), gaussian(rng), gaussian(rng));
+		headMatrix = mat4_cast(headRotation);
+		headMatrix[3] = vec4(headPosition, 1.0f);
+	}
+
+	const CurvedWorldPosAndRot start = { vec4(0,1,0,0), vec4(1,0,0,0), vec4(0,0,0,1), vec4(0,0,1,0) };
+
+	CurvedWorldPosAndRot vectors = start;
+	int vectorUpdates = 0;
+	Clock::time_point startTime = Clock::now();
+	try {
+		for (; vectorUpdates < numUpdates; vectorUpdates++) {
+			changeByMatrixDifference(headMatrices[vectorUpdates], headMatrices[vectorUpdates + 1], 1.0f, &vectors);
+		}
+	}
+	catch (const std::runtime_error& e) {
+		// Only with FOURD_VALIDATION: the four vectors drift until the checks trip, which is what
+		// the SO4 is for
+		std::cout << "  four vec4s stopped after " << vectorUpdates << " updates: " << e.what() << std::endl;
+	}
+	double vectorSeconds = secondsSince(startTime);
+	if (vectorUpdates > 0) {
+		// Scaled up to numUpdates if the checks stopped it early
+		vectorSeconds *= (double)numUpdates / vectorUpdates;
+		reportUpdates("  four vec4s", numUpdates, vectorSeconds, vectorSeconds, orthonormalityError(vectors));
+	}
+
+	SO4 rotor = fromPosAndRot(start);
+	CurvedWorldPosAndRot fromRotor = start;
+	float checksum = 0;
+	startTime = Clock::now();
+	for (int i = 0; i < numUpdates; i++) {
+		changeByMatrixDifference(headMatrices[i], headMatrices[i + 1], 1.0f, &rotor);
+		fromRotor = toPosAndRot(rotor);
+		checksum += fromRotor.pos.x;
+	}
+	double rotorSeconds = secondsSince(startTime);
+	reportUpdates("  SO4 rotor", numUpdates, rotorSeconds, vectorUpdates > 0 ? vectorSeconds : rotorSeconds, orthonormalityError(fromRotor));
+
+	// Both paths make the same moves, so they should end up in about the same place
+	std::cout << "    (final positions differ by " << std::scientific << std::setprecision(1)
+		<< length(fromRotor.pos - vectors.pos) << std::fixed << ", checksum " << checksum << ")" << std::endl;
+
+	// Composition alone: 4x4 matrix product against two quaternion products
+	std::vector<SO4> rotors(1024);
+	std::vector<mat4> matrices(rotors.size());
+	for (size_t i = 0; i < rotors.size(); i++) {
+		rotors[i] = normalize(SO4{ quat(gaussian(rng), gaussian(rng), gaussian(rng), gaussian(rng)),
+			quat(gaussian(rng), gaussian(rng), gaussian(rng), gaussian(rng)) });
+		matrices[i] = toMat4(rotors[i]);
+	}
+	mat4 matrixProduct(1.0f);
+	startTime = Clock::now();
+	for (int i = 0; i < numUpdates; i++) {
+		matrixProduct = matrixProduct * matrices[i & 1023];
+	}
+	double matrixSeconds = secondsSince(startTime);
+	SO4 rotorProduct = SO4::identity();
+	startTime = Clock::now();
+	for (int i = 0; i < numUpdates; i++) {
+		rotorProduct = rotorProduct * rotors[i & 1023];
+	}
+	double rotorProductSeconds = secondsSince(startTime);
+	reportUpdates("  compose mat4", numUpdates, matrixSeconds, matrixSeconds, 0);
+	reportUpdates("  compose SO4", numUpdates, rotorProductSeconds, matrixSeconds, 0);
+	std::cout << "    (" << matrixProduct[0][0] + rotorProduct.left.w << ")" << std::endl;
+}
+
+static void reportObjects(const std::string& name, size_t numObjects, double seconds, double baselineSeconds) {
+	recordResult(name, numObjects / (seconds * 1000.0), "objects/ms", true);
+	std::cout << std::left << std::setw(28) << name << std::right
+		<< std::setw(12) << std::fixed << std::setprecision(0) << numObjects / (seconds * 1000.0) << " objects/ms"
+		<< std::setw(8) << std::setprecision(2) << baselineSeconds / seconds << "x" << std::endl;
+}
+
+/**
+ * threadCounts() as the batch functions will actually run them for numObjects, each once:
+ * small batches are capped to fewer threads, so asking for more would only repeat a row.
+ */
+static std::vector<int> batchThreadCounts(size_t numObjects) {
+	std::vector<int> counts;
+	for (int threads : threadCounts()) {
+		int used = batchThreadCount(numObjects, threads);
+		if (counts.empty() || counts.back() != used) {
+			counts.push_back(used);
+		}
+	}
+	return counts;
+}
+
+/**
+ * numObjects points, each moving along its own geodesic, stepped a few times with the batch
+ * functions against a plain loop over SO4 and vec4. The baseline is the plain loop for per-object
+ * rotations and 1 thread for the rest.
+ */
+static void benchmarkBatchRotations(size_t numObjects) {
+	const int numSteps = 8;
+	beginSection("Batched SO4 rotations, " + std::to_string(numObjects) + " objects, " + std::to_string(numSteps) + " steps, "
+		+ std::to_string(floatv::width) + " lanes");
+
+	std::mt19937 rng(7);
+	std::normal_distribution<float> gaussian;
+	auto randomPoint = [&]() { return normalize(vec4(gaussian(rng), gaussian(rng), gaussian(rng), gaussian(rng))); };
+
+	std::vector<vec4> scalarPoints(numObjects);
+	std::vector<SO4> scalarSteps(numObjects);
+	Vec4Array points;
+	SO4Array steps, frames;
+	points.resize(numObjects);
+	steps.resize(numObjects);
+	frames.resize(numObjects);
+	for (size_t i = 0; i < numObjects; i++) {
+		vec4 point = randomPoint();
+		vec4 direction = randomPoint();
+		direction = normalize(direction - dot(direction, point) * point);
+		scalarPoints[i] = point;
+		scalarSteps[i] = planeRotation(point, direction, 0.01f);
+		points.set(i, point);
+		steps.set(i, scalarSteps[i]);
+		frames.set(i, SO4::identity());
+	}
+	const Vec4Array startPoints = points;
+
+	Clock::time_point start = Clock::now();
+	for (int step = 0; step < numSteps; step++) {
+		for (size_t i = 0; i < numObjects; i++) {
+			scalarPoints[i] = normalize(apply(scalarSteps[i], scalarPoints[i]));
+		}
+	}
+	double scalarSeconds = secondsSince(start) / numSteps;
+	reportObjects("  per-object, SO4 loop", numObjects, scalarSeconds, scalarSeconds);
+
+	for (int threads : batchThreadCounts(numObjects)) {
+		points = startPoints;
+		start = Clock::now();
+		for (int step = 0; step < numSteps; step++) {
+			rotatePoints(steps, points, threads);
+		}
+		reportObjects("  per-object" + onThreads(threads), numObjects, secondsSince(start) / numSteps, scalarSeconds);
+	}
+
+	// The batch path has to end up where the plain loop did
+	float maxError = 0;
+	for (size_t i = 0; i < numObjects; i++) {
+		maxError = std::max(maxError, length(points.get(i) - scalarPoints[i]));
+	}
+	std::cout << "    (largest difference from the SO4 loop " << std::scientific << std::setprecision(1) << maxError << std::fixed << ")" << std::endl;
+
+	SO4 sharedStep = planeRotation(vec4(1, 0, 0, 0), vec4(0, 1, 0, 0), 0.01f) * planeRotation(vec4(0, 0, 1, 0), vec4(0, 0, 0, 1), 0.02f);
+	double sharedBaseline = 0, composeBaseline = 0;
+	for (int threads : batchThreadCounts(numObjects)) {
+		start = Clock::now();
+		for (int step = 0; step < numSteps; step++) {
+			rotatePoints(sharedStep, points, threads);
+		}
+		double seconds = secondsSince(start) / numSteps;
+		sharedBaseline = threads == 1 ? seconds : sharedBaseline;
+		reportObjects("  shared" + onThreads(threads), numObjects, seconds, sharedBaseline);
+	}
+	for (int threads : batchThreadCounts(numObjects)) {
+		start = Clock::now();
+		for (int step = 0; step < numSteps; step++) {
+			composeRotations(steps, frames, threads);
+		}
+		double seconds = secondsSince(start) / numSteps;
+		composeBaseline = threads == 1 ? seconds : composeBaseline;
+		reportObjects("  compose frames" + onThreads(threads), numObjects, seconds, composeBaseline);
+	}
+}
+
+/** A head turning and swaying the way it does looking around a room, as a tracker would see it. */
+static mat4 headPoseAt(double time) {
+	float t = (float)time;
+	float yaw = 1.2f * sin(1.1f * t) + 0.4f * sin(2.9f * t + 1.0f);
+	float pitch = 0.3f * sin(0.7f * t + 0.5f) + 0.1f * sin(3.7f * t);
+	float roll = 0.05f * sin(1.9f * t + 2.0f);
+	mat4 pose = translate(mat4(1.0f), vec3(0.1f * sin(0.9f * t), 1.7f + 0.02f * sin(1.3f * t), 0.1f * sin(0.6f * t + 1.0f)));
+	return rotate(rotate(rotate(pose, yaw, vec3(0, 1, 0)), pitch, vec3(1, 0, 0)), roll, vec3(0, 0, 1));
+}
+
+static float rotationErrorDegrees(const mat4& a, const mat4& b) {
+	quat difference = quat_cast(mat3(a)) * conjugate(quat_cast(mat3(b)));
+	return degrees(2.0f * acos(std::min(1.0f, std::abs(difference.w))));
+}
+
+struct HeadTraceSample {
+	double time;
+	mat4 pose;
+};
+
+/** headPoseAt() sampled at sampleRate for duration seconds, with jitter and tracker noise. */
+static std::vector<HeadTraceSample> makeHeadTrace(double sampleRate, double duration) {
+	std::mt19937 rng(7);
+	std::normal_distribution<float> gaussian;
+	std::uniform_real_distribution<double> jitter(-0.001, 0.001);
+	const float rotationNoise = radians(0.05f);
+	const float positionNoise = 0.0002f;
+
+	std::vector<HeadTraceSample> samples;
+	for (double time = 0.0; time < duration; time += 1.0 / sampleRate) {
+		double sampleTime = time + jitter(rng);
+		mat4 pose = headPoseAt(sampleTime);
+		pose = rotate(pose, rotationNoise * gaussian(rng), normalize(vec3(gaussian(rng), gaussian(rng), gaussian(rng))));
+		pose[3] += vec4(positionNoise * gaussian(rng), positionNoise * gaussian(rng), positionNoise * gaussian(rng), 0.0f);
+		samples.push_back({ sampleTime, pose });
+	}
+	return samples;
+}
+
+/** The head tracker moves of a recording from the VR app. */
+static std::vector<HeadTraceSample> loadHeadTrace(const std::string& path) {
+	EventRecording recording = loadEventRecording(path);
+	std::vector<HeadTraceSample> samples;
+	for (const RecordedEvent& event : recording.events) {
+		if (event.type == RecordedEvent::TRACKER_MOVE && recording.isHead[event.name]) {
+			samples.push_back({ event.time, make_mat4(event.data) });
+		}
+	}
+	return samples;
+}
+
+/**
+ * How far the pose on screen is from the real head, where the predictor gets the newest
+ * sample once per frame (as in the VR app) and shows it latency seconds after it was taken:
+ * as it was (horizon 0) or predicted horizon seconds ahead. actualAt(time) is the real pose.
+ */
+template<class ActualAt>
+static void benchmarkHeadPrediction(const std::string& name, const std::vector<HeadTraceSample>& samples, double frameRate,
+	double latency, ActualAt actualAt) {
+	beginSection("Head pose prediction, " + name + ", " + formatNumber(frameRate) + " Hz frames, shown "
+		+ formatNumber(latency * 1000.0) + " ms after each sample");
+	if (samples.empty()) {
+		std::cout << "  no head tracker moves" << std::endl;
+		return;
+	}
+	double endTime = samples.back().time - latency;
+
+	for (double horizon : { 0.0, latency * 0.5, latency }) {
+		PosePredictor predictor;
+		std::vector<float> rotationErrors, positionErrors;
+		size_t next = 0;
+		for (double frameTime = samples.front().time; frameTime <= endTime; frameTime += 1.0 / frameRate) {
+			const HeadTraceSample* newest = nullptr;
+			for (; next < samples.size() && samples[next].time <= frameTime; next++) {
+				newest = &samples[next];
+			}
+			if (!newest) {
+				continue;
+			}
+			predictor.addSample(newest->time, newest->pose);
+
+			mat4 shown = predictor.predict(newest->time + horizon);
+			mat4 actual = actualAt(newest->time + latency);
+			rotationErrors.push_back(rotationErrorDegrees(shown, actual));
+			positionErrors.push_back(length(vec3(shown[3]) - vec3(actual[3])) * 1000.0f);
+		}
+		if (rotationErrors.empty()) {
+			std::cout << "  trace too short" << std::endl;
+			return;
+		}
+
+		auto meanOf = [](const std::vector<float>& values) {
+			double sum = 0.0;
+			for (float value : values) {
+				sum += value;
+			}
+			return sum / values.size();
+		};
+		auto percentile99 = [](std::vector<float> values) {
+			std::nth_element(values.begin(), values.begin() + values.size() * 99 / 100, values.end());
+			return values[values.size() * 99 / 100];
+		};
+		std::string label = "predicting " + formatNumber(std::round(horizon * 1000.0)) + " ms ahead";
+		recordResult(label + ", rotation mean", meanOf(rotationErrors), "deg", false);
+		recordResult(label + ", rotation 99th", percentile99(rotationErrors), "deg", false);
+		recordResult(label + ", position mean", meanOf(positionErrors), "mm", false);
+		std::cout << "  predicting " << std::setw(4) << std::fixed << std::setprecision(0) << horizon * 1000.0 << " ms ahead: "
+			<< std::setprecision(3) << "rotation " << meanOf(rotationErrors) << " deg mean, " << percentile99(rotationErrors) << " deg 99th"
+			<< std::setprecision(2) << ", position " << meanOf(positionErrors) << " mm mean, " << percentile99(positionErrors) << " mm 99th" << std::endl;
+	}
+}
+
+static void writeJsonString(std::ostream& out, const std::string& text) {
+	out << '"';
+	for (char c : text) {
+		if (c == '"' || c == '\\') {
+			out << '\\';
+		}
+		out << c;
+	}
+	out << '"';
+}
+
+static void writeResults(const std::string& path) {
+	std::ofstream outFile(path);
+	if (!outFile) {
+		throw std::runtime_error("could not open " + path + " for writing");
+	}
+	outFile << std::setprecision(9);
+	outFile << "{\n\t\"simdWidth\": " << floatv::width << ",\n\t\"cores\": " << std::max(1u, std::thread::hardware_concurrency())
+		<< ",\n\t\"fourDValidation\": " << (isFourDValidationEnabled() ? "true" : "false") << ",\n\t\"results\": [\n";
+	for (size_t i = 0; i < results.size(); i++) {
+		const BenchmarkResult& result = results[i];
+		outFile << "\t\t{ \"name\": ";
+		writeJsonString(outFile, result.name);
+		outFile << ", \"value\": " << result.value << ", \"unit\": ";
+		writeJsonString(outFile, result.unit);
+		outFile << ", \"higherIsBetter\": " << (result.higherIsBetter ? "true" : "false") << " }"
+			<< (i + 1 < results.size() ? "," : "") << "\n";
+	}
+	outFile << "\t]\n}\n";
+	if (!outFile) {
+		throw std::runtime_error("could not write " + path);
+	}
+}
+
+/** The values by name from a file written by writeResults; not a general JSON reader. */
+static std::map<std::string, double> loadResults(const std::string& path) {
+	std::ifstream inFile(path);
+	if (!inFile) {
+		throw std::runtime_error("could not load benchmark results " + path);
+	}
+	std::string text((std::istreambuf_iterator<char>(inFile)), std::istreambuf_iterator<char>());
+
+	std::map<std::string, double> values;
+	const std::string nameKey = "\"name\": \"";
+	const std::string valueKey = "\"value\": ";
+	for (size_t at = text.find(nameKey); at != std::string::npos; at = text.find(nameKey, at)) {
+		std::string name;
+		for (at += nameKey.size(); at < text.size() && text[at] != '"'; at++) {
+			if (text[at] == '\\' && at + 1 < text.size()) {
+				at++;
+			}
+			name += text[at];
+		}
+		size_t valueAt = text.find(valueKey, at);
+		if (valueAt == std::string::npos) {
+			throw std::runtime_error(path + ": result " + name + " has no value");
+		}
+		values[name] = std::strtod(text.c_str() + valueAt + valueKey.size(), nullptr);
+	}
+	return values;
+}
+
+/** Prints the results that got worse than the baseline by more than thresholdPercent, and returns how many did. */
+static int compareResults(const std::string& baselinePath, double thresholdPercent) {
+	std::map<std::string, double> baseline = loadResults(baselinePath);
+	beginSection("Compared with " + baselinePath + ", flagging anything over " + formatNumber(thresholdPercent) + "% worse");
+
+	int numCompared = 0, numRegressions = 0;
+	for (const BenchmarkResult& result : results) {
+		std::map<std::string, double>::const_iterator found = baseline.find(result.name);
+		// Nothing to scale a change by for a zero, like an error that was exactly 0
+		if (found == baseline.end() || found->second == 0.0) {
+			continue;
+		}
+		numCompared++;
+		double change = (result.value - found->second) / std::abs(found->second) * 100.0;
+		double worse = result.higherIsBetter ? -change : change;
+		if (worse > thresholdPercent) {
+			numRegressions++;
+			std::cout << "  REGRESSION " << result.name << ": " << std::setprecision(3) << found->second << " -> " << result.value
+				<< " " << result.unit << " (" << std::showpos << std::setprecision(1) << change << std::noshowpos << "%)" << std::endl;
+		}
+	}
+	std::cout << "  " << numCompared << " of " << results.size() << " results compared, " << numRegressions << " regressed" << std::endl;
+	if (numCompared == 0) {
+		std::cout << "    (nothing matched; the baseline should be from a run with the same arguments)" << std::endl;
+	}
+	return numRegressions;
+}
+
+int main(int argc, char **argv) {
+	int numRays = 1 << 20;
+	int width = 1280;
+	int height = 720;
+	std::vector<int> bvhSceneSizes = { 1000, 10000, 100000 };
+	std::vector<int> frameSceneSizes = { 1000, 10000 };
+	std::string headTracePath;
+	std::string jsonPath;
+	std::string baselinePath;
+	double thresholdPercent = 10.0;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--rays" && i + 1 < argc) {
+			numRays = std::atoi(argv[++i]);
+		}
+		else if (arg == "--size" && i + 2 < argc) {
+			width = std::atoi(argv[++i]);
+			height = std::atoi(argv[++i]);
+		}
+		else if (arg == "--bvh-spheres" && i + 1 < argc) {
+			bvhSceneSizes = { std::atoi(argv[++i]) };
+		}
+		else if (arg == "--frame-spheres" && i + 1 < argc) {
+			frameSceneSizes = { std::atoi(argv[++i]) };
+		}
+		else if (arg == "--head-trace" && i + 1 < argc) {
+			headTracePath = argv[++i];
+		}
+		else if (arg == "--json" && i + 1 < argc) {
+			jsonPath = argv[++i];
+		}
+		else if (arg == "--compare" && i + 1 < argc) {
+			baselinePath = argv[++i];
+		}
+		else if (arg == "--threshold" && i + 1 < argc) {
+			thresholdPercent = std::atof(argv[++i]);
+		}
+		else {
+			std::cerr << "Usage: " << argv[0] << " [--rays <n>] [--size <width> <height>] [--bvh-spheres <n>] [--frame-spheres <n>]"
+				<< " [--head-trace <recording>] [--json <results>] [--compare <baseline results>] [--threshold <percent>]" << std::endl;
+			return 1;
+		}
+	}
+
+	if (isFourDValidationEnabled()) {
+		std::cerr << "Warning: the 4D camera math was built with its checks in (FOURD_VALIDATION), so those timings"
+			" are of a debug build; configure with -DCMAKE_BUILD_TYPE=Release to compare them" << std::endl;
+	}
+
+	CPURaytracer raytracer(makeDefaultScene());
+	std::vector<Ray> rays = makeRandomRays(numRays, 1234);
+
+	beginSection("Closest hit, " + std::to_string(raytracer.getScene().spheres.size()) + " spheres, " + std::to_string(numRays) + " random rays");
+
+	std::vector<int> referenceIndices(numRays);
+	Clock::time_point start = Clock::now();
+	for (int i = 0; i < numRays; i++) {
+		referenceIndices[i] = raytracer.findClosestHit(rays[i]).objectIndex;
+	}
+	double scalarSeconds = secondsSince(start);
+	report("scalar SphereHitDistance", numRays, scalarSeconds, scalarSeconds);
+
+	benchmarkPacketWidth<float1v>("packet x1", raytracer, rays, referenceIndices, scalarSeconds);
+#ifdef SIMD_HAS_SSE
+	benchmarkPacketWidth<float4v>("packet x4 (SSE)", raytracer, rays, referenceIndices, scalarSeconds);
+#endif
+#ifdef SIMD_HAS_AVX
+	benchmarkPacketWidth<float8v>("packet x8 (AVX)", raytracer, rays, referenceIndices, scalarSeconds);
+#endif
+#ifdef SIMD_HAS_AVX512
+	benchmarkPacketWidth<float16v>("packet x16 (AVX-512)", raytracer, rays, referenceIndices, scalarSeconds);
+#endif
+
+	beginSection("Full frame " + std::to_string(width) + "x" + std::to_string(height) + ", all cores");
+
+	CurvedWorldPosAndRot view = { vec4(0,1,0,0), vec4(1,0,0,0), vec4(0,0,0,1), vec4(0,0,1,0) };
+	mat4 projectionMat = perspective(radians(90.0f), (float)width / height, 0.1f, 100.0f);
+	std::vector<vec3> pixels;
+
+	raytracer.setPacketTracing(false);
+	start = Clock::now();
+	raytracer.render(view, projectionMat, width, height, pixels);
+	double scalarFrameSeconds = secondsSince(start);
+	report("scalar primary rays", width * height, scalarFrameSeconds, scalarFrameSeconds);
+
+	raytracer.setPacketTracing(true);
+	raytracer.setCameraFramePrimaryRays(false);
+	start = Clock::now();
+	raytracer.render(view, projectionMat, width, height, pixels);
+	report("packet primary rays", width * height, secondsSince(start), scalarFrameSeconds);
+
+	raytracer.setCameraFramePrimaryRays(true);
+	start = Clock::now();
+	raytracer.render(view, projectionMat, width, height, pixels);
+	report("camera-frame packets", width * height, secondsSince(start), scalarFrameSeconds);
+
+	benchmarkPrimaryRays(raytracer, view, projectionMat, width, height);
+
+	benchmarkFrameScaling(frameSceneSizes, width, height);
+
+	benchmarkShadows("default scene", makeDefaultScene(), width, height);
+	benchmarkShadows("random scene", makeRandomScene(10000, 42), width, height);
+
+	for (int numSpheres : bvhSceneSizes) {
+		benchmarkBVH(numSpheres, std::min(numRays, 1 << 16));
+	}
+	benchmarkBVHRefit(bvhSceneSizes.back(), std::min(numRays, 1 << 16));
+
+	benchmarkPlaneRotations(numRays);
+	benchmarkCameraUpdates(numRays);
+
+	benchmarkBatchRotations(numRays);
+
+	auto syntheticHeadAt = [](double time) { return headPoseAt(time); };
+	benchmarkHeadPrediction("90 Hz synthetic tracker", makeHeadTrace(90.0, 60.0), 90.0, 0.020, syntheticHeadAt);
+	benchmarkHeadPrediction("1000 Hz synthetic tracker", makeHeadTrace(1000.0, 60.0), 90.0, 0.020, syntheticHeadAt);
+	if (!headTracePath.empty()) {
+		// The recording is its own ground truth: the pose it recorded next after each time
+		std::vector<HeadTraceSample> trace = loadHeadTrace(headTracePath);
+		benchmarkHeadPrediction(headTracePath, trace, 90.0, 0.020, [&](double time) {
+			auto after = std::lower_bound(trace.begin(), trace.end(), time,
+				[](const HeadTraceSample& sample, double t) { return sample.time < t; });
+			return after == trace.end() ? trace.back().pose : after->pose;
+		});
+	}
+
+	if (!jsonPath.empty()) {
+		writeResults(jsonPath);
+	}
+	if (!baselinePath.empty() && compareResults(baselinePath, thresholdPercent) > 0) {
+		return 2;
+	}
+	return 0;
+}
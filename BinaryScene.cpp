@@ -0,0 +1,344 @@
+#include "BinaryScene.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <utility>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static float cellDistance(vec4 p1, vec4 p2) {
+	return acos(clamp(dot(p1, p2), -1.0f, 1.0f));
+}
+
+// Cells are numbered face-major, where face = 2 * (largest axis) + (1 if it's negative), and
+// the other three coordinates divided by the largest one (so in [-1, 1]) pick the cell of the face.
+static uint32_t cellIndexOf(vec4 p, int cellsPerAxis) {
+	int axis = 0;
+	for (int i = 1; i < 4; i++) {
+		if (abs(p[i]) > abs(p[axis])) {
+			axis = i;
+		}
+	}
+
+	uint32_t index = axis * 2 + (p[axis] < 0.0f ? 1 : 0);
+	for (int i = 0; i < 4; i++) {
+		if (i != axis) {
+			float u = p[i] / abs(p[axis]);
+			int cell = clamp((int)floor((u + 1.0f) * 0.5f * cellsPerAxis), 0, cellsPerAxis - 1);
+			index = index * cellsPerAxis + cell;
+		}
+	}
+	return index;
+}
+
+static vec4 cellCenterOf(uint32_t index, int cellsPerAxis) {
+	int cells[3];
+	for (int i = 2; i >= 0; i--) {
+		cells[i] = index % cellsPerAxis;
+		index /= cellsPerAxis;
+	}
+	int axis = index / 2;
+
+	vec4 center(0.0f);
+	center[axis] = (index % 2 == 0) ? 1.0f : -1.0f;
+	for (int i = 0, j = 0; i < 4; i++) {
+		if (i != axis) {
+			center[i] = -1.0f + (cells[j++] + 0.5f) * 2.0f / cellsPerAxis;
+		}
+	}
+	return normalize(center);
+}
+
+bool isBinaryScenePath(const std::string& path) {
+	const std::string extension = ".s3scene";
+	return path.size() >= extension.size() && path.compare(path.size() - extension.size(), extension.size(), extension) == 0;
+}
+
+/////////////////////////////// WRITING ///////////////////////////////
+
+void writeBinaryScene(const std::string& path, const Scene& scene, int cellsPerAxis) {
+	if (cellsPerAxis < 1 || cellsPerAxis > 256) {
+		throw std::runtime_error("cells per axis must be between 1 and 256");
+	}
+
+	SceneBuffers packed = packSceneBuffers(scene);
+
+	// The player sphere and light spheres are fixed; light sphere indices are remapped to them
+	std::vector<int> fixedIndex(packed.spheres.size(), -1);
+	std::vector<GPUSphere> fixedSpheres;
+	fixedIndex[0] = 0;
+	fixedSpheres.push_back(packed.spheres[0]);
+	for (GPULight& light : packed.lights) {
+		if (light.sphereIndex < 0) {
+			continue;
+		}
+		if (fixedIndex[light.sphereIndex] < 0) {
+			fixedIndex[light.sphereIndex] = (int)fixedSpheres.size();
+			fixedSpheres.push_back(packed.spheres[light.sphereIndex]);
+		}
+		light.sphereIndex = fixedIndex[light.sphereIndex];
+	}
+
+	// Counting sort of the other spheres by cell
+	const uint32_t totalCells = 8 * cellsPerAxis * cellsPerAxis * cellsPerAxis;
+	std::vector<uint32_t> sphereCells(packed.spheres.size());
+	std::vector<uint64_t> cellStarts(totalCells + 1, 0);
+	for (size_t i = 0; i < packed.spheres.size(); i++) {
+		if (fixedIndex[i] < 0) {
+			sphereCells[i] = cellIndexOf(packed.spheres[i].center, cellsPerAxis);
+			cellStarts[sphereCells[i] + 1]++;
+		}
+	}
+	for (uint32_t c = 0; c < totalCells; c++) {
+		cellStarts[c + 1] += cellStarts[c];
+	}
+
+	std::vector<GPUSphere> cellSpheres(cellStarts[totalCells]);
+	std::vector<uint64_t> next(cellStarts.begin(), cellStarts.end() - 1);
+	for (size_t i = 0; i < packed.spheres.size(); i++) {
+		if (fixedIndex[i] < 0) {
+			cellSpheres[next[sphereCells[i]]++] = packed.spheres[i];
+		}
+	}
+
+	std::vector<BinarySceneCell> cells;
+	for (uint32_t c = 0; c < totalCells; c++) {
+		if (cellStarts[c] == cellStarts[c + 1]) {
+			continue;
+		}
+		BinarySceneCell cell;
+		cell.center = cellCenterOf(c, cellsPerAxis);
+		cell.boundingRadius = 0.0f;
+		cell.numSpheres = (uint32_t)(cellStarts[c + 1] - cellStarts[c]);
+		cell.firstSphere = cellStarts[c];
+		for (uint64_t i = cellStarts[c]; i < cellStarts[c + 1]; i++) {
+			float extent = cellDistance(cell.center, cellSpheres[i].center) + cellSpheres[i].radius;
+			cell.boundingRadius = std::min(PI, std::max(cell.boundingRadius, extent));
+		}
+		cells.push_back(cell);
+	}
+
+	// Every section's element size is a multiple of 16, so the offsets stay aligned
+	BinarySceneHeader header = {};
+	std::memcpy(header.magic, BINARY_SCENE_MAGIC, sizeof(header.magic));
+	header.version = BINARY_SCENE_VERSION;
+	header.cellsPerAxis = cellsPerAxis;
+	header.numMaterials = (uint32_t)packed.materials.size();
+	header.numLights = (uint32_t)packed.lights.size();
+	header.numFixedSpheres = (uint32_t)fixedSpheres.size();
+	header.numCells = (uint32_t)cells.size();
+	header.numCellSpheres = cellSpheres.size();
+	header.materialsOffset = sizeof(BinarySceneHeader);
+	header.lightsOffset = header.materialsOffset + sizeof(GPUMaterial) * packed.materials.size();
+	header.fixedSpheresOffset = header.lightsOffset + sizeof(GPULight) * packed.lights.size();
+	header.cellsOffset = header.fixedSpheresOffset + sizeof(GPUSphere) * fixedSpheres.size();
+	header.cellSpheresOffset = header.cellsOffset + sizeof(BinarySceneCell) * cells.size();
+
+	std::ofstream outFile(path, std::ios::out | std::ios::binary);
+	if (!outFile) {
+		throw std::runtime_error("could not open " + path + " for writing");
+	}
+	auto writeAll = [&](const void* data, size_t size) {
+		outFile.write((const char*)data, size);
+	};
+	writeAll(&header, sizeof(header));
+	writeAll(packed.materials.data(), sizeof(GPUMaterial) * packed.materials.size());
+	writeAll(packed.lights.data(), sizeof(GPULight) * packed.lights.size());
+	writeAll(fixedSpheres.data(), sizeof(GPUSphere) * fixedSpheres.size());
+	writeAll(cells.data(), sizeof(BinarySceneCell) * cells.size());
+	writeAll(cellSpheres.data(), sizeof(GPUSphere) * cellSpheres.size());
+	if (!outFile) {
+		throw std::runtime_error("could not write " + path);
+	}
+}
+
+/////////////////////////////// READING ///////////////////////////////
+
+MappedScene::MappedScene(const std::string& path) : _path(path) {
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) {
+		throw std::runtime_error("could not load scene file " + path);
+	}
+	LARGE_INTEGER fileSize;
+	GetFileSizeEx(file, &fileSize);
+	_size = (size_t)fileSize.QuadPart;
+	_fileHandle = file;
+	_mappingHandle = _size > 0 ? CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL) : NULL;
+	if (_mappingHandle != NULL) {
+		_data = (const unsigned char*)MapViewOfFile(_mappingHandle, FILE_MAP_READ, 0, 0, 0);
+	}
+	if (_data == nullptr) {
+		if (_mappingHandle != NULL) {
+			CloseHandle(_mappingHandle);
+		}
+		CloseHandle(file);
+		throw std::runtime_error("could not map scene file " + path);
+	}
+#else
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		throw std::runtime_error("could not load scene file " + path);
+	}
+	struct stat fileStat;
+	if (fstat(fd, &fileStat) != 0 || fileStat.st_size == 0) {
+		close(fd);
+		throw std::runtime_error("could not map scene file " + path);
+	}
+	_size = (size_t)fileStat.st_size;
+	void* data = mmap(nullptr, _size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		throw std::runtime_error("could not map scene file " + path);
+	}
+	_data = (const unsigned char*)data;
+#endif
+
+	// Only the small sections are checked here; cell spheres are checked as they are read
+	auto fail = [&](const std::string& message) {
+		unmap();
+		throw std::runtime_error(path + ": " + message);
+	};
+	auto sectionFits = [&](uint64_t offset, uint64_t count, size_t elementSize) {
+		return offset % 16 == 0 && offset <= _size && count <= (_size - offset) / elementSize;
+	};
+
+	_header = (const BinarySceneHeader*)_data;
+	if (_size < sizeof(BinarySceneHeader) || std::memcmp(_header->magic, BINARY_SCENE_MAGIC, sizeof(_header->magic)) != 0) {
+		fail("not a binary scene file");
+	}
+	if (_header->version != BINARY_SCENE_VERSION) {
+		fail("unsupported binary scene version " + std::to_string(_header->version));
+	}
+	if (!sectionFits(_header->materialsOffset, _header->numMaterials, sizeof(GPUMaterial))
+		|| !sectionFits(_header->lightsOffset, _header->numLights, sizeof(GPULight))
+		|| !sectionFits(_header->fixedSpheresOffset, _header->numFixedSpheres, sizeof(GPUSphere))
+		|| !sectionFits(_header->cellsOffset, _header->numCells, sizeof(BinarySceneCell))
+		|| !sectionFits(_header->cellSpheresOffset, _header->numCellSpheres, sizeof(GPUSphere))) {
+		fail("file is truncated");
+	}
+	if (_header->numFixedSpheres == 0 || _header->numLights == 0) {
+		fail("the scene has no player sphere or no lights");
+	}
+
+	_cells = (const BinarySceneCell*)(_data + _header->cellsOffset);
+	_cellSpheres = (const GPUSphere*)(_data + _header->cellSpheresOffset);
+
+	const GPUSphere* fixedSpheres = (const GPUSphere*)(_data + _header->fixedSpheresOffset);
+	for (uint32_t i = 0; i < _header->numFixedSpheres; i++) {
+		if (fixedSpheres[i].material < 0 || (uint32_t)fixedSpheres[i].material >= _header->numMaterials) {
+			fail("sphere refers to a material that doesn't exist");
+		}
+	}
+	const GPULight* lights = (const GPULight*)(_data + _header->lightsOffset);
+	for (uint32_t i = 0; i < _header->numLights; i++) {
+		if (lights[i].sphereIndex < -1 || lights[i].sphereIndex >= (int32_t)_header->numFixedSpheres) {
+			fail("light refers to a sphere that doesn't exist");
+		}
+	}
+	for (uint32_t i = 0; i < _header->numCells; i++) {
+		if (_cells[i].firstSphere > _header->numCellSpheres || _cells[i].numSpheres > _header->numCellSpheres - _cells[i].firstSphere) {
+			fail("cell refers to spheres that don't exist");
+		}
+	}
+}
+
+MappedScene::~MappedScene() {
+	unmap();
+}
+
+void MappedScene::unmap() {
+	if (_data == nullptr) {
+		return;
+	}
+#ifdef _WIN32
+	UnmapViewOfFile(_data);
+	CloseHandle(_mappingHandle);
+	CloseHandle(_fileHandle);
+#else
+	munmap((void*)_data, _size);
+#endif
+	_data = nullptr;
+}
+
+SceneBuffers MappedScene::getFixedBuffers() const {
+	SceneBuffers buffers;
+	const GPUMaterial* materials = (const GPUMaterial*)(_data + _header->materialsOffset);
+	const GPULight* lights = (const GPULight*)(_data + _header->lightsOffset);
+	const GPUSphere* fixedSpheres = (const GPUSphere*)(_data + _header->fixedSpheresOffset);
+	buffers.materials.assign(materials, materials + _header->numMaterials);
+	buffers.lights.assign(lights, lights + _header->numLights);
+	buffers.spheres.assign(fixedSpheres, fixedSpheres + _header->numFixedSpheres);
+	return buffers;
+}
+
+std::vector<uint32_t> MappedScene::selectCells(vec4 pos, float streamRadius, size_t maxSpheres) const {
+	pos = normalize(pos);
+
+	std::vector<std::pair<float, uint32_t>> inRange;
+	for (uint32_t i = 0; i < _header->numCells; i++) {
+		float distance = cellDistance(_cells[i].center, pos) - _cells[i].boundingRadius;
+		if (distance <= streamRadius) {
+			inRange.push_back({ distance, i });
+		}
+	}
+	std::sort(inRange.begin(), inRange.end());
+
+	std::vector<uint32_t> selected;
+	size_t numSpheres = 0;
+	for (const auto& cell : inRange) {
+		numSpheres += _cells[cell.second].numSpheres;
+		if (numSpheres > maxSpheres) {
+			break;
+		}
+		selected.push_back(cell.second);
+	}
+	return selected;
+}
+
+void MappedScene::appendCellSpheres(const std::vector<uint32_t>& cells, std::vector<GPUSphere>& spheres) const {
+	size_t total = spheres.size();
+	for (uint32_t cell : cells) {
+		total += _cells[cell].numSpheres;
+#ifndef _WIN32
+		// Let the OS start reading every cell before the copy below faults them in one by one
+		const GPUSphere* begin = _cellSpheres + _cells[cell].firstSphere;
+		uintptr_t pageSize = (uintptr_t)sysconf(_SC_PAGESIZE);
+		uintptr_t start = (uintptr_t)begin & ~(pageSize - 1);
+		madvise((void*)start, (uintptr_t)(begin + _cells[cell].numSpheres) - start, MADV_WILLNEED);
+#endif
+	}
+	spheres.reserve(total);
+
+	for (uint32_t cell : cells) {
+		const GPUSphere* begin = _cellSpheres + _cells[cell].firstSphere;
+		const GPUSphere* end = begin + _cells[cell].numSpheres;
+		for (const GPUSphere* sphere = begin; sphere != end; sphere++) {
+			if (sphere->material < 0 || (uint32_t)sphere->material >= _header->numMaterials) {
+				throw std::runtime_error(_path + ": sphere refers to a material that doesn't exist");
+			}
+		}
+		spheres.insert(spheres.end(), begin, end);
+	}
+}
+
+void MappedScene::releaseCell(uint32_t cell) const {
+#ifndef _WIN32
+	const GPUSphere* begin = _cellSpheres + _cells[cell].firstSphere;
+	uintptr_t pageSize = (uintptr_t)sysconf(_SC_PAGESIZE);
+	uintptr_t start = (uintptr_t)begin & ~(pageSize - 1);
+	madvise((void*)start, (uintptr_t)(begin + _cells[cell].numSpheres) - start, MADV_DONTNEED);
+#endif
+}
@@ -0,0 +1,121 @@
+#ifndef BINARYSCENE_H_
+#define BINARYSCENE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "SceneBuffers.h"
+
+/**
+ * A scene file that is used straight out of mmap, for scenes too big to parse at startup.
+ *
+ * Spheres, materials and lights are stored in the std430 layouts from SceneBuffers.h, so they
+ * go to the GPU without any conversion. The spheres are partitioned into cells of the 3-sphere:
+ * each of the 8 cubes of the tesseract (the points whose largest coordinate is +x, -x, +y, ...)
+ * is projected onto the 3-sphere and split into cellsPerAxis^3 cells. Only the cells near the
+ * user are read (see MappedScene::selectCells and SceneStreamer).
+ *
+ * The player sphere and the spheres drawn at lights are kept outside the cells ("fixed"
+ * spheres) so they are always present and keep their indices: a streamed scene is always the
+ * fixed spheres followed by the spheres of the selected cells.
+ *
+ * Files are written and read in the byte order of the machine.
+ */
+
+const char BINARY_SCENE_MAGIC[8] = { 'S', '3', 'S', 'C', 'E', 'N', 'E', '\0' };
+const uint32_t BINARY_SCENE_VERSION = 1;
+
+struct BinarySceneHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t cellsPerAxis;
+
+	uint32_t numMaterials;
+	uint32_t numLights;
+	uint32_t numFixedSpheres;
+	uint32_t numCells; // non-empty cells only
+
+	uint64_t numCellSpheres;
+
+	// Byte offsets from the start of the file, all 16-byte aligned
+	uint64_t materialsOffset;
+	uint64_t lightsOffset;
+	uint64_t fixedSpheresOffset;
+	uint64_t cellsOffset;
+	uint64_t cellSpheresOffset;
+};
+
+struct BinarySceneCell {
+	vec4 center;
+	float boundingRadius; // every sphere in the cell is within this geodesic distance of center
+	uint32_t numSpheres;
+	uint64_t firstSphere; // index into the cell spheres
+};
+
+static_assert(sizeof(BinarySceneHeader) == 80, "BinarySceneHeader is part of the file format");
+static_assert(sizeof(BinarySceneCell) == 32, "BinarySceneCell is part of the file format");
+
+/** Whether path names a binary scene (by extension, .s3scene) rather than a text one. */
+bool isBinaryScenePath(const std::string& path);
+
+/**
+ * Writes scene to path. Sphere motions are not part of the format and are dropped. Throws
+ * std::runtime_error if the file can't be written.
+ */
+void writeBinaryScene(const std::string& path, const Scene& scene, int cellsPerAxis);
+
+/**
+ * A read-only mapping of a binary scene file. Opening it only checks the header and the cell
+ * table, so it takes the same time for any number of spheres. Throws std::runtime_error on
+ * unreadable or malformed files.
+ *
+ * All methods are const and safe to call from several threads at once.
+ */
+class MappedScene {
+public:
+	MappedScene(const std::string& path);
+	~MappedScene();
+
+	MappedScene(const MappedScene&) = delete;
+	MappedScene& operator=(const MappedScene&) = delete;
+
+	const BinarySceneHeader& getHeader() const { return *_header; }
+	const BinarySceneCell* getCells() const { return _cells; }
+
+	/** Materials, lights and fixed spheres, with no cell spheres yet. */
+	SceneBuffers getFixedBuffers() const;
+
+	/**
+	 * The cells that touch the cap of radius streamRadius around pos, nearest first, up to
+	 * maxSpheres spheres in total.
+	 */
+	std::vector<uint32_t> selectCells(vec4 pos, float streamRadius, size_t maxSpheres) const;
+
+	/**
+	 * Appends the spheres of the given cells to spheres. This is where the pages are actually
+	 * read. Throws std::runtime_error if a sphere refers to a material that doesn't exist.
+	 */
+	void appendCellSpheres(const std::vector<uint32_t>& cells, std::vector<GPUSphere>& spheres) const;
+
+	/** Tells the OS that the pages of a cell aren't needed any more, so they can be dropped. */
+	void releaseCell(uint32_t cell) const;
+
+private:
+	void unmap();
+
+	std::string _path;
+	const unsigned char* _data = nullptr;
+	size_t _size = 0;
+#ifdef _WIN32
+	void* _fileHandle = nullptr;
+	void* _mappingHandle = nullptr;
+#endif
+
+	const BinarySceneHeader* _header = nullptr;
+	const BinarySceneCell* _cells = nullptr;
+	const GPUSphere* _cellSpheres = nullptr;
+};
+
+#endif /* BINARYSCENE_H_ */
@@ -0,0 +1,459 @@
+#include "CPURaytracer.h"
+#include "Parallel.h"
+#include "RayPacket.h"
+#include "SphereBVH.h"
+#include "ViewConstants.h"
+
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+///////////////////////////// UTILITY METHODS ////////////////////////////
+
+float geodesicDistance(vec4 p1, vec4 p2) {
+	float dotProd = dot(normalize(p1), normalize(p2));
+
+	//clamp in case of float imprecision
+	return acos(clamp(dotProd, -1.0f, 1.0f));
+}
+
+static float angleFromGeodesicDistance(float dist) {
+	return dist;
+}
+
+static vec4 reflect4(vec4 normal, vec4 dir) {
+	vec4 n = normalize(normal);
+	return dir - (2.f*dot(dir, n))*n;
+}
+
+static vec4 project4(vec4 toBeProjected, vec4 onto) {
+	vec4 normOnto = normalize(onto);
+	return dot(toBeProjected, normOnto) * normOnto;
+}
+
+static bool pointsAreEqualOrOpposite(vec4 pt1, vec4 pt2) {
+	return abs(dot(pt1, pt2)) == 1.0f;
+}
+
+/////////////////////////////////// RAY ///////////////////////////////////
+
+vec4 pointAlongRay(const Ray& ray, float t) {
+	return normalize((cos(t) * ray.origin) + (sin(t) * ray.direction));
+}
+
+vec4 directionAtPointAlongRay(const Ray& ray, float t) {
+	return normalize((cos(t) * ray.direction) + (sin(t) * -ray.origin));
+}
+
+Ray rayFromAToB(vec4 from, vec4 to) {
+	return { from, normalize(to - project4(to, from)) };
+}
+
+////////////////////////////////// SPHERE /////////////////////////////////
+
+float sphereHitDistance(const Sphere& sphere, const Ray& ray) {
+	//See SphereHit in shader.frag for the derivation: we intersect the ray with the hyperplane
+	//whose intersection with the 3-sphere is the sphere.
+
+	float angle = angleFromGeodesicDistance(sphere.radius);
+	vec4 volumeNormal = sphere.center;
+	vec4 volumeNormalCenter = sphere.center * cos(angle);
+
+	float A = dot(volumeNormal, ray.direction);
+	float B = dot(volumeNormal, ray.origin);
+	float C = dot(volumeNormal, volumeNormalCenter);
+
+	float phaseShift = atan2(B, A);
+	float amplitude = sqrt((A*A) + (B*B));
+
+	float asinInput = C / amplitude;
+	if (abs(asinInput) > 1.f) {
+		return -1.f;
+	}
+
+	float asinVal = asin(asinInput);
+	float asinAltVal = sign(asinVal) * (PI - abs(asinVal));
+
+	float t1 = asinVal - phaseShift;
+	float t2 = asinAltVal - phaseShift;
+
+	while (t1 < 0.f)     { t1 += TWO_PI; }
+	while (t1 >= TWO_PI) { t1 -= TWO_PI; }
+	while (t2 < 0.f)     { t2 += TWO_PI; }
+	while (t2 >= TWO_PI) { t2 -= TWO_PI; }
+
+	//When we're inside a sphere, we can see through it.
+	//(this is mainly to allow the user to have a sphere representing them.)
+	bool rayIsComingFromWithinSphere = geodesicDistance(ray.origin, sphere.center) <= sphere.radius;
+
+	float t;
+	float nearT = min(t1, t2);
+	float farT = max(t1, t2);
+	if (nearT < MIN_RAY_HIT_THRESHOLD && farT < MIN_RAY_HIT_THRESHOLD) {
+		return -1.f;
+	}
+	else if (nearT < MIN_RAY_HIT_THRESHOLD) {
+		t = farT;
+	}
+	else if (farT < MIN_RAY_HIT_THRESHOLD) {
+		if (!sphere.visibleFromInside && rayIsComingFromWithinSphere) {
+			return -1.f;
+		}
+		else {
+			t = nearT;
+		}
+	}
+	else {
+		if (!sphere.visibleFromInside && rayIsComingFromWithinSphere) {
+			t = farT;
+		}
+		else {
+			t = nearT;
+		}
+	}
+
+	return t;
+}
+
+Surface shadeSphereHit(const Sphere& sphere, const Material& material, const Ray& ray, float t) {
+	vec3 returnColor = material.color;
+
+	vec4 hitPoint = pointAlongRay(ray, t);
+
+	//Draw a grid-like texture on the spheres to let you see how you rotate around them
+	if (material.hasCheckerboardPattern) {
+		ivec4 alternating = ivec4(round(mod(vec4(floor(hitPoint / .06f)), 2.f)));
+		if ((alternating.x == 1) ^ (alternating.y == 1) ^ (alternating.z == 1) ^ (alternating.w == 1)) {
+			returnColor = vec3(0);
+		}
+	}
+
+	vec4 vecToHitPoint = hitPoint - sphere.center;
+	vec4 normal = normalize(vecToHitPoint - project4(vecToHitPoint, hitPoint));
+
+	return { hitPoint, normal, returnColor };
+}
+
+////////////////////////// CORE RENDERING LOGIC ///////////////////////////
+
+// Scenes with fewer spheres than this per thread reduce them to the camera frame on one thread
+static const int CAMERA_FRAME_SPHERES_PER_THREAD = 1 << 14;
+
+CPURaytracer::CPURaytracer(const Scene& scene, const RaytracerParams& params)
+	: _scene(scene), _params(params), _bvh(new SphereBVH()) {
+	if (_params.reflectionCount < 0 || _params.reflectionCount > MAX_REFLECTION_COUNT) {
+		throw std::runtime_error("reflection count " + std::to_string(_params.reflectionCount)
+			+ " is outside 0-" + std::to_string(MAX_REFLECTION_COUNT));
+	}
+
+	for (const Sphere& sphere : _scene.spheres) {
+		_packedSpheres.push_back(packSphere(sphere));
+	}
+
+	// The player sphere moves with the camera, so it stays out of the hierarchy
+	_bvh->build(_scene.spheres, 1);
+	_useBVH = (int)_scene.spheres.size() > BVH_MIN_SPHERES;
+}
+
+CPURaytracer::~CPURaytracer() {
+}
+
+void CPURaytracer::moveSpheres(const std::vector<int>& sphereIndices, const std::vector<vec4>& centers) {
+	for (size_t i = 0; i < sphereIndices.size(); i++) {
+		Sphere& sphere = _scene.spheres[sphereIndices[i]];
+		sphere.center = normalize(centers[i]);
+		_packedSpheres[sphereIndices[i]] = packSphere(sphere);
+	}
+	_bvh->refit(_scene.spheres, sphereIndices);
+}
+
+template<class V>
+void CPURaytracer::findClosestHitIndices(const RayPacketT<V>& rays, V& closestT, V& closestIndex) const {
+	int startingPoint = _params.userSphereVisible ? 0 : 1;
+	if (!_useBVH) {
+		findClosestHitPacket(_packedSpheres, startingPoint, rays, closestT, closestIndex);
+		return;
+	}
+
+	closestT = V(99999999999999.f);
+	closestIndex = V(-1.0f);
+	if (startingPoint == 0) {
+		intersectSpherePacket(_packedSpheres[0], 0.0f, rays, closestT, closestIndex);
+	}
+	_bvh->findClosestHit(_packedSpheres, rays, closestT, closestIndex);
+}
+
+template<class V>
+void CPURaytracer::findClosestPrimaryHitIndices(const RayPacketT<V>& rays, const CameraRayPacketT<V>& cameraRays, V& closestT, V& closestIndex) const {
+	int startingPoint = _params.userSphereVisible ? 0 : 1;
+	if (!_useBVH) {
+		findClosestCameraFrameHitPacket(_cameraFrameSpheres, startingPoint, cameraRays, closestT, closestIndex);
+		return;
+	}
+
+	closestT = V(99999999999999.f);
+	closestIndex = V(-1.0f);
+	if (startingPoint == 0) {
+		intersectCameraFrameSpherePacket(_cameraFrameSpheres[0], cameraRays, closestT, closestIndex);
+	}
+	_bvh->findClosestHit(_cameraFrameSpheres, rays, cameraRays, closestT, closestIndex);
+}
+
+Hit CPURaytracer::findClosestHit(const Ray& ray) const {
+	if (_useBVH) {
+		float1v closestT, closestIndex;
+		findClosestHitIndices(RayPacketT<float1v>::gather(&ray, 1), closestT, closestIndex);
+		return { closestT.v, (int)closestIndex.v };
+	}
+
+	Hit nearest = { 99999999999999.f, -1 };
+
+	//Iterate over spheres
+	int startingPoint = _params.userSphereVisible ? 0 : 1;
+	for (int i = startingPoint; i < (int)_scene.spheres.size(); i++) {
+		float t = sphereHitDistance(_scene.spheres[i], ray);
+		if (t >= 0.f && t < nearest.dist) {
+			nearest = { t, i };
+		}
+	}
+
+	return nearest;
+}
+
+bool CPURaytracer::isOccluded(const Ray& ray, float tMax, int ignoredObjectIndex) const {
+	int startingPoint = _params.userSphereVisible ? 0 : 1;
+	if (_useBVH) {
+		float1v tMaxV(tMax), ignoredIndex((float)ignoredObjectIndex);
+		RayPacketT<float1v> rays = RayPacketT<float1v>::gather(&ray, 1);
+		if (startingPoint == 0 && ignoredObjectIndex != 0 && any(anyHitSpherePacket(_packedSpheres[0], rays, tMaxV))) {
+			return true;
+		}
+		return any(_bvh->anyHit(_packedSpheres, rays, tMaxV, ignoredIndex));
+	}
+
+	for (int i = startingPoint; i < (int)_scene.spheres.size(); i++) {
+		if (i == ignoredObjectIndex) {
+			continue;
+		}
+
+		float t = sphereHitDistance(_scene.spheres[i], ray);
+		if (t >= 0.f && t < tMax) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+float CPURaytracer::calculateDiffuseLightingAndShadows(vec4 hitPos, vec4 normal, int hitObjectIndex) const {
+	float lightAmnt = 0.0f;
+	for (const Light& light : _scene.lights) {
+		if (hitObjectIndex == light.sphereIndex) {
+			return 1.0f;
+		}
+		lightAmnt += calculateDiffuseLight(light, hitPos, normal, hitObjectIndex);
+	}
+	return lightAmnt;
+}
+
+float CPURaytracer::calculateDiffuseLight(const Light& light, vec4 hitPos, vec4 normal, int hitObjectIndex) const {
+	const vec4 lightPosition = light.position;
+
+	if (pointsAreEqualOrOpposite(hitPos, lightPosition)) {
+		//It's basically impossible to calclate the antipodal case in any reasonable timeframe, so
+		//we'll just call it 1.0 since that's what it will most likely be.
+		return 1.0f;
+	}
+
+	vec4 lightRayDirAtHitPoint = -normalize(lightPosition - project4(lightPosition, hitPos));
+	float nearPathDotProduct = dot(-lightRayDirAtHitPoint, normal);
+
+	//The light ray reaches hitPos at t = dist going the short way round, or 2pi - dist going the long way
+	float dist = geodesicDistance(lightPosition, hitPos);
+
+	Ray lightRayWithPossibilityOfHitting;
+	float hitDotProduct;
+	float tAtHitPos;
+	if (nearPathDotProduct > 0.0f) {
+		lightRayWithPossibilityOfHitting = rayFromAToB(lightPosition, hitPos);
+		hitDotProduct = nearPathDotProduct;
+		tAtHitPos = dist;
+	}
+	else if (nearPathDotProduct < 0.0f) {
+		Ray closeRay = rayFromAToB(lightPosition, hitPos);
+		closeRay.direction = -closeRay.direction;
+		lightRayWithPossibilityOfHitting = closeRay;
+
+		hitDotProduct = -nearPathDotProduct;
+		tAtHitPos = TWO_PI - dist;
+	}
+	else {
+		// angle is exactly 90deg so it's not lit at all
+		return 0.0f;
+	}
+
+	//TODO: this only works for convex objects - if concave objects are added this code will need to be updated
+	if (_closestHitShadows) {
+		if (findClosestHit(lightRayWithPossibilityOfHitting).objectIndex != hitObjectIndex) {
+			return 0.0f;
+		}
+	}
+	else if (isOccluded(lightRayWithPossibilityOfHitting, tAtHitPos, hitObjectIndex)) {
+		return 0.0f;
+	}
+
+	//Nothing in between!
+	float lightAmnt = min(1.0f, light.intensity / (sin(dist) * sin(dist)));
+	lightAmnt *= clamp(hitDotProduct, 0.0f, 1.0f);
+	return lightAmnt;
+}
+
+vec3 CPURaytracer::rayColor(Ray ray) const {
+	return rayColorFromHit(ray, findClosestHit(ray));
+}
+
+vec3 CPURaytracer::rayColorFromHit(Ray ray, Hit nearest) const {
+	const int reflectionCount = _params.reflectionCount;
+
+	//vec3(-1) lets us detect non-reflective surfaces.
+	vec3 colors[MAX_REFLECTION_COUNT + 1];
+	for (int i = 0; i <= reflectionCount; i++) {
+		colors[i] = vec3(-1);
+	}
+
+	for (int reflections = 0; reflections <= reflectionCount; reflections++) {
+		if (reflections > 0) {
+			nearest = findClosestHit(ray);
+		}
+
+		if (nearest.objectIndex < 0) {
+			colors[reflections] = _params.backgroundColor;
+			break;
+		}
+
+		const Sphere& sphere = _scene.spheres[nearest.objectIndex];
+		const Material& material = _scene.materials[sphere.material];
+		Surface surface = shadeSphereHit(sphere, material, ray, nearest.dist);
+
+		float lightAmnt = 1.0f;
+		if (_params.lightingEnabled) {
+			lightAmnt = calculateDiffuseLightingAndShadows(surface.position, surface.normal, nearest.objectIndex);
+			lightAmnt = min(1.0f, lightAmnt + _params.ambientLight);
+		}
+
+		colors[reflections] = surface.color * lightAmnt;
+
+		if (material.isReflective) {
+			//Calculate reflection
+			vec4 rayDirAtHitPoint = directionAtPointAlongRay(ray, nearest.dist);
+			ray = { surface.position, normalize(reflect4(surface.normal, rayDirAtHitPoint)) };
+		}
+		else {
+			break;
+		}
+	}
+
+	vec3 curColor = colors[reflectionCount];
+	for (int j = reflectionCount - 1; j >= 0; j--) {
+		if (curColor == vec3(-1)) {
+			curColor = colors[j];
+		}
+		else {
+			curColor = mix(colors[j], curColor, _params.reflectance);
+		}
+	}
+
+	return curColor;
+}
+
+void CPURaytracer::render(const CurvedWorldPosAndRot& view, const mat4& projectionMat, int width, int height,
+	std::vector<vec3>& pixels, int numThreads) {
+
+	// Per-view part of ColorAt(), same as what main.cpp uploads to the shader
+	const ViewConstants viewConstants = makeViewConstants(view, projectionMat, (float)width, (float)height);
+	const vec4 userPos = viewConstants.userPos;
+
+	if (_params.userSphereVisible) {
+		_scene.spheres[0].center = userPos;
+		_packedSpheres[0] = packSphere(_scene.spheres[0]);
+	}
+
+	if (numThreads <= 0) {
+		numThreads = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	// Primary rays are intersected in the camera frame (see RayPacket.h)
+	const bool cameraFrame = _packetTracing && _cameraFramePrimaryRays;
+	if (cameraFrame) {
+		const mat4 toCameraFrame = transpose(viewConstants.fromCameraFrame);
+		_cameraFrameSpheres.resize(_packedSpheres.size());
+		// With the hierarchy this is the only per-view work that grows with the whole scene
+		int chunks = std::min(numThreads, 1 + (int)_packedSpheres.size() / CAMERA_FRAME_SPHERES_PER_THREAD);
+		parallelChunks(0, (int)_packedSpheres.size(), chunks, [&](int begin, int end, int) {
+			for (int i = begin; i < end; i++) {
+				_cameraFrameSpheres[i] = makeCameraFrameSphere(_packedSpheres[i], i, toCameraFrame);
+			}
+		});
+	}
+
+	pixels.resize((size_t)width * height);
+
+	// Rows are handed out one at a time so threads that hit cheap rows (background) pick up the slack.
+	std::atomic<int> nextRow(0);
+	auto renderRows = [&]() {
+		const int packetWidth = _packetTracing ? floatv::width : 1;
+		Ray rays[floatv::width];
+		vec3 cameraDirs[floatv::width];
+
+		for (int y = nextRow++; y < height; y = nextRow++) {
+			for (int packetStart = 0; packetStart < width; packetStart += packetWidth) {
+				int count = std::min(packetWidth, width - packetStart);
+
+				for (int lane = 0; lane < count; lane++) {
+					vec2 pixelCoord(packetStart + lane + 0.5f, y + 0.5f);
+
+					if (cameraFrame) {
+						cameraDirs[lane] = cameraRayDirectionAt(viewConstants, pixelCoord);
+						rays[lane] = { viewConstants.fromCameraFrame[0], viewConstants.fromCameraFrame * vec4(0, cameraDirs[lane]) };
+					}
+					else {
+						rays[lane] = { userPos, normalize(rayDirectionAt(viewConstants, pixelCoord)) };
+					}
+				}
+
+				vec3* out = &pixels[(size_t)y * width + packetStart];
+				if (!_packetTracing) {
+					out[0] = rayColor(rays[0]);
+					continue;
+				}
+
+				floatv closestT, closestIndex;
+				if (cameraFrame) {
+					findClosestPrimaryHitIndices(RayPacket::gather(rays, count), CameraRayPacketT<floatv>::gather(cameraDirs, count),
+						closestT, closestIndex);
+				}
+				else {
+					findClosestHitIndices(RayPacket::gather(rays, count), closestT, closestIndex);
+				}
+
+				float hitTs[floatv::width], hitIndices[floatv::width];
+				closestT.store(hitTs);
+				closestIndex.store(hitIndices);
+				for (int lane = 0; lane < count; lane++) {
+					out[lane] = rayColorFromHit(rays[lane], { hitTs[lane], (int)hitIndices[lane] });
+				}
+			}
+		}
+	};
+
+	std::vector<std::thread> threads;
+	for (int i = 1; i < numThreads; i++) {
+		threads.emplace_back(renderRows);
+	}
+	renderRows();
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+}
@@ -0,0 +1,183 @@
+#ifndef CPURAYTRACER_H_
+#define CPURAYTRACER_H_
+
+#include <memory>
+#include <vector>
+
+#include "4DUtils.h"
+#include "Scene.h"
+
+/**
+ * C++ port of shaders/shader.frag, so frames can be rendered without a GL context.
+ * The functions below mirror their GLSL counterparts one-to-one; if you change the
+ * shader, change these too.
+ */
+
+const float MIN_RAY_HIT_THRESHOLD = 0.001f;
+
+/** The most RaytracerParams::reflectionCount may be; colors are kept on the stack, like the shader does. */
+const int MAX_REFLECTION_COUNT = 16;
+
+struct Ray {
+	vec4 origin;
+
+	//For the purpose of this raytracer, the "direction" vector is the point in space that this
+	//ray will reach at t=pi/2.
+
+	//So the equation of this ray would be cos(t) * origin + sin(t) * direction
+	vec4 direction;
+};
+
+//Intersection only finds out which object is hit and where; everything else about the
+//surface is worked out afterwards, for the closest hit only (see shadeSphereHit).
+struct Hit {
+	float dist;
+	int objectIndex; //-1 if nothing was hit
+};
+
+struct Surface {
+	vec4 position;
+	vec4 normal;
+	vec3 color;
+};
+
+float geodesicDistance(vec4 p1, vec4 p2);
+vec4 pointAlongRay(const Ray& ray, float t);
+vec4 directionAtPointAlongRay(const Ray& ray, float t);
+Ray rayFromAToB(vec4 from, vec4 to);
+
+/** The t at which the ray hits the sphere, or -1 on a miss. */
+float sphereHitDistance(const Sphere& sphere, const Ray& ray);
+Surface shadeSphereHit(const Sphere& sphere, const Material& material, const Ray& ray, float t);
+
+/** The per-sphere values SphereHit derives from the sphere alone, computed once per scene. */
+struct PackedSphere {
+	vec4 center;
+	float cosRadius;
+	float planeOffset; // C in SphereHit: dot(center, center * cos(radius))
+	bool visibleFromInside;
+};
+
+inline PackedSphere packSphere(const Sphere& sphere) {
+	PackedSphere packed;
+	packed.center = sphere.center;
+	packed.cosRadius = cos(sphere.radius);
+	packed.planeOffset = dot(sphere.center, sphere.center * packed.cosRadius);
+	packed.visibleFromInside = sphere.visibleFromInside;
+	return packed;
+}
+
+/**
+ * A sphere in the camera frame, with everything that depends only on the ray origin
+ * precomputed (see the camera-frame section of RayPacket.h).
+ */
+struct CameraFrameSphere {
+	vec3 center;         // y, z, w of the center in the camera frame
+	float originDot;     // B: the center's x in the camera frame
+	float originDotSq;   // B^2
+	float missThreshold; // C^2 - B^2; the ray misses the sphere's hyperplane iff A^2 < this
+	float planeOffset;   // C
+	float index;
+	bool hiddenFromInside;
+};
+
+inline CameraFrameSphere makeCameraFrameSphere(const PackedSphere& sphere, int index, const mat4& toCameraFrame) {
+	vec4 center = toCameraFrame * sphere.center;
+
+	CameraFrameSphere cameraSphere;
+	cameraSphere.center = vec3(center.y, center.z, center.w);
+	cameraSphere.originDot = center.x;
+	cameraSphere.originDotSq = center.x * center.x;
+	cameraSphere.missThreshold = sphere.planeOffset * sphere.planeOffset - cameraSphere.originDotSq;
+	cameraSphere.planeOffset = sphere.planeOffset;
+	cameraSphere.index = (float)index;
+	cameraSphere.hiddenFromInside = !sphere.visibleFromInside && center.x >= sphere.cosRadius;
+	return cameraSphere;
+}
+
+class SphereBVH;
+template<class V> struct RayPacketT;
+template<class V> struct CameraRayPacketT;
+
+class CPURaytracer {
+public:
+	/** Throws std::runtime_error if params.reflectionCount is outside [0, MAX_REFLECTION_COUNT]. */
+	CPURaytracer(const Scene& scene, const RaytracerParams& params = RaytracerParams());
+	~CPURaytracer();
+
+	/**
+	 * Renders one view into pixels (width*height, bottom row first like gl_FragCoord).
+	 * numThreads = 0 uses every core.
+	 */
+	void render(const CurvedWorldPosAndRot& view, const mat4& projectionMat, int width, int height,
+		std::vector<vec3>& pixels, int numThreads = 0);
+
+	/**
+	 * Moves spheres[sphereIndices[i]] to centers[i] (normalized), refitting the hierarchy
+	 * rather than rebuilding it; see SphereBVH::refit.
+	 */
+	void moveSpheres(const std::vector<int>& sphereIndices, const std::vector<vec4>& centers);
+
+	Hit findClosestHit(const Ray& ray) const;
+
+	/** Whether any sphere but ignoredObjectIndex is hit at a t below tMax. Stops at the first one found. */
+	bool isOccluded(const Ray& ray, float tMax, int ignoredObjectIndex) const;
+	vec3 rayColor(Ray ray) const;
+
+	/** Same as rayColor(), but continues from an already known first hit. */
+	vec3 rayColorFromHit(Ray ray, Hit nearest) const;
+
+	/** Trace primary rays as SIMD packets (see RayPacket.h). On by default. */
+	void setPacketTracing(bool enabled) { _packetTracing = enabled; }
+
+	/**
+	 * Intersect packets of primary rays in a frame where the camera sits at (1, 0, 0, 0), with
+	 * the origin-dependent sphere terms precomputed per view. On by default; only used when
+	 * packet tracing is on. With the hierarchy, only the sphere tests in its leaves change.
+	 */
+	void setCameraFramePrimaryRays(bool enabled) { _cameraFramePrimaryRays = enabled; }
+
+	/**
+	 * Find hits through the bounding-cap hierarchy (see SphereBVH.h) instead of testing every
+	 * sphere. On by default for scenes with more than BVH_MIN_SPHERES spheres.
+	 */
+	void setUseBVH(bool enabled) { _useBVH = enabled; }
+
+	/**
+	 * Test shadow rays with a full closest-hit search, as shader.frag used to, instead of
+	 * isOccluded(). Off by default; kept so the two can be benchmarked against each other.
+	 */
+	void setClosestHitShadows(bool enabled) { _closestHitShadows = enabled; }
+
+	const Scene& getScene() const { return _scene; }
+	const RaytracerParams& getParams() const { return _params; }
+	const std::vector<PackedSphere>& getPackedSpheres() const { return _packedSpheres; }
+	const SphereBVH& getBVH() const { return *_bvh; }
+
+	static const int BVH_MIN_SPHERES = 16;
+
+private:
+	float calculateDiffuseLightingAndShadows(vec4 hitPos, vec4 normal, int hitObjectIndex) const;
+	float calculateDiffuseLight(const Light& light, vec4 hitPos, vec4 normal, int hitObjectIndex) const;
+
+	/** (t, sphere index) of the closest hit per lane, via the hierarchy or the plain loop. */
+	template<class V>
+	void findClosestHitIndices(const RayPacketT<V>& rays, V& closestT, V& closestIndex) const;
+
+	/** The same for primary rays, given both in world space and in the camera frame. */
+	template<class V>
+	void findClosestPrimaryHitIndices(const RayPacketT<V>& rays, const CameraRayPacketT<V>& cameraRays, V& closestT, V& closestIndex) const;
+
+	Scene _scene;
+	RaytracerParams _params;
+
+	std::vector<PackedSphere> _packedSpheres;
+	std::vector<CameraFrameSphere> _cameraFrameSpheres; // per sphere, rebuilt by every render()
+	std::unique_ptr<SphereBVH> _bvh;
+	bool _packetTracing = true;
+	bool _cameraFramePrimaryRays = true;
+	bool _closestHitShadows = false;
+	bool _useBVH;
+};
+
+#endif /* CPURAYTRACER_H_ */
@@ -0,0 +1,41 @@
+#include "DirtyRanges.h"
+
+#include <algorithm>
+
+void DirtyRanges::add(size_t begin, size_t end) {
+	if (begin >= end) {
+		return;
+	}
+	// Updates usually come in index order, so extending the last range is the common case
+	if (!_ranges.empty() && begin >= _ranges.back().begin && begin <= _ranges.back().end + _mergeGap) {
+		_ranges.back().end = std::max(_ranges.back().end, end);
+		return;
+	}
+	_sorted = _sorted && (_ranges.empty() || begin > _ranges.back().end);
+	_ranges.push_back({ begin, end });
+}
+
+void DirtyRanges::add(const DirtyRanges& other) {
+	for (const Range& range : other._ranges) {
+		add(range.begin, range.end);
+	}
+}
+
+const std::vector<DirtyRanges::Range>& DirtyRanges::get() {
+	if (_sorted) {
+		return _ranges;
+	}
+	std::sort(_ranges.begin(), _ranges.end(), [](const Range& a, const Range& b) { return a.begin < b.begin; });
+	size_t merged = 0;
+	for (size_t i = 1; i < _ranges.size(); i++) {
+		if (_ranges[i].begin <= _ranges[merged].end + _mergeGap) {
+			_ranges[merged].end = std::max(_ranges[merged].end, _ranges[i].end);
+		}
+		else {
+			_ranges[++merged] = _ranges[i];
+		}
+	}
+	_ranges.resize(merged + 1);
+	_sorted = true;
+	return _ranges;
+}
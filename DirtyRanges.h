@@ -0,0 +1,35 @@
+#ifndef DIRTYRANGES_H_
+#define DIRTYRANGES_H_
+
+#include <cstddef>
+#include <vector>
+
+/**
+ * The parts of an array that changed since it was last copied somewhere, as half-open index
+ * ranges. Ranges closer together than the merge gap are merged, since copying a few clean
+ * elements is cheaper than another flush call.
+ */
+class DirtyRanges {
+public:
+	struct Range {
+		size_t begin;
+		size_t end;
+	};
+
+	DirtyRanges(size_t mergeGap = 0) : _mergeGap(mergeGap) {}
+
+	void add(size_t begin, size_t end);
+	void add(const DirtyRanges& other);
+	void clear() { _ranges.clear(); _sorted = true; }
+	bool empty() const { return _ranges.empty(); }
+
+	/** The dirty ranges, sorted and merged. */
+	const std::vector<Range>& get();
+
+private:
+	size_t _mergeGap;
+	std::vector<Range> _ranges;
+	bool _sorted = true;
+};
+
+#endif /* DIRTYRANGES_H_ */
@@ -0,0 +1,175 @@
+#include "EventRecording.h"
+
+#include <cstring>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+
+namespace {
+
+const uint8_t NAME_RECORD = 0xFF;
+const size_t HEADER_SIZE = 16;
+
+template<class T>
+void append(std::vector<char>& bytes, const T& value) {
+	const char* begin = (const char*)&value;
+	bytes.insert(bytes.end(), begin, begin + sizeof(T));
+}
+
+/** Reads values out of the file's bytes, and whether the file ran out while doing so. */
+class RecordReader {
+public:
+	RecordReader(const std::vector<char>& bytes, size_t offset) : _bytes(bytes), _offset(offset) {}
+
+	bool atEnd() const { return _offset >= _bytes.size(); }
+	bool truncated() const { return _truncated; }
+
+	template<class T>
+	T read() {
+		T value = T();
+		readBytes(&value, sizeof(T));
+		return value;
+	}
+
+	void readBytes(void* out, size_t size) {
+		if (_truncated || _offset + size > _bytes.size()) {
+			_truncated = true;
+			return;
+		}
+		std::memcpy(out, &_bytes[_offset], size);
+		_offset += size;
+	}
+
+private:
+	const std::vector<char>& _bytes;
+	size_t _offset;
+	bool _truncated = false;
+};
+
+}
+
+int recordedDataSize(RecordedEvent::Type type) {
+	switch (type) {
+	case RecordedEvent::TRACKER_MOVE:
+		return 16;
+	case RecordedEvent::ANALOG_UPDATE:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+EventRecording loadEventRecording(const std::string& path) {
+	std::ifstream inFile(path, std::ios::in | std::ios::binary);
+	if (!inFile) {
+		throw std::runtime_error("could not load event recording " + path);
+	}
+	std::vector<char> bytes((std::istreambuf_iterator<char>(inFile)), std::istreambuf_iterator<char>());
+
+	uint32_t version = 0;
+	if (bytes.size() < HEADER_SIZE || std::memcmp(bytes.data(), EVENT_RECORDING_MAGIC, sizeof(EVENT_RECORDING_MAGIC)) != 0) {
+		throw std::runtime_error(path + ": not an event recording");
+	}
+	std::memcpy(&version, &bytes[sizeof(EVENT_RECORDING_MAGIC)], sizeof(version));
+	if (version != EVENT_RECORDING_VERSION) {
+		throw std::runtime_error(path + ": event recording version " + std::to_string(version) + " is not supported");
+	}
+
+	EventRecording recording;
+	RecordReader reader(bytes, HEADER_SIZE);
+	while (!reader.atEnd()) {
+		uint8_t kind = reader.read<uint8_t>();
+		if (kind == NAME_RECORD) {
+			uint8_t isHead = reader.read<uint8_t>();
+			std::string name(reader.read<uint16_t>(), '\0');
+			reader.readBytes(&name[0], name.size());
+			if (reader.truncated()) {
+				break;
+			}
+			recording.names.push_back(name);
+			recording.isHead.push_back(isHead != 0);
+			continue;
+		}
+		if (kind >= RecordedEvent::NUM_TYPES) {
+			throw std::runtime_error(path + ": unknown record kind " + std::to_string(kind));
+		}
+
+		RecordedEvent event = RecordedEvent();
+		event.type = (RecordedEvent::Type)kind;
+		event.time = reader.read<double>();
+		event.name = reader.read<uint16_t>();
+		reader.readBytes(event.data, sizeof(float) * recordedDataSize(event.type));
+		if (reader.truncated()) {
+			break;
+		}
+		if (event.name >= recording.names.size()) {
+			throw std::runtime_error(path + ": event refers to a name that doesn't exist");
+		}
+		recording.events.push_back(event);
+	}
+	return recording;
+}
+
+EventRecorder::EventRecorder(const std::string& path) : _path(path), _file(path, std::ios::out | std::ios::binary) {
+	if (!_file) {
+		throw std::runtime_error("could not open " + path + " for writing");
+	}
+	char header[HEADER_SIZE] = {};
+	std::memcpy(header, EVENT_RECORDING_MAGIC, sizeof(EVENT_RECORDING_MAGIC));
+	std::memcpy(header + sizeof(EVENT_RECORDING_MAGIC), &EVENT_RECORDING_VERSION, sizeof(EVENT_RECORDING_VERSION));
+	_file.write(header, sizeof(header));
+}
+
+EventRecorder::~EventRecorder() {
+	flush();
+}
+
+void EventRecorder::record(double time, RecordedEvent::Type type, const std::string& name, bool isHead, const float* data) {
+	if (!_recording) {
+		return;
+	}
+
+	std::unordered_map<std::string, uint16_t>::const_iterator found = _names.find(name);
+	uint16_t nameIndex;
+	if (found == _names.end()) {
+		if (_names.size() > UINT16_MAX || name.size() > UINT16_MAX) {
+			stop("too many or too long event names to record");
+			return;
+		}
+		nameIndex = (uint16_t)_names.size();
+		_names[name] = nameIndex;
+		append(_pending, NAME_RECORD);
+		append(_pending, (uint8_t)isHead);
+		append(_pending, (uint16_t)name.size());
+		_pending.insert(_pending.end(), name.begin(), name.end());
+	}
+	else {
+		nameIndex = found->second;
+	}
+
+	append(_pending, (uint8_t)type);
+	append(_pending, time);
+	append(_pending, nameIndex);
+	const char* dataBytes = (const char*)data;
+	_pending.insert(_pending.end(), dataBytes, dataBytes + sizeof(float) * recordedDataSize(type));
+}
+
+void EventRecorder::flush() {
+	if (!_recording) {
+		return;
+	}
+	_file.write(_pending.data(), _pending.size());
+	_file.flush();
+	_pending.clear();
+	if (!_file) {
+		stop("could not write " + _path);
+	}
+}
+
+void EventRecorder::stop(const std::string& reason) {
+	// Whatever made it to the file is still a readable recording
+	std::cerr << "Stopped recording events to " << _path << ": " << reason << std::endl;
+	_recording = false;
+	_pending.clear();
+	_file.close();
+}
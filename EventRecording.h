@@ -0,0 +1,90 @@
+#ifndef EVENTRECORDING_H_
+#define EVENTRECORDING_H_
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Input events recorded as they reached VRMultithreadedApp, for replaying without a headset
+ * (HeadlessRenderer --replay, or MinVR/ReplayEvents in the app's config).
+ *
+ * A recording is a 16 byte header followed by records, each starting with a one byte kind. A
+ * NAME record gives the next event name its index (names are written the first time they are
+ * used); every other kind is an event: time, name index, then its data. Files are written and
+ * read in the byte order of the machine. Records are written out once a frame (see
+ * EventRecorder::flush), so a recording cut short by a crash is still readable up to the last
+ * frame before it.
+ *
+ * Cursor moves aren't recorded.
+ */
+
+const char EVENT_RECORDING_MAGIC[8] = { 'S', '3', 'E', 'V', 'E', 'N', 'T', 'S' };
+const uint32_t EVENT_RECORDING_VERSION = 1;
+
+struct RecordedEvent {
+	enum Type : uint8_t {
+		TRACKER_MOVE,   // data: the tracker's transform, column-major
+		BUTTON_DOWN,
+		BUTTON_UP,
+		ANALOG_UPDATE,  // data[0]: the value
+		NUM_TYPES
+	};
+
+	double time;    // seconds since the app started running
+	Type type;
+	uint16_t name;  // index into EventRecording::names
+	float data[16];
+};
+
+struct EventRecording {
+	std::vector<std::string> names;
+	std::vector<bool> isHead; // per name, whether it's the head tracker
+	std::vector<RecordedEvent> events; // in the order they happened
+};
+
+/** The number of floats of data each type of event has in the file. */
+int recordedDataSize(RecordedEvent::Type type);
+
+/**
+ * Reads a whole recording. A last record that was cut short is dropped; anything else that's
+ * wrong with the file throws std::runtime_error.
+ */
+EventRecording loadEventRecording(const std::string& path);
+
+/**
+ * Appends events to a new recording file. Only opening it throws: once recording, a file that
+ * can't be written any more (a full disk, say) is reported on stderr and recording stops, so the
+ * app keeps running.
+ */
+class EventRecorder {
+public:
+	/** Throws std::runtime_error if path can't be opened for writing. */
+	EventRecorder(const std::string& path);
+	~EventRecorder();
+
+	/**
+	 * Buffers one event until the next flush(). data has recordedDataSize(type) floats. isHead is
+	 * only stored the first time a name is seen.
+	 */
+	void record(double time, RecordedEvent::Type type, const std::string& name, bool isHead, const float* data);
+
+	/** Writes the events recorded since the last call to the file; the app calls it every frame. */
+	void flush();
+
+	/** False once writing has failed; nothing is recorded after that. */
+	bool isRecording() const { return _recording; }
+
+private:
+	void stop(const std::string& reason);
+
+	std::string _path;
+	std::ofstream _file;
+	std::unordered_map<std::string, uint16_t> _names;
+	std::vector<char> _pending; // records not written yet, reused from frame to frame
+	bool _recording = true;
+};
+
+#endif /* EVENTRECORDING_H_ */
@@ -0,0 +1,157 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "EventRecording.h"
+#include "TestSupport.h"
+
+/**
+ * Event recordings written with EventRecorder and read back with loadEventRecording, run by
+ * ctest: whole recordings, recordings read after each frame's flush (what a crash leaves), and
+ * every shorter cut of the file. See TestSupport.h for the command line.
+ */
+
+const char* const RECORDING_PATH = "event-recording-test.s3events";
+
+class RandomCases : public TestRandom {
+public:
+	explicit RandomCases(unsigned seed) : TestRandom(seed) {}
+
+	/** An event of any type from one of numNames devices; name is an index into those. */
+	RecordedEvent event(double time, int numNames) {
+		RecordedEvent event = RecordedEvent();
+		event.time = time;
+		event.type = (RecordedEvent::Type)(seed() % RecordedEvent::NUM_TYPES);
+		event.name = (uint16_t)(seed() % numNames);
+		for (int i = 0; i < recordedDataSize(event.type); i++) {
+			event.data[i] = angle(100.0f);
+		}
+		return event;
+	}
+};
+
+static std::vector<char> readFile(const std::string& path) {
+	std::ifstream inFile(path, std::ios::in | std::ios::binary);
+	return std::vector<char>((std::istreambuf_iterator<char>(inFile)), std::istreambuf_iterator<char>());
+}
+
+static void writeFile(const std::string& path, const std::vector<char>& bytes, size_t size) {
+	std::ofstream outFile(path, std::ios::out | std::ios::binary | std::ios::trunc);
+	outFile.write(bytes.data(), size);
+}
+
+static bool sameEvent(const RecordedEvent& a, const RecordedEvent& b) {
+	return a.time == b.time && a.type == b.type && a.name == b.name
+		&& std::memcmp(a.data, b.data, sizeof(float) * recordedDataSize(a.type)) == 0;
+}
+
+/** loaded holds the first count of expected's events, names and all. */
+static void expectPrefix(const EventRecording& loaded, const EventRecording& expected, size_t count, const std::string& what) {
+	bool same = loaded.events.size() == count;
+	for (size_t i = 0; same && i < count; i++) {
+		const RecordedEvent& event = loaded.events[i];
+		same = sameEvent(event, expected.events[i]) && event.name < loaded.names.size()
+			&& loaded.names[event.name] == expected.names[event.name] && loaded.isHead[event.name] == expected.isHead[event.name];
+	}
+	expect(same, what + ": read back " + std::to_string(loaded.events.size()) + " events, expected the first " + std::to_string(count));
+}
+
+static void testRoundTrip(RandomCases& random, int iterations) {
+	const int numNames = 5;
+	std::vector<std::string> names;
+	for (int i = 0; i < numNames; i++) {
+		names.push_back(i == 0 ? "Head_Move" : "Device" + std::to_string(i));
+	}
+
+	// What should be read back: names are numbered in the order they're first used
+	EventRecording expected;
+	std::vector<int> fileIndex(numNames, -1);
+
+	// A few events a frame, each frame read back right after it's flushed
+	{
+		EventRecorder recorder(RECORDING_PATH);
+		double time = 0;
+		for (int frame = 0; frame < iterations; frame++) {
+			int eventsThisFrame = (int)(random.seed() % 4);
+			for (int i = 0; i < eventsThisFrame; i++) {
+				time += random.uniform() / 90.0;
+				RecordedEvent event = random.event(time, numNames);
+				int device = event.name;
+				recorder.record(event.time, event.type, names[device], device == 0, event.data);
+
+				if (fileIndex[device] < 0) {
+					fileIndex[device] = (int)expected.names.size();
+					expected.names.push_back(names[device]);
+					expected.isHead.push_back(device == 0);
+				}
+				event.name = (uint16_t)fileIndex[device];
+				expected.events.push_back(event);
+			}
+			recorder.flush();
+			expect(recorder.isRecording(), "stopped recording");
+			expectPrefix(loadEventRecording(RECORDING_PATH), expected, expected.events.size(),
+				"after frame " + std::to_string(frame));
+		}
+	}
+	expectPrefix(loadEventRecording(RECORDING_PATH), expected, expected.events.size(), "whole recording");
+
+	// Cut anywhere after the header, a recording reads back as some whole events and never fewer
+	// than a shorter cut did. Every cut through the names and first frames, then a sample of the
+	// rest, since each one reads the file again.
+	std::vector<char> bytes = readFile(RECORDING_PATH);
+	size_t previousCount = 0;
+	for (size_t size = 16; size <= bytes.size(); size = (size < 4096 || size == bytes.size()) ? size + 1 : std::min(size + 61, bytes.size())) {
+		writeFile(RECORDING_PATH, bytes, size);
+		EventRecording cut = loadEventRecording(RECORDING_PATH);
+		expectPrefix(cut, expected, cut.events.size(), "cut to " + std::to_string(size) + " bytes");
+		expect(cut.events.size() >= previousCount, "cut to " + std::to_string(size) + " bytes lost events a shorter cut had");
+		previousCount = cut.events.size();
+	}
+	expect(previousCount == expected.events.size(), "the uncut file lost events");
+
+	writeFile(RECORDING_PATH, bytes, 8);
+	bool threw = false;
+	try {
+		loadEventRecording(RECORDING_PATH);
+	}
+	catch (const std::runtime_error&) {
+		threw = true;
+	}
+	expect(threw, "a file shorter than the header was read as a recording");
+	std::remove(RECORDING_PATH);
+}
+
+static void testWriteErrors() {
+	bool threw = false;
+	try {
+		EventRecorder recorder("no-such-directory/recording.s3events");
+	}
+	catch (const std::runtime_error&) {
+		threw = true;
+	}
+	expect(threw, "a recording that can't be opened didn't throw");
+
+	// A disk that's full once recording has started: reported and stopped, not thrown
+	if (std::ifstream("/dev/full")) {
+		EventRecorder recorder("/dev/full");
+		float value = 1.0f;
+		recorder.record(0.0, RecordedEvent::ANALOG_UPDATE, "Trigger", false, &value);
+		recorder.flush();
+		expect(!recorder.isRecording(), "kept recording to a full disk");
+		recorder.record(1.0, RecordedEvent::ANALOG_UPDATE, "Trigger", false, &value);
+		recorder.flush();
+	}
+}
+
+int main(int argc, char **argv) {
+	return runTests(argc, argv, "frames of events", [](unsigned seed, int iterations) {
+		RandomCases random(seed);
+		testRoundTrip(random, iterations);
+		testWriteErrors();
+	});
+}
@@ -0,0 +1,317 @@
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "BinaryScene.h"
+#include "CPURaytracer.h"
+#include "EventRecording.h"
+#include "SceneStreamer.h"
+#include "UserHead.h"
+
+/**
+ * Command line front end for CPURaytracer: renders a single frame of a scene to a binary
+ * PPM, without MinVR or a GL context. With --replay it instead drives the camera from a
+ * recording of the VR app's head tracker and renders a frame at a fixed rate of recorded time,
+ * as fast as it can, printing a checksum of every view and pixel. Replays don't depend on the
+ * wall clock or the number of threads, so the checksum is the same on every run.
+ */
+
+static void printUsage(const char* exe) {
+	std::cerr << "Usage: " << exe << " [options]\n"
+		"  -o <file.ppm>              output image (default: frame.ppm)\n"
+		"  --size <width> <height>    image size in pixels (default: 1280 720)\n"
+		"  --threads <n>              worker threads, 0 = all cores (default: 0)\n"
+		"  --fov <degrees>            vertical field of view (default: 90)\n"
+		"  --near <z> --far <z>       clip planes (default: 0.1 100)\n"
+		"  --projection <16 floats>   column-major projection matrix, overrides --fov/--near/--far\n"
+		"  --pos <x y z w>            camera position on the 3-sphere\n"
+		"  --forward <x y z w>        camera forward direction\n"
+		"  --up <x y z w>             camera up direction\n"
+		"  --right <x y z w>          camera right direction\n"
+		"  --no-packets               trace primary rays one at a time instead of as SIMD packets\n"
+		"  --scene <file>             .scene or .s3scene to render (default: the built-in default scene)\n"
+		"  --stream-radius <r>        for .s3scene files, only load cells within r of the camera (default: 1)\n"
+		"  --max-spheres <n>          for .s3scene files, load at most n spheres (default: 1048576)\n"
+		"  --time <seconds>           where moving spheres are drawn (default: 0)\n"
+		"  --random-spheres <n>       add n randomly placed spheres to the default scene\n"
+		"  --seed <n>                 random seed for --random-spheres (default: 1)\n"
+		"  --no-bvh                   test every sphere instead of using the bounding-cap hierarchy\n"
+		"  --replay <file>            replay the head tracker moves of an event recording from the VR app\n"
+		"  --replay-rate <hz>         frames per second of recorded time (default: 90)\n"
+		"  --head-prediction-ms <ms>  head prediction horizon for --replay, as MinVR/HeadPredictionMs (default: 0)\n";
+}
+
+static void writePPM(const std::string& path, const std::vector<vec3>& pixels, int width, int height) {
+	std::ofstream outFile(path, std::ios::out | std::ios::binary);
+	if (!outFile) {
+		throw std::runtime_error("could not open " + path + " for writing");
+	}
+
+	outFile << "P6\n" << width << " " << height << "\n255\n";
+
+	// pixels are bottom row first (gl_FragCoord order), PPM is top row first
+	std::vector<unsigned char> row((size_t)width * 3);
+	for (int y = height - 1; y >= 0; y--) {
+		for (int x = 0; x < width; x++) {
+			vec3 color = clamp(pixels[(size_t)y * width + x], 0.0f, 1.0f);
+			row[x * 3 + 0] = (unsigned char)round(color.r * 255.0f);
+			row[x * 3 + 1] = (unsigned char)round(color.g * 255.0f);
+			row[x * 3 + 2] = (unsigned char)round(color.b * 255.0f);
+		}
+		outFile.write((const char*)row.data(), row.size());
+	}
+}
+
+/** FNV-1a, for telling whether two replays came out bit for bit the same. */
+static void hashBytes(const void* data, size_t size, uint64_t& hash) {
+	const unsigned char* bytes = (const unsigned char*)data;
+	for (size_t i = 0; i < size; i++) {
+		hash = (hash ^ bytes[i]) * 1099511628211ull;
+	}
+}
+
+/**
+ * Renders a frame every 1 / frameRate seconds of the recording from start to end, after the
+ * newest head pose up to then, the way the VR app coalesces them. The last frame is left in pixels.
+ */
+static void replayRecording(const EventRecording& recording, CPURaytracer& raytracer, const Scene& scene,
+	const CurvedWorldPosAndRot& initialView, const mat4& projectionMat, int width, int height, int numThreads,
+	double frameRate, double predictionHorizon, std::vector<vec3>& pixels) {
+	// The same movement scale as MyVRApp::USER_SCALE
+	const float userScale = 1.0f;
+	UserHead userHead(initialView, userScale, predictionHorizon);
+	double endTime = recording.events.empty() ? 0.0 : recording.events.back().time;
+
+	std::vector<int> movingSpheres;
+	std::vector<vec4> movingCenters(scene.motions.size());
+	for (const SphereMotion& motion : scene.motions) {
+		movingSpheres.push_back(motion.sphereIndex);
+	}
+
+	uint64_t checksum = 14695981039346656037ull;
+	size_t nextEvent = 0;
+	int numFrames = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (double frameTime = 0.0; frameTime <= endTime; frameTime = ++numFrames / frameRate) {
+		const RecordedEvent* newestHeadMove = nullptr;
+		for (; nextEvent < recording.events.size() && recording.events[nextEvent].time <= frameTime; nextEvent++) {
+			const RecordedEvent& event = recording.events[nextEvent];
+			if (event.type == RecordedEvent::TRACKER_MOVE && recording.isHead[event.name]) {
+				newestHeadMove = &event;
+			}
+		}
+		if (newestHeadMove) {
+			userHead.addSample(newestHeadMove->time, make_mat4(newestHeadMove->data));
+		}
+
+		if (!movingSpheres.empty()) {
+			for (size_t i = 0; i < scene.motions.size(); i++) {
+				movingCenters[i] = scene.motions[i].centerAt(frameTime);
+			}
+			raytracer.moveSpheres(movingSpheres, movingCenters);
+		}
+
+		// Drawn from the head itself, with the prediction on top, as each eye is in the VR app
+		CurvedWorldPosAndRot view = userHead.getUserState();
+		changeByMatrixDifference(userHead.getHeadMatrix(), userHead.getHeadPrediction() * userHead.getHeadMatrix(), userScale, &view);
+		raytracer.render(view, projectionMat, width, height, pixels, numThreads);
+
+		hashBytes(&view, sizeof(view), checksum);
+		hashBytes(pixels.data(), pixels.size() * sizeof(vec3), checksum);
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	std::cout << "Replayed " << recording.events.size() << " events over " << endTime << " s as " << numFrames
+		<< " frames in " << seconds * 1000.0 << " ms (" << numFrames / seconds << " frames/s, "
+		<< endTime / seconds << "x real time)" << std::endl;
+	std::cout << "Checksum " << std::hex << checksum << std::dec << std::endl;
+}
+
+int main(int argc, char **argv) {
+	std::string outputPath = "frame.ppm";
+	std::string scenePath;
+	int width = 1280;
+	int height = 720;
+	int numThreads = 0;
+	float fovDegrees = 90;
+	float nearZ = 0.1f;
+	float farZ = 100;
+	bool hasProjection = false;
+	bool packetTracing = true;
+	bool useBVH = true;
+	int randomSpheres = 0;
+	unsigned seed = 1;
+	float streamRadius = DEFAULT_STREAM_RADIUS;
+	size_t maxSpheres = DEFAULT_MAX_RESIDENT_SPHERES;
+	float sceneTime = 0;
+	std::string replayPath;
+	float replayRate = 90;
+	float headPredictionMs = 0;
+	mat4 projectionMat;
+
+	// Same starting state as MyVRApp::initialUserState
+	CurvedWorldPosAndRot view = { vec4(0,1,0,0), vec4(1,0,0,0), vec4(0,0,0,1), vec4(0,0,1,0) };
+
+	auto readFloats = [&](int& i, float* out, int count) {
+		if (i + count >= argc) {
+			throw std::runtime_error(std::string("missing values for ") + argv[i]);
+		}
+		for (int j = 0; j < count; j++) {
+			out[j] = (float)std::atof(argv[++i]);
+		}
+	};
+
+	try {
+		for (int i = 1; i < argc; i++) {
+			std::string arg = argv[i];
+			float values[16];
+			if (arg == "-o" && i + 1 < argc) {
+				outputPath = argv[++i];
+			}
+			else if (arg == "--size") {
+				readFloats(i, values, 2);
+				width = (int)values[0];
+				height = (int)values[1];
+			}
+			else if (arg == "--threads") {
+				readFloats(i, values, 1);
+				numThreads = (int)values[0];
+			}
+			else if (arg == "--fov") {
+				readFloats(i, &fovDegrees, 1);
+			}
+			else if (arg == "--near") {
+				readFloats(i, &nearZ, 1);
+			}
+			else if (arg == "--far") {
+				readFloats(i, &farZ, 1);
+			}
+			else if (arg == "--projection") {
+				readFloats(i, values, 16);
+				std::memcpy(&projectionMat[0][0], values, sizeof(values));
+				hasProjection = true;
+			}
+			else if (arg == "--pos") {
+				readFloats(i, &view.pos[0], 4);
+			}
+			else if (arg == "--forward") {
+				readFloats(i, &view.forwardDir[0], 4);
+			}
+			else if (arg == "--up") {
+				readFloats(i, &view.upDir[0], 4);
+			}
+			else if (arg == "--right") {
+				readFloats(i, &view.rightDir[0], 4);
+			}
+			else if (arg == "--no-packets") {
+				packetTracing = false;
+			}
+			else if (arg == "--scene" && i + 1 < argc) {
+				scenePath = argv[++i];
+			}
+			else if (arg == "--stream-radius") {
+				readFloats(i, &streamRadius, 1);
+			}
+			else if (arg == "--max-spheres") {
+				readFloats(i, values, 1);
+				maxSpheres = (size_t)values[0];
+			}
+			else if (arg == "--time") {
+				readFloats(i, &sceneTime, 1);
+			}
+			else if (arg == "--random-spheres") {
+				readFloats(i, values, 1);
+				randomSpheres = (int)values[0];
+			}
+			else if (arg == "--seed") {
+				readFloats(i, values, 1);
+				seed = (unsigned)values[0];
+			}
+			else if (arg == "--no-bvh") {
+				useBVH = false;
+			}
+			else if (arg == "--replay" && i + 1 < argc) {
+				replayPath = argv[++i];
+			}
+			else if (arg == "--replay-rate") {
+				readFloats(i, &replayRate, 1);
+			}
+			else if (arg == "--head-prediction-ms") {
+				readFloats(i, &headPredictionMs, 1);
+			}
+			else {
+				printUsage(argv[0]);
+				return 1;
+			}
+		}
+
+		if (width <= 0 || height <= 0) {
+			throw std::runtime_error("image size must be positive");
+		}
+		if (replayRate <= 0) {
+			throw std::runtime_error("replay rate must be positive");
+		}
+		if (!hasProjection) {
+			projectionMat = perspective(radians(fovDegrees), (float)width / height, nearZ, farZ);
+		}
+
+		auto start = std::chrono::steady_clock::now();
+		Scene scene;
+		if (!scenePath.empty() && isBinaryScenePath(scenePath)) {
+			// The same cells the VR app would have streamed in at this position
+			MappedScene mappedScene(scenePath);
+			SceneBuffers buffers = mappedScene.getFixedBuffers();
+			mappedScene.appendCellSpheres(mappedScene.selectCells(view.pos, streamRadius, maxSpheres), buffers.spheres);
+			scene = unpackSceneBuffers(buffers);
+		}
+		else if (!scenePath.empty()) {
+			scene = loadScene(scenePath);
+		}
+		else {
+			scene = randomSpheres > 0 ? makeRandomScene(randomSpheres, seed) : makeDefaultScene();
+		}
+		for (const SphereMotion& motion : scene.motions) {
+			scene.spheres[motion.sphereIndex].center = motion.centerAt(sceneTime);
+		}
+		CPURaytracer raytracer(scene);
+		std::cout << "Loaded " << scene.spheres.size() << " spheres in "
+			<< std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() * 1000.0 << " ms" << std::endl;
+
+		raytracer.setPacketTracing(packetTracing);
+		if (!useBVH) {
+			raytracer.setUseBVH(false);
+		}
+		std::vector<vec3> pixels;
+
+		if (!replayPath.empty()) {
+			replayRecording(loadEventRecording(replayPath), raytracer, scene, view, projectionMat, width, height, numThreads,
+				replayRate, headPredictionMs / 1000.0, pixels);
+			writePPM(outputPath, pixels, width, height);
+			return 0;
+		}
+
+		start = std::chrono::steady_clock::now();
+		raytracer.render(view, projectionMat, width, height, pixels, numThreads);
+		auto end = std::chrono::steady_clock::now();
+
+		double seconds = std::chrono::duration<double>(end - start).count();
+		std::cout << "Rendered " << width << "x" << height << " in " << seconds * 1000.0 << " ms ("
+			<< (width * (double)height) / seconds / 1e6 << " Mpixels/s)" << std::endl;
+
+		writePPM(outputPath, pixels, width, height);
+	}
+	catch (const std::exception& e) {
+		std::cerr << "Error: " << e.what() << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
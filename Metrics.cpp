@@ -0,0 +1,148 @@
+#include "Metrics.h"
+
+#include <algorithm>
+#include <cmath>
+#include <sstream>
+
+const double MetricHistogram::MIN_VALUE = 1e-6;
+
+namespace {
+
+std::string withLabels(const std::string& name, const std::string& labels, const std::string& extraLabel = "") {
+	std::string allLabels = labels;
+	if (!extraLabel.empty()) {
+		allLabels += (allLabels.empty() ? "" : ",") + extraLabel;
+	}
+	return allLabels.empty() ? name : name + "{" + allLabels + "}";
+}
+
+// Prometheus spells it NaN
+std::string formatValue(double value) {
+	if (std::isnan(value)) {
+		return "NaN";
+	}
+	std::ostringstream out;
+	out.precision(9);
+	out << value;
+	return out.str();
+}
+
+// NaN if there were no observations
+double percentile(const std::vector<uint64_t>& from, const std::vector<uint64_t>& to, double fraction) {
+	uint64_t total = 0;
+	for (int bucket = 0; bucket < MetricHistogram::NUM_BUCKETS; bucket++) {
+		total += to[bucket] - from[bucket];
+	}
+	if (total == 0) {
+		return NAN;
+	}
+
+	uint64_t rank = std::max((uint64_t)1, (uint64_t)std::ceil(fraction * total));
+	uint64_t seen = 0;
+	for (int bucket = 0; bucket < MetricHistogram::NUM_BUCKETS; bucket++) {
+		seen += to[bucket] - from[bucket];
+		if (seen >= rank) {
+			return MetricHistogram::bucketValue(bucket);
+		}
+	}
+	return MetricHistogram::bucketValue(MetricHistogram::NUM_BUCKETS - 1);
+}
+
+}
+
+void MetricHistogram::observe(double seconds) {
+	int bucket = 0;
+	if (seconds > MIN_VALUE) {
+		bucket = std::min(NUM_BUCKETS - 1, (int)(std::log2(seconds / MIN_VALUE) * BUCKETS_PER_DOUBLING));
+	}
+	_buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+	_sumNanoseconds.fetch_add((uint64_t)(std::max(0.0, seconds) * 1e9), std::memory_order_relaxed);
+}
+
+double MetricHistogram::bucketValue(int bucket) {
+	return MIN_VALUE * std::exp2((bucket + 0.5) / BUCKETS_PER_DOUBLING);
+}
+
+MetricCounter& MetricsRegistry::addCounter(const std::string& name, const std::string& help, const std::string& labels) {
+	std::lock_guard<std::mutex> lock(_mutex);
+	_counters.emplace_back(new MetricCounter());
+	_counterInfo.push_back({ name, help, labels });
+	return *_counters.back();
+}
+
+MetricHistogram& MetricsRegistry::addHistogram(const std::string& name, const std::string& help, const std::string& labels) {
+	std::lock_guard<std::mutex> lock(_mutex);
+	_histograms.emplace_back(new MetricHistogram());
+	_histogramInfo.push_back({ name, help, labels });
+	return *_histograms.back();
+}
+
+MetricsSnapshot MetricsRegistry::snapshot(double time) const {
+	std::lock_guard<std::mutex> lock(_mutex);
+	MetricsSnapshot snapshot;
+	snapshot.time = time;
+	for (const std::unique_ptr<MetricCounter>& counter : _counters) {
+		snapshot.counters.push_back(counter->get());
+	}
+	for (const std::unique_ptr<MetricHistogram>& histogram : _histograms) {
+		std::vector<uint64_t> values(MetricHistogram::NUM_BUCKETS + 1);
+		for (int bucket = 0; bucket < MetricHistogram::NUM_BUCKETS; bucket++) {
+			values[bucket] = histogram->getBucket(bucket);
+		}
+		values[MetricHistogram::NUM_BUCKETS] = histogram->getSumNanoseconds();
+		snapshot.histograms.push_back(values);
+	}
+	return snapshot;
+}
+
+std::string MetricsRegistry::format(const MetricsSnapshot& from, const MetricsSnapshot& to) const {
+	std::lock_guard<std::mutex> lock(_mutex);
+	std::ostringstream out;
+	out.precision(9);
+	double seconds = to.time - from.time;
+
+	// Metrics registered after the earlier snapshot count from zero
+	for (size_t i = 0; i < to.counters.size(); i++) {
+		const Info& info = _counterInfo[i];
+		bool first = i == 0 || _counterInfo[i - 1].name != info.name;
+		if (first) {
+			out << "# HELP " << info.name << "_total " << info.help << "\n";
+			out << "# TYPE " << info.name << "_total counter\n";
+		}
+		out << withLabels(info.name + "_total", info.labels) << " " << to.counters[i] << "\n";
+	}
+	for (size_t i = 0; i < to.counters.size(); i++) {
+		const Info& info = _counterInfo[i];
+		bool first = i == 0 || _counterInfo[i - 1].name != info.name;
+		if (first) {
+			out << "# HELP " << info.name << "_per_second " << info.help << ", per second over the last "
+				<< seconds << " s\n";
+			out << "# TYPE " << info.name << "_per_second gauge\n";
+		}
+		uint64_t before = i < from.counters.size() ? from.counters[i] : 0;
+		double rate = seconds > 0.0 ? (to.counters[i] - before) / seconds : 0.0;
+		out << withLabels(info.name + "_per_second", info.labels) << " " << rate << "\n";
+	}
+
+	std::vector<uint64_t> empty(MetricHistogram::NUM_BUCKETS + 1, 0);
+	for (size_t i = 0; i < to.histograms.size(); i++) {
+		const Info& info = _histogramInfo[i];
+		const std::vector<uint64_t>& before = i < from.histograms.size() ? from.histograms[i] : empty;
+		const std::vector<uint64_t>& after = to.histograms[i];
+		bool first = i == 0 || _histogramInfo[i - 1].name != info.name;
+		if (first) {
+			out << "# HELP " << info.name << " " << info.help << "; percentiles over the last " << seconds << " s\n";
+			out << "# TYPE " << info.name << " summary\n";
+		}
+		out << withLabels(info.name, info.labels, "quantile=\"0.5\"") << " " << formatValue(percentile(before, after, 0.5)) << "\n";
+		out << withLabels(info.name, info.labels, "quantile=\"0.99\"") << " " << formatValue(percentile(before, after, 0.99)) << "\n";
+
+		uint64_t count = 0;
+		for (int bucket = 0; bucket < MetricHistogram::NUM_BUCKETS; bucket++) {
+			count += after[bucket];
+		}
+		out << withLabels(info.name + "_sum", info.labels) << " " << after[MetricHistogram::NUM_BUCKETS] / 1e9 << "\n";
+		out << withLabels(info.name + "_count", info.labels) << " " << count << "\n";
+	}
+	return out.str();
+}
@@ -0,0 +1,88 @@
+#ifndef METRICS_H_
+#define METRICS_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * Counters and histograms that can be updated from any thread with a few relaxed atomic adds,
+ * so the render threads never wait on whoever is reading them. Metrics are registered up front
+ * (registering takes a lock); after that, reading is done by taking a MetricsSnapshot and
+ * formatting two of them, which gives rates and percentiles over the time between them.
+ *
+ * The format is the Prometheus text exposition format: counters get a _total and a
+ * _per_second line, histograms get their 50th and 99th percentiles plus a _sum and _count.
+ */
+
+class MetricCounter {
+public:
+	void add(uint64_t count = 1) { _value.fetch_add(count, std::memory_order_relaxed); }
+	uint64_t get() const { return _value.load(std::memory_order_relaxed); }
+
+private:
+	std::atomic<uint64_t> _value{ 0 };
+};
+
+/**
+ * Durations in seconds, in buckets that are each 2^(1/8) (about 9%) wider than the last, from
+ * a microsecond to a few minutes. Percentiles are accurate to within half a bucket.
+ */
+class MetricHistogram {
+public:
+	static const int BUCKETS_PER_DOUBLING = 8;
+	static const int NUM_BUCKETS = 28 * BUCKETS_PER_DOUBLING;
+	static const double MIN_VALUE;
+
+	void observe(double seconds);
+
+	uint64_t getBucket(int bucket) const { return _buckets[bucket].load(std::memory_order_relaxed); }
+	uint64_t getSumNanoseconds() const { return _sumNanoseconds.load(std::memory_order_relaxed); }
+
+	/** The value in the middle of a bucket. */
+	static double bucketValue(int bucket);
+
+private:
+	std::atomic<uint64_t> _buckets[NUM_BUCKETS] = {};
+	std::atomic<uint64_t> _sumNanoseconds{ 0 };
+};
+
+struct MetricsSnapshot {
+	double time = 0.0; // seconds, on any clock, as long as both snapshots being compared use it
+	std::vector<uint64_t> counters;
+	std::vector<std::vector<uint64_t>> histograms; // buckets, then the sum in nanoseconds
+};
+
+class MetricsRegistry {
+public:
+	/**
+	 * name follows Prometheus conventions without the _total; labels is empty or a label list
+	 * such as eye="left". Metrics sharing a name must share help and be registered together.
+	 * The returned references stay valid as long as the registry.
+	 */
+	MetricCounter& addCounter(const std::string& name, const std::string& help, const std::string& labels = "");
+	MetricHistogram& addHistogram(const std::string& name, const std::string& help, const std::string& labels = "");
+
+	MetricsSnapshot snapshot(double time) const;
+
+	/** Everything in the registry, with rates and percentiles over from..to. */
+	std::string format(const MetricsSnapshot& from, const MetricsSnapshot& to) const;
+
+private:
+	struct Info {
+		std::string name;
+		std::string help;
+		std::string labels;
+	};
+
+	mutable std::mutex _mutex;
+	std::vector<std::unique_ptr<MetricCounter>> _counters;
+	std::vector<Info> _counterInfo;
+	std::vector<std::unique_ptr<MetricHistogram>> _histograms;
+	std::vector<Info> _histogramInfo;
+};
+
+#endif /* METRICS_H_ */
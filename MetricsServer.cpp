@@ -0,0 +1,117 @@
+#include "MetricsServer.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+#ifdef MSG_NOSIGNAL
+const int SEND_FLAGS = MSG_NOSIGNAL;
+#else
+const int SEND_FLAGS = 0;
+#endif
+
+// How often the server thread looks at _stop
+const int POLL_MILLISECONDS = 100;
+
+}
+
+#ifdef _WIN32
+
+MetricsServer::MetricsServer(const MetricsRegistry& registry, const std::string& socketPath, int windowSeconds)
+	: _registry(registry), _socketPath(socketPath), _windowSeconds(windowSeconds), _startTime(std::chrono::steady_clock::now()), _listenSocket(-1) {
+	throw std::runtime_error("the metrics socket is not supported on Windows");
+}
+
+MetricsServer::~MetricsServer() {}
+
+void MetricsServer::run() {}
+
+#else
+
+MetricsServer::MetricsServer(const MetricsRegistry& registry, const std::string& socketPath, int windowSeconds)
+	: _registry(registry), _socketPath(socketPath), _windowSeconds(std::max(1, windowSeconds)), _startTime(std::chrono::steady_clock::now()) {
+	sockaddr_un address = {};
+	address.sun_family = AF_UNIX;
+	if (socketPath.empty() || socketPath.size() >= sizeof(address.sun_path)) {
+		throw std::runtime_error("metrics socket path " + socketPath + " is empty or too long");
+	}
+	std::strcpy(address.sun_path, socketPath.c_str());
+
+	_listenSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (_listenSocket < 0) {
+		throw std::runtime_error("could not create the metrics socket");
+	}
+	// Left behind if the last run crashed
+	unlink(socketPath.c_str());
+	if (bind(_listenSocket, (const sockaddr*)&address, sizeof(address)) != 0 || listen(_listenSocket, 8) != 0) {
+		close(_listenSocket);
+		throw std::runtime_error("could not listen on metrics socket " + socketPath + ": " + std::strerror(errno));
+	}
+
+	_snapshots.push_back(takeSnapshot());
+	_thread = std::thread(&MetricsServer::run, this);
+}
+
+MetricsServer::~MetricsServer() {
+	_stop = true;
+	_thread.join();
+	close(_listenSocket);
+	unlink(_socketPath.c_str());
+}
+
+void MetricsServer::run() {
+	typedef std::chrono::steady_clock Clock;
+	Clock::time_point nextSnapshot = Clock::now() + std::chrono::seconds(1);
+	while (!_stop) {
+		pollfd listening = { _listenSocket, POLLIN, 0 };
+		int ready = poll(&listening, 1, POLL_MILLISECONDS);
+
+		if (Clock::now() >= nextSnapshot) {
+			_snapshots.push_back(takeSnapshot());
+			if (_snapshots.size() > _windowSeconds + 1) {
+				_snapshots.pop_front();
+			}
+			nextSnapshot += std::chrono::seconds(1);
+		}
+
+		if (ready <= 0 || (listening.revents & POLLIN) == 0) {
+			continue;
+		}
+		int client = accept(_listenSocket, nullptr, nullptr);
+		if (client < 0) {
+			continue;
+		}
+		// A client that doesn't read is given up on rather than waited for
+		timeval timeout = { 1, 0 };
+		setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+#ifdef SO_NOSIGPIPE
+		int noSigPipe = 1;
+		setsockopt(client, SOL_SOCKET, SO_NOSIGPIPE, &noSigPipe, sizeof(noSigPipe));
+#endif
+		std::string text = _registry.format(_snapshots.front(), takeSnapshot());
+		for (size_t sent = 0; sent < text.size();) {
+			ssize_t result = send(client, text.data() + sent, text.size() - sent, SEND_FLAGS);
+			if (result <= 0) {
+				break;
+			}
+			sent += result;
+		}
+		close(client);
+	}
+}
+
+#endif
+
+MetricsSnapshot MetricsServer::takeSnapshot() const {
+	return _registry.snapshot(std::chrono::duration<double>(std::chrono::steady_clock::now() - _startTime).count());
+}
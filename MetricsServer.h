@@ -0,0 +1,49 @@
+#ifndef METRICSSERVER_H_
+#define METRICSSERVER_H_
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <string>
+#include <thread>
+
+#include "Metrics.h"
+
+/**
+ * Serves a MetricsRegistry on a Unix domain socket, from a thread of its own: every client
+ * that connects is sent the metrics in text form and disconnected, e.g.
+ *
+ *     socat - UNIX-CONNECT:/tmp/raytracer.metrics
+ *
+ * Rates and percentiles are over the last windowSeconds, from snapshots the thread takes once a
+ * second. Nothing here takes a lock that the threads updating the metrics do, so a slow or
+ * stuck client only ever holds up this thread.
+ */
+class MetricsServer {
+public:
+	/** Replaces anything already at socketPath. Throws std::runtime_error if it can't listen. */
+	MetricsServer(const MetricsRegistry& registry, const std::string& socketPath, int windowSeconds = 10);
+	~MetricsServer();
+
+	MetricsServer(const MetricsServer&) = delete;
+	MetricsServer& operator=(const MetricsServer&) = delete;
+
+private:
+	void run();
+	MetricsSnapshot takeSnapshot() const;
+
+	const MetricsRegistry& _registry;
+	const std::string _socketPath;
+	const size_t _windowSeconds;
+	const std::chrono::steady_clock::time_point _startTime;
+
+	int _listenSocket;
+	std::atomic<bool> _stop{ false };
+
+	// Only touched by the server thread: one a second, oldest first
+	std::deque<MetricsSnapshot> _snapshots;
+
+	std::thread _thread;
+};
+
+#endif /* METRICSSERVER_H_ */
@@ -0,0 +1,25 @@
+#ifndef PARALLEL_H_
+#define PARALLEL_H_
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+/**
+ * Runs fn(chunkBegin, chunkEnd, chunkIndex) over [begin, end) split into numThreads chunks.
+ * Chunk 0 runs on the calling thread.
+ */
+template<class Fn>
+void parallelChunks(int begin, int end, int numThreads, Fn fn) {
+	int chunkSize = (end - begin + numThreads - 1) / numThreads;
+	std::vector<std::thread> threads;
+	for (int chunkBegin = begin + chunkSize; chunkBegin < end; chunkBegin += chunkSize) {
+		threads.emplace_back(fn, chunkBegin, std::min(end, chunkBegin + chunkSize), (int)threads.size() + 1);
+	}
+	fn(begin, std::min(end, begin + chunkSize), 0);
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+}
+
+#endif /* PARALLEL_H_ */
@@ -0,0 +1,68 @@
+#include "PosePredictor.h"
+
+#include <algorithm>
+#include <cmath>
+
+const double PosePredictor::MAX_HORIZON = 0.1;
+
+namespace {
+
+/** axis * angle of a unit quaternion, taking the short way round. */
+vec3 rotationVector(quat q) {
+	if (q.w < 0.0f) {
+		q = -q;
+	}
+	vec3 v(q.x, q.y, q.z);
+	float sinHalfAngle = length(v);
+	if (sinHalfAngle < 1e-7f) {
+		return 2.0f * v;
+	}
+	return v * (2.0f * std::atan2(sinHalfAngle, q.w) / sinHalfAngle);
+}
+
+}
+
+void PosePredictor::addSample(double time, const mat4& pose) {
+	quat rotation = normalize(quat_cast(mat3(pose)));
+	double dt = time - _time;
+
+	if (_numSamples > 0 && dt <= 0.0) {
+		_pose = pose;
+		_rotation = rotation;
+		return;
+	}
+	if (_numSamples == 0 || dt > MAX_HORIZON) {
+		_velocity = vec3(0);
+		_angularVelocity = vec3(0);
+		_numSamples = 0;
+	}
+	else {
+		vec3 velocity = (vec3(pose[3]) - vec3(_pose[3])) / (float)dt;
+		vec3 angularVelocity = rotationVector(rotation * conjugate(_rotation)) / (float)dt;
+		// The first estimate is taken as is; after that each one counts for more the longer
+		// it was since the last
+		float blend = _numSamples == 1 ? 1.0f : (float)(1.0 - std::exp(-dt / _velocityTimeConstant));
+		_velocity = mix(_velocity, velocity, blend);
+		_angularVelocity = mix(_angularVelocity, angularVelocity, blend);
+	}
+
+	_numSamples++;
+	_time = time;
+	_pose = pose;
+	_rotation = rotation;
+}
+
+mat4 PosePredictor::predict(double time) const {
+	float horizon = (float)std::min(std::max(time - _time, 0.0), MAX_HORIZON);
+	if (horizon == 0.0f || _numSamples < 2) {
+		return _pose;
+	}
+
+	vec3 turn = _angularVelocity * horizon;
+	float turnAngle = length(turn);
+	quat rotation = turnAngle > 1e-7f ? angleAxis(turnAngle, turn / turnAngle) * _rotation : _rotation;
+
+	mat4 result = mat4_cast(rotation);
+	result[3] = vec4(vec3(_pose[3]) + _velocity * horizon, 1.0f);
+	return result;
+}
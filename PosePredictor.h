@@ -0,0 +1,47 @@
+#ifndef POSEPREDICTOR_H_
+#define POSEPREDICTOR_H_
+
+#include "4DUtils.h"
+
+/**
+ * Predicts where a tracker will be a little later from its recent samples, so the view can be
+ * drawn for where the head will be when the frame is on screen rather than where it was when
+ * the tracker last reported.
+ *
+ * The model is constant linear and angular velocity. Both velocities are estimated from
+ * consecutive samples and smoothed over about velocityTimeConstant seconds, which trades
+ * tracker noise against how quickly a change of direction is picked up. The pose itself is
+ * never smoothed, so predicting no time ahead gives back the latest sample exactly.
+ */
+class PosePredictor {
+public:
+	/** Predictions never go further than this past the latest sample. */
+	static const double MAX_HORIZON;
+
+	PosePredictor(double velocityTimeConstant = 0.02) : _velocityTimeConstant(velocityTimeConstant) {}
+
+	/**
+	 * Adds a rigid tracker pose sampled at time (seconds, any fixed origin). A sample no later
+	 * than the previous one replaces it without changing the velocities; after a gap of more
+	 * than MAX_HORIZON the velocities start over.
+	 */
+	void addSample(double time, const mat4& pose);
+
+	bool empty() const { return _numSamples == 0; }
+	double getLatestTime() const { return _time; }
+	const mat4& getLatestPose() const { return _pose; }
+
+	/** The pose at time, extrapolated from the latest sample. Times before it give the latest sample. */
+	mat4 predict(double time) const;
+
+private:
+	double _velocityTimeConstant;
+	int _numSamples = 0;
+	double _time = 0;
+	mat4 _pose = mat4(1.0f);
+	quat _rotation;
+	vec3 _velocity = vec3(0);
+	vec3 _angularVelocity = vec3(0); // axis * radians per second, in tracker space
+};
+
+#endif /* POSEPREDICTOR_H_ */
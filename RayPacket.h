@@ -0,0 +1,192 @@
+#ifndef RAYPACKET_H_
+#define RAYPACKET_H_
+
+#include <vector>
+
+#include "CPURaytracer.h"
+#include "SIMD.h"
+
+/**
+ * Structure-of-arrays ray packets and a packet version of SphereHitDistance.
+ *
+ * Like the scalar path, the packet kernel only answers "which sphere is hit first, and at
+ * what t"; shadeSphereHit() fills in the rest for the winning sphere only.
+ */
+
+template<class V>
+struct RayPacketT {
+	V ox, oy, oz, ow;
+	V dx, dy, dz, dw;
+
+	/** Gathers V::width rays; the packet is padded with copies of the last ray. */
+	static RayPacketT gather(const Ray* rays, int count) {
+		float o[4][V::width];
+		float d[4][V::width];
+		for (int lane = 0; lane < V::width; lane++) {
+			const Ray& ray = rays[lane < count ? lane : count - 1];
+			for (int c = 0; c < 4; c++) {
+				o[c][lane] = ray.origin[c];
+				d[c][lane] = ray.direction[c];
+			}
+		}
+		RayPacketT packet;
+		packet.ox = V::load(o[0]); packet.oy = V::load(o[1]); packet.oz = V::load(o[2]); packet.ow = V::load(o[3]);
+		packet.dx = V::load(d[0]); packet.dy = V::load(d[1]); packet.dz = V::load(d[2]); packet.dw = V::load(d[3]);
+		return packet;
+	}
+};
+
+typedef RayPacketT<floatv> RayPacket;
+
+/**
+ * The rest of SphereHit's distance logic once the plane terms are known: A and B are the
+ * sphere center dotted with the ray direction and origin, asinInput is C / sqrt(A^2 + B^2).
+ * hiddenFromInside marks lanes that start inside a sphere that isn't visible from inside.
+ */
+template<class V>
+SIMD_INLINE typename V::mask hitDistanceFromPlaneTerms(V A, V B, V asinInput, typename V::mask valid,
+	typename V::mask hiddenFromInside, V& t) {
+	V phaseShift = vatan2(B, A);
+	V asinVal = vasin(vmin(vmax(asinInput, V(-1.0f)), V(1.0f)));
+	// sign(asinVal) * (PI - abs(asinVal)), with sign(0) == 0
+	V altMagnitude = V(PI) - vabs(asinVal);
+	V asinAltVal = select(asinVal < V(0.0f), -altMagnitude, select(asinVal > V(0.0f), altMagnitude, V(0.0f)));
+
+	V t1 = asinVal - phaseShift;
+	V t2 = asinAltVal - phaseShift;
+
+	// Both are in (-2pi, 2pi), so one wrap in each direction is enough
+	t1 = select(t1 < V(0.0f), t1 + V(TWO_PI), t1);
+	t1 = select(t1 >= V(TWO_PI), t1 - V(TWO_PI), t1);
+	t2 = select(t2 < V(0.0f), t2 + V(TWO_PI), t2);
+	t2 = select(t2 >= V(TWO_PI), t2 - V(TWO_PI), t2);
+
+	V nearT = vmin(t1, t2);
+	V farT = vmax(t1, t2);
+
+	typename V::mask useFar = (nearT < V(MIN_RAY_HIT_THRESHOLD)) | hiddenFromInside;
+	t = select(useFar, farT, nearT);
+
+	return andnot(farT < V(MIN_RAY_HIT_THRESHOLD), valid);
+}
+
+/** Packet version of sphereHitDistance(): the lanes that hit the sphere, and their t. */
+template<class V>
+SIMD_INLINE typename V::mask sphereHitDistancePacket(const PackedSphere& sphere, const RayPacketT<V>& rays, V& t) {
+	const V cx(sphere.center.x), cy(sphere.center.y), cz(sphere.center.z), cw(sphere.center.w);
+
+	V A = fmadd(cx, rays.dx, fmadd(cy, rays.dy, fmadd(cz, rays.dz, cw * rays.dw)));
+	V B = fmadd(cx, rays.ox, fmadd(cy, rays.oy, fmadd(cz, rays.oz, cw * rays.ow)));
+	V C(sphere.planeOffset);
+
+	V amplitude = vsqrt(fmadd(A, A, B * B));
+	V asinInput = C / amplitude;
+	typename V::mask valid = vabs(asinInput) <= V(1.0f);
+	if (!any(valid)) {
+		return valid;
+	}
+
+	// geodesicDistance(origin, center) <= radius, for unit origins and centers
+	typename V::mask hiddenFromInside = V(0.0f) < V(0.0f);
+	if (!sphere.visibleFromInside) {
+		hiddenFromInside = B >= V(sphere.cosRadius);
+	}
+
+	return hitDistanceFromPlaneTerms(A, B, asinInput, valid, hiddenFromInside, t);
+}
+
+/**
+ * Lanes that hit the sphere closer than closestT get their closestT/closestIndex replaced.
+ * Indices are carried as floats, which is exact for anything below 2^24 spheres.
+ */
+template<class V>
+SIMD_INLINE void intersectSpherePacket(const PackedSphere& sphere, float index, const RayPacketT<V>& rays, V& closestT, V& closestIndex) {
+	V t;
+	typename V::mask isHit = sphereHitDistancePacket(sphere, rays, t);
+	typename V::mask closer = isHit & (t < closestT);
+
+	closestT = select(closer, t, closestT);
+	closestIndex = select(closer, V(index), closestIndex);
+}
+
+/** Lanes that hit the sphere before tMax. */
+template<class V>
+SIMD_INLINE typename V::mask anyHitSpherePacket(const PackedSphere& sphere, const RayPacketT<V>& rays, const V& tMax) {
+	V t;
+	typename V::mask isHit = sphereHitDistancePacket(sphere, rays, t);
+	return isHit & (t < tMax);
+}
+
+/** Packet version of CPURaytracer::findClosestHit's loop; misses are left at index -1. */
+template<class V>
+void findClosestHitPacket(const std::vector<PackedSphere>& spheres, int startingPoint, const RayPacketT<V>& rays, V& closestT, V& closestIndex) {
+	closestT = V(99999999999999.f);
+	closestIndex = V(-1.0f);
+	for (int i = startingPoint; i < (int)spheres.size(); i++) {
+		intersectSpherePacket(spheres[i], (float)i, rays, closestT, closestIndex);
+	}
+}
+
+/////////////////////////// CAMERA-FRAME PRIMARY RAYS ///////////////////////////
+//
+// Every primary ray of a view starts at the user's position. After rotating the scene so that
+// position is (1, 0, 0, 0) (see cameraFrameRotation() in ViewConstants.h), every primary ray
+// direction has x == 0, B in SphereHit is just the sphere center's x, and whether the ray
+// starts inside the sphere is the same for every pixel. All of that is worked out once per
+// sphere per view, leaving a 3-component dot product and one compare for the common case of
+// a ray that misses.
+
+/** Primary ray directions in the camera frame; the origin is always (1, 0, 0, 0). */
+template<class V>
+struct CameraRayPacketT {
+	V dy, dz, dw;
+
+	/** Gathers V::width directions (y, z, w); the packet is padded with copies of the last one. */
+	static CameraRayPacketT gather(const vec3* directions, int count) {
+		float d[3][V::width];
+		for (int lane = 0; lane < V::width; lane++) {
+			const vec3& direction = directions[lane < count ? lane : count - 1];
+			for (int c = 0; c < 3; c++) {
+				d[c][lane] = direction[c];
+			}
+		}
+		CameraRayPacketT packet;
+		packet.dy = V::load(d[0]); packet.dz = V::load(d[1]); packet.dw = V::load(d[2]);
+		return packet;
+	}
+};
+
+/** intersectSpherePacket() for primary rays in the camera frame. */
+template<class V>
+SIMD_INLINE void intersectCameraFrameSpherePacket(const CameraFrameSphere& sphere, const CameraRayPacketT<V>& rays, V& closestT, V& closestIndex) {
+	const V cy(sphere.center.x), cz(sphere.center.y), cw(sphere.center.z);
+
+	V A = fmadd(cy, rays.dy, fmadd(cz, rays.dz, cw * rays.dw));
+	typename V::mask valid = A * A >= V(sphere.missThreshold);
+	if (!any(valid)) {
+		return;
+	}
+
+	V B(sphere.originDot);
+	V asinInput = V(sphere.planeOffset) / vsqrt(fmadd(A, A, V(sphere.originDotSq)));
+	typename V::mask hiddenFromInside = V(sphere.hiddenFromInside ? 1.0f : 0.0f) > V(0.0f);
+
+	V t;
+	typename V::mask isHit = hitDistanceFromPlaneTerms(A, B, asinInput, valid, hiddenFromInside, t);
+	typename V::mask closer = isHit & (t < closestT);
+
+	closestT = select(closer, t, closestT);
+	closestIndex = select(closer, V(sphere.index), closestIndex);
+}
+
+/** findClosestHitPacket() for primary rays in the camera frame; spheres[i] is sphere i. */
+template<class V>
+void findClosestCameraFrameHitPacket(const std::vector<CameraFrameSphere>& spheres, int startingPoint, const CameraRayPacketT<V>& rays, V& closestT, V& closestIndex) {
+	closestT = V(99999999999999.f);
+	closestIndex = V(-1.0f);
+	for (int i = startingPoint; i < (int)spheres.size(); i++) {
+		intersectCameraFrameSpherePacket(spheres[i], rays, closestT, closestIndex);
+	}
+}
+
+#endif /* RAYPACKET_H_ */
@@ -0,0 +1,338 @@
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "4DUtils.h"
+#include "SIMD.h"
+#include "SO4.h"
+#include "SO4Batch.h"
+#include "TestSupport.h"
+
+/**
+ * Tests of the S3 rotation and camera math, run by ctest. First the known answers that used to
+ * be checked every time the VR app created a GL context, then randomized checks of the
+ * invariants the renderer relies on, each over many random planes, cameras and head moves, and
+ * the batched rotations of SO4Batch.h against the SO4 calls they stand for.
+ * See TestSupport.h for the command line.
+ */
+
+typedef std::chrono::steady_clock Clock;
+
+/** How far the camera's four vectors are from orthonormal (largest error of any dot product). */
+static float orthonormalityError(const CurvedWorldPosAndRot& camera) {
+	vec4 axes[4] = { camera.pos, camera.forwardDir, camera.upDir, camera.rightDir };
+	float error = 0;
+	for (int i = 0; i < 4; i++) {
+		for (int j = 0; j <= i; j++) {
+			error = std::max(error, abs(dot(axes[i], axes[j]) - (i == j ? 1.0f : 0.0f)));
+		}
+	}
+	return error;
+}
+
+static float largestDifference(const CurvedWorldPosAndRot& a, const CurvedWorldPosAndRot& b) {
+	return std::max(std::max(length(a.pos - b.pos), length(a.forwardDir - b.forwardDir)),
+		std::max(length(a.upDir - b.upDir), length(a.rightDir - b.rightDir)));
+}
+
+/** The checks testRotationMethods() used to make on every GL context. */
+static void testKnownRotations() {
+	const float epsilon = 0.00001f;
+
+	struct Case {
+		const char* name;
+		vec4 from;
+		vec4 to;
+		vec4 vector;
+		vec4 expected;
+	};
+	const Case rotationCases[] = {
+		// Rotating A from A to B
+		{ "A onto itself", vec4(1, 0, 0, 0), vec4(1, 0, 0, 0), vec4(1, 0, 0, 0), vec4(1, 0, 0, 0) },
+		{ "x onto y", vec4(1, 0, 0, 0), vec4(0, 1, 0, 0), vec4(1, 0, 0, 0), vec4(0, 1, 0, 0) },
+		{ "x onto z", vec4(1, 0, 0, 0), vec4(0, 0, 1, 0), vec4(1, 0, 0, 0), vec4(0, 0, 1, 0) },
+		{ "x onto w", vec4(1, 0, 0, 0), vec4(0, 0, 0, 1), vec4(1, 0, 0, 0), vec4(0, 0, 0, 1) },
+		{ "x onto (4, 3, 2, 1)", vec4(1, 0, 0, 0), normalize(vec4(4, 3, 2, 1)), vec4(1, 0, 0, 0), normalize(vec4(4, 3, 2, 1)) },
+		{ "x onto (-3, 0, 10, 0.36)", vec4(1, 0, 0, 0), normalize(vec4(-3, 0, 10, 0.36)), vec4(1, 0, 0, 0), normalize(vec4(-3, 0, 10, 0.36)) },
+		{ "(4, 3, 2, 1) onto (-3, 0, 10, 0.36)", normalize(vec4(4, 3, 2, 1)), normalize(vec4(-3, 0, 10, 0.36)),
+			normalize(vec4(4, 3, 2, 1)), normalize(vec4(-3, 0, 10, 0.36)) },
+
+		// Rotate vectors in plane
+		{ "y in the xy plane", vec4(1, 0, 0, 0), vec4(0, 1, 0, 0), vec4(0, 1, 0, 0), vec4(-1, 0, 0, 0) },
+		{ "-x in the xy plane", vec4(1, 0, 0, 0), vec4(0, 1, 0, 0), vec4(-1, 0, 0, 0), vec4(0, -1, 0, 0) },
+		{ "y by 45 degrees", vec4(1, 0, 0, 0), normalize(vec4(1, 1, 0, 0)), vec4(0, 1, 0, 0), normalize(vec4(-1, 1, 0, 0)) },
+		{ "(1, 1, 0, 0) by 45 degrees", vec4(1, 0, 0, 0), normalize(vec4(1, 1, 0, 0)), normalize(vec4(1, 1, 0, 0)), vec4(0, 1, 0, 0) },
+
+		// Do NOT rotate vectors orthogonal
+		{ "z, orthogonal to xy", vec4(1, 0, 0, 0), vec4(0, 1, 0, 0), vec4(0, 0, 1, 0), vec4(0, 0, 1, 0) },
+		{ "w, orthogonal to xy", vec4(1, 0, 0, 0), vec4(0, 1, 0, 0), vec4(0, 0, 0, 1), vec4(0, 0, 0, 1) },
+		{ "(0, 0, 1, 1), orthogonal to xy", vec4(1, 0, 0, 0), vec4(0, 1, 0, 0), vec4(0, 0, 1, 1), vec4(0, 0, 1, 1) },
+		{ "w, orthogonal to x(y+z)", vec4(1, 0, 0, 0), normalize(vec4(0, 1, 1, 0)), vec4(0, 0, 0, 1), vec4(0, 0, 0, 1) },
+		{ "-w, orthogonal to x(y+z)", vec4(1, 0, 0, 0), normalize(vec4(0, 1, 1, 0)), vec4(0, 0, 0, -1), vec4(0, 0, 0, -1) },
+
+		// Non-normal vectors are still non-normal
+		{ "2y in the xy plane", vec4(1, 0, 0, 0), vec4(0, 1, 0, 0), vec4(0, 2, 0, 0), vec4(-2, 0, 0, 0) },
+		{ "-0.3x in the xy plane", vec4(1, 0, 0, 0), vec4(0, 1, 0, 0), vec4(-0.3, 0, 0, 0), vec4(0, -0.3, 0, 0) },
+
+		// Rotate vectors not orthogonal but not in plane
+		{ "(0, 1, 0, 1) in the xy plane", vec4(1, 0, 0, 0), vec4(0, 1, 0, 0), vec4(0, 1, 0, 1), vec4(-1, 0, 0, 1) },
+		{ "(0, 1, 2, 1) in the xy plane", vec4(1, 0, 0, 0), vec4(0, 1, 0, 0), vec4(0, 1, 2, 1), vec4(-1, 0, 2, 1) },
+	};
+	for (const Case& test : rotationCases) {
+		vec4 vector = test.vector;
+		rotate4DSinglePlane(test.from, test.to, { &vector });
+		expectNear(vector, test.expected, epsilon, std::string("rotate4DSinglePlane, ") + test.name);
+	}
+
+	struct AngleCase {
+		float degrees;
+		vec4 expected;
+	};
+	const AngleCase angleCases[] = {
+		{ 45.0f, normalize(vec4(1, 1, 0, 0)) },
+		{ -45.0f, normalize(vec4(1, -1, 0, 0)) },
+		{ -90.0f, vec4(0, -1, 0, 0) },
+		{ 30.0f, vec4(cos(radians(30.0f)), 0.5f, 0, 0) },
+	};
+	for (const AngleCase& test : angleCases) {
+		vec4 vector(1, 0, 0, 0);
+		rotate4DSinglePlaneSpecificAngle(vec4(1, 0, 0, 0), vec4(0, 1, 0, 0), radians(test.degrees), { &vector });
+		std::ostringstream name;
+		name << "rotate4DSinglePlaneSpecificAngle, x by " << test.degrees << " degrees in the xy plane";
+		expectNear(vector, test.expected, epsilon, name.str());
+	}
+}
+
+/** Random planes, angles, cameras and head moves, all from one seed. */
+class RandomCases : public TestRandom {
+public:
+	explicit RandomCases(unsigned seed) : TestRandom(seed) {}
+
+	/** A rigid head pose turned and moved by up to about the given amounts from the last one. */
+	mat4 nextHeadPose(const mat4& last, float turn, float move) {
+		quat rotation = normalize(quat(1.0f, turn * _gaussian(_rng), turn * _gaussian(_rng), turn * _gaussian(_rng)));
+		mat4 step = mat4_cast(rotation);
+		step[3] = vec4(move * _gaussian(_rng), move * _gaussian(_rng), move * _gaussian(_rng), 1.0f);
+		mat4 pose = last * step;
+		// Rebuilt from a normalized quaternion, like a tracker sample, so it stays rigid
+		mat4 rigid = mat4_cast(normalize(quat_cast(mat3(pose))));
+		rigid[3] = pose[3];
+		return rigid;
+	}
+};
+
+static void testRotationProperties(RandomCases& random, int iterations) {
+	const float epsilon = 0.0001f;
+	for (int i = 0; i < iterations; i++) {
+		std::string iteration = " (case " + std::to_string(i) + ")";
+
+		// rotate4DSinglePlane takes from onto to
+		vec4 from = random.unitVector();
+		vec4 to = random.unitVector();
+		if (dot(from, to) > -0.999f) {
+			vec4 rotated = from;
+			rotate4DSinglePlane(from, to, { &rotated });
+			expectNear(rotated, to, epsilon, "rotate4DSinglePlane doesn't take from onto to" + iteration);
+		}
+
+		// Rotations keep lengths and angles, leave the orthogonal plane alone, and are undone
+		// by the opposite angle
+		vec4 towards = random.orthogonalTo(from);
+		float angle = random.angle(pi<float>());
+		vec4 vectors[4] = { random.vector(), random.vector(), random.vector(), random.vector() };
+		vec4 rotated[4] = { vectors[0], vectors[1], vectors[2], vectors[3] };
+		rotate4DSinglePlaneSpecificAngle(from, towards, angle, { &rotated[0], &rotated[1], &rotated[2], &rotated[3] });
+		for (int a = 0; a < 4; a++) {
+			for (int b = a; b < 4; b++) {
+				float before = dot(vectors[a], vectors[b]);
+				float after = dot(rotated[a], rotated[b]);
+				expect(abs(after - before) <= epsilon * std::max(1.0f, abs(before)),
+					"rotation changed a dot product from " + std::to_string(before) + " to " + std::to_string(after) + iteration);
+			}
+		}
+
+		vec4 orthogonal = vectors[0] - dot(vectors[0], from) * from - dot(vectors[0], towards) * towards;
+		vec4 orthogonalRotated = orthogonal;
+		rotate4DSinglePlaneSpecificAngle(from, towards, angle, { &orthogonalRotated });
+		expectNear(orthogonalRotated, orthogonal, epsilon, "rotation moved a vector orthogonal to its plane" + iteration);
+
+		vec4 undone = rotated[0];
+		rotate4DSinglePlaneSpecificAngle(from, towards, -angle, { &undone });
+		expectNear(undone, vectors[0], epsilon * length(vectors[0]), "rotating back by -angle didn't undo the rotation" + iteration);
+
+		// The SO4 rotor for the same plane and angle does the same thing
+		expectNear(apply(planeRotation(from, towards, angle), vectors[0]), rotated[0], epsilon * length(vectors[0]),
+			"planeRotation disagrees with rotate4DSinglePlaneSpecificAngle" + iteration);
+	}
+}
+
+static void testCameraUpdateProperties(RandomCases& random, int iterations) {
+	const float epsilon = 0.0001f;
+	const int walkLength = 100;
+	for (int i = 0; i < iterations; i++) {
+		std::string iteration = " (case " + std::to_string(i) + ")";
+		CurvedWorldPosAndRot start = random.camera();
+		float scale = 0.5f + 2.0f * abs(random.angle(1.0f));
+
+		// Not moving the head doesn't move the camera
+		mat4 pose = random.nextHeadPose(mat4(1.0f), 1.0f, 1.0f);
+		CurvedWorldPosAndRot camera = start;
+		changeByMatrixDifference(pose, pose, scale, &camera);
+		expect(largestDifference(camera, start) <= epsilon, "a head move of nothing moved the camera" + iteration);
+
+		// Moving forward by d moves the camera along its forward direction by scale * d radians
+		float distance = 0.1f * abs(random.angle(1.0f));
+		mat4 forwardPose = pose * translate(mat4(1.0f), vec3(0, 0, distance));
+		camera = start;
+		changeByMatrixDifference(pose, forwardPose, scale, &camera);
+		float moved = scale * distance;
+		expectNear(camera.pos, cos(moved) * start.pos + sin(moved) * start.forwardDir, epsilon,
+			"moving forward didn't move the camera along its forward direction" + iteration);
+		expectNear(camera.forwardDir, cos(moved) * start.forwardDir - sin(moved) * start.pos, epsilon,
+			"moving forward didn't keep the camera facing along the geodesic" + iteration);
+
+		// Turns alone compose: turning A to B to C ends where turning A to C does
+		mat4 turnA = mat4_cast(normalize(quat(1.0f, random.angle(1.0f), random.angle(1.0f), random.angle(1.0f))));
+		mat4 turnB = mat4_cast(normalize(quat(1.0f, random.angle(1.0f), random.angle(1.0f), random.angle(1.0f))));
+		mat4 turnC = mat4_cast(normalize(quat(1.0f, random.angle(1.0f), random.angle(1.0f), random.angle(1.0f))));
+		CurvedWorldPosAndRot twoSteps = start, oneStep = start;
+		changeByMatrixDifference(turnA, turnB, scale, &twoSteps);
+		changeByMatrixDifference(turnB, turnC, scale, &twoSteps);
+		changeByMatrixDifference(turnA, turnC, scale, &oneStep);
+		expect(largestDifference(twoSteps, oneStep) <= epsilon, "two turns ended somewhere else than one" + iteration);
+		expectNear(twoSteps.pos, start.pos, epsilon, "turning the head moved the camera" + iteration);
+
+		// A walk of head moves keeps the camera orthonormal, and the SO4 camera follows the
+		// same path
+		camera = start;
+		SO4 rotor = fromPosAndRot(start);
+		float worstError = 0;
+		for (int step = 0; step < walkLength; step++) {
+			mat4 next = random.nextHeadPose(pose, 0.05f, 0.02f);
+			changeByMatrixDifference(pose, next, scale, &camera);
+			changeByMatrixDifference(pose, next, scale, &rotor);
+			worstError = std::max(worstError, orthonormalityError(camera));
+			pose = next;
+		}
+		expect(worstError <= 0.001f, "camera drifted " + std::to_string(worstError) + " from orthonormal over "
+			+ std::to_string(walkLength) + " head moves" + iteration);
+		expect(largestDifference(camera, toPosAndRot(rotor)) <= 0.001f,
+			"the four-vector and SO4 cameras took different paths" + iteration);
+
+		// rigidInverse is the inverse
+		mat4 identity = rigidInverse(pose) * pose;
+		float inverseError = 0;
+		for (int column = 0; column < 4; column++) {
+			inverseError = std::max(inverseError, length(identity[column] - mat4(1.0f)[column]));
+		}
+		expect(inverseError <= epsilon, "rigidInverse(m) * m is off from identity by " + std::to_string(inverseError) + iteration);
+	}
+}
+
+static float rotorDifference(const SO4& a, const SO4& b) {
+	return std::max(length(vec4FromQuat(a.left) - vec4FromQuat(b.left)), length(vec4FromQuat(a.right) - vec4FromQuat(b.right)));
+}
+
+template<class Batch>
+static bool throwsRuntimeError(Batch batch) {
+	try {
+		batch();
+	}
+	catch (const std::runtime_error&) {
+		return true;
+	}
+	return false;
+}
+
+/**
+ * rotatePoints and composeRotations, per-object and shared, against apply and operator* one
+ * object at a time: with leftover lanes after the last full register, and with enough objects
+ * to be split between threads.
+ */
+static void testBatchRotations(RandomCases& random) {
+	const float epsilon = 1e-5f;
+	const size_t width = floatv::width;
+	size_t threaded = width;
+	while (batchThreadCount(threaded, 4) < 4) {
+		threaded *= 2;
+	}
+	auto randomRotor = [&]() { return normalize(SO4{ quatFromVec4(random.unitVector()), quatFromVec4(random.unitVector()) }); };
+
+	for (size_t size : { (size_t)1, width + 3, 5 * width + 1, threaded + 3 }) {
+		std::vector<vec4> points(size);
+		std::vector<SO4> rotors(size), steps(size);
+		Vec4Array pointArray;
+		SO4Array rotorArray, stepArray;
+		pointArray.resize(size);
+		rotorArray.resize(size);
+		stepArray.resize(size);
+		for (size_t i = 0; i < size; i++) {
+			points[i] = random.unitVector();
+			rotors[i] = randomRotor();
+			steps[i] = randomRotor();
+			pointArray.set(i, points[i]);
+			rotorArray.set(i, rotors[i]);
+			stepArray.set(i, steps[i]);
+		}
+		SO4 sharedStep = randomRotor();
+
+		for (int threads : { 1, 3, 0 }) {
+			std::string where = " (" + std::to_string(size) + " objects, " + std::to_string(batchThreadCount(size, threads)) + " threads)";
+			float pointsEach = 0, pointsShared = 0, composeEach = 0, composeShared = 0;
+
+			Vec4Array batchPoints = pointArray;
+			rotatePoints(stepArray, batchPoints, threads);
+			for (size_t i = 0; i < size; i++) {
+				pointsEach = std::max(pointsEach, length(batchPoints.get(i) - normalize(apply(steps[i], points[i]))));
+			}
+			batchPoints = pointArray;
+			rotatePoints(sharedStep, batchPoints, threads);
+			for (size_t i = 0; i < size; i++) {
+				pointsShared = std::max(pointsShared, length(batchPoints.get(i) - normalize(apply(sharedStep, points[i]))));
+			}
+
+			SO4Array batchRotors = rotorArray;
+			composeRotations(stepArray, batchRotors, threads);
+			for (size_t i = 0; i < size; i++) {
+				composeEach = std::max(composeEach, rotorDifference(batchRotors.get(i), normalize(steps[i] * rotors[i])));
+			}
+			batchRotors = rotorArray;
+			composeRotations(sharedStep, batchRotors, threads);
+			for (size_t i = 0; i < size; i++) {
+				composeShared = std::max(composeShared, rotorDifference(batchRotors.get(i), normalize(sharedStep * rotors[i])));
+			}
+
+			expect(pointsEach <= epsilon, "per-object rotatePoints is off by " + std::to_string(pointsEach) + where);
+			expect(pointsShared <= epsilon, "shared rotatePoints is off by " + std::to_string(pointsShared) + where);
+			expect(composeEach <= epsilon, "per-object composeRotations is off by " + std::to_string(composeEach) + where);
+			expect(composeShared <= epsilon, "shared composeRotations is off by " + std::to_string(composeShared) + where);
+		}
+	}
+
+	Vec4Array onePoint;
+	SO4Array oneRotor, twoRotors;
+	onePoint.resize(1);
+	oneRotor.resize(1);
+	twoRotors.resize(2);
+	expect(throwsRuntimeError([&]() { rotatePoints(twoRotors, onePoint); }), "rotatePoints took 2 rotations for 1 point");
+	expect(throwsRuntimeError([&]() { composeRotations(twoRotors, oneRotor); }), "composeRotations took 2 steps for 1 rotation");
+}
+
+int main(int argc, char **argv) {
+	return runTests(argc, argv, "random cases", [](unsigned seed, int iterations) {
+		// What the VR app used to spend on these for each GL context before its first frame
+		Clock::time_point start = Clock::now();
+		testKnownRotations();
+		double knownSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+		std::cout << "known rotations: " << knownSeconds * 1e6 << " us" << std::endl;
+
+		RandomCases random(seed);
+		testRotationProperties(random, iterations);
+		testCameraUpdateProperties(random, iterations);
+		testBatchRotations(random);
+	});
+}
@@ -0,0 +1,286 @@
+#ifndef SIMD_H_
+#define SIMD_H_
+
+#include <cmath>
+
+/**
+ * Thin wrappers around the x86 vector registers so ray packet kernels can be written once
+ * as templates and instantiated for every width the compiler was allowed to target:
+ *
+ *   float1v  - plain float, always available (the "packet" of one ray)
+ *   float4v  - SSE    (__m128)
+ *   float8v  - AVX    (__m256)
+ *   float16v - AVX512 (__m512)
+ *
+ * floatv is the widest of these and is what the renderer uses. Each type V has a matching
+ * V::mask type returned by comparisons and consumed by select()/any()/bits().
+ */
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SIMD_HAS_SSE 1
+#endif
+#if defined(__AVX__)
+#define SIMD_HAS_AVX 1
+#endif
+#if defined(__AVX512F__)
+#define SIMD_HAS_AVX512 1
+#endif
+
+#if defined(SIMD_HAS_SSE) || defined(SIMD_HAS_AVX) || defined(SIMD_HAS_AVX512)
+#include <immintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#define SIMD_INLINE __forceinline
+#else
+#define SIMD_INLINE inline __attribute__((always_inline))
+#endif
+
+//////////////////////////////// SCALAR ////////////////////////////////
+
+struct float1v {
+	static const int width = 1;
+	struct mask {
+		bool m;
+		mask() {}
+		mask(bool b) : m(b) {}
+	};
+
+	float v;
+
+	float1v() {}
+	float1v(float f) : v(f) {}
+
+	static float1v load(const float* p) { return float1v(*p); }
+	void store(float* p) const { *p = v; }
+};
+
+SIMD_INLINE float1v operator+(float1v a, float1v b) { return a.v + b.v; }
+SIMD_INLINE float1v operator-(float1v a, float1v b) { return a.v - b.v; }
+SIMD_INLINE float1v operator*(float1v a, float1v b) { return a.v * b.v; }
+SIMD_INLINE float1v operator/(float1v a, float1v b) { return a.v / b.v; }
+SIMD_INLINE float1v operator-(float1v a) { return -a.v; }
+SIMD_INLINE float1v fmadd(float1v a, float1v b, float1v c) { return a.v * b.v + c.v; }
+SIMD_INLINE float1v vmin(float1v a, float1v b) { return a.v < b.v ? a.v : b.v; }
+SIMD_INLINE float1v vmax(float1v a, float1v b) { return a.v > b.v ? a.v : b.v; }
+SIMD_INLINE float1v vabs(float1v a) { return std::fabs(a.v); }
+SIMD_INLINE float1v vsqrt(float1v a) { return std::sqrt(a.v); }
+SIMD_INLINE float1v::mask operator<(float1v a, float1v b) { return a.v < b.v; }
+SIMD_INLINE float1v::mask operator<=(float1v a, float1v b) { return a.v <= b.v; }
+SIMD_INLINE float1v::mask operator>(float1v a, float1v b) { return a.v > b.v; }
+SIMD_INLINE float1v::mask operator>=(float1v a, float1v b) { return a.v >= b.v; }
+SIMD_INLINE float1v::mask operator==(float1v a, float1v b) { return a.v == b.v; }
+SIMD_INLINE float1v::mask operator&(float1v::mask a, float1v::mask b) { return a.m && b.m; }
+SIMD_INLINE float1v::mask operator|(float1v::mask a, float1v::mask b) { return a.m || b.m; }
+SIMD_INLINE float1v::mask andnot(float1v::mask a, float1v::mask b) { return !a.m && b.m; }
+SIMD_INLINE float1v select(float1v::mask m, float1v a, float1v b) { return m.m ? a : b; }
+SIMD_INLINE bool any(float1v::mask m) { return m.m; }
+SIMD_INLINE int bits(float1v::mask m) { return m.m ? 1 : 0; }
+
+///////////////////////////////// SSE //////////////////////////////////
+
+#ifdef SIMD_HAS_SSE
+struct float4v {
+	static const int width = 4;
+	struct mask {
+		__m128 m;
+		mask() {}
+		mask(__m128 x) : m(x) {}
+	};
+
+	__m128 v;
+
+	float4v() {}
+	float4v(__m128 x) : v(x) {}
+	float4v(float f) : v(_mm_set1_ps(f)) {}
+
+	static float4v load(const float* p) { return _mm_loadu_ps(p); }
+	void store(float* p) const { _mm_storeu_ps(p, v); }
+};
+
+SIMD_INLINE float4v operator+(float4v a, float4v b) { return _mm_add_ps(a.v, b.v); }
+SIMD_INLINE float4v operator-(float4v a, float4v b) { return _mm_sub_ps(a.v, b.v); }
+SIMD_INLINE float4v operator*(float4v a, float4v b) { return _mm_mul_ps(a.v, b.v); }
+SIMD_INLINE float4v operator/(float4v a, float4v b) { return _mm_div_ps(a.v, b.v); }
+SIMD_INLINE float4v operator-(float4v a) { return _mm_xor_ps(a.v, _mm_set1_ps(-0.0f)); }
+#ifdef __FMA__
+SIMD_INLINE float4v fmadd(float4v a, float4v b, float4v c) { return _mm_fmadd_ps(a.v, b.v, c.v); }
+#else
+SIMD_INLINE float4v fmadd(float4v a, float4v b, float4v c) { return a * b + c; }
+#endif
+SIMD_INLINE float4v vmin(float4v a, float4v b) { return _mm_min_ps(a.v, b.v); }
+SIMD_INLINE float4v vmax(float4v a, float4v b) { return _mm_max_ps(a.v, b.v); }
+SIMD_INLINE float4v vabs(float4v a) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a.v); }
+SIMD_INLINE float4v vsqrt(float4v a) { return _mm_sqrt_ps(a.v); }
+SIMD_INLINE float4v::mask operator<(float4v a, float4v b) { return _mm_cmplt_ps(a.v, b.v); }
+SIMD_INLINE float4v::mask operator<=(float4v a, float4v b) { return _mm_cmple_ps(a.v, b.v); }
+SIMD_INLINE float4v::mask operator>(float4v a, float4v b) { return _mm_cmpgt_ps(a.v, b.v); }
+SIMD_INLINE float4v::mask operator>=(float4v a, float4v b) { return _mm_cmpge_ps(a.v, b.v); }
+SIMD_INLINE float4v::mask operator==(float4v a, float4v b) { return _mm_cmpeq_ps(a.v, b.v); }
+SIMD_INLINE float4v::mask operator&(float4v::mask a, float4v::mask b) { return _mm_and_ps(a.m, b.m); }
+SIMD_INLINE float4v::mask operator|(float4v::mask a, float4v::mask b) { return _mm_or_ps(a.m, b.m); }
+SIMD_INLINE float4v::mask andnot(float4v::mask a, float4v::mask b) { return _mm_andnot_ps(a.m, b.m); }
+#ifdef __SSE4_1__
+SIMD_INLINE float4v select(float4v::mask m, float4v a, float4v b) { return _mm_blendv_ps(b.v, a.v, m.m); }
+#else
+SIMD_INLINE float4v select(float4v::mask m, float4v a, float4v b) { return _mm_or_ps(_mm_and_ps(m.m, a.v), _mm_andnot_ps(m.m, b.v)); }
+#endif
+SIMD_INLINE bool any(float4v::mask m) { return _mm_movemask_ps(m.m) != 0; }
+SIMD_INLINE int bits(float4v::mask m) { return _mm_movemask_ps(m.m); }
+#endif
+
+///////////////////////////////// AVX //////////////////////////////////
+
+#ifdef SIMD_HAS_AVX
+struct float8v {
+	static const int width = 8;
+	struct mask {
+		__m256 m;
+		mask() {}
+		mask(__m256 x) : m(x) {}
+	};
+
+	__m256 v;
+
+	float8v() {}
+	float8v(__m256 x) : v(x) {}
+	float8v(float f) : v(_mm256_set1_ps(f)) {}
+
+	static float8v load(const float* p) { return _mm256_loadu_ps(p); }
+	void store(float* p) const { _mm256_storeu_ps(p, v); }
+};
+
+SIMD_INLINE float8v operator+(float8v a, float8v b) { return _mm256_add_ps(a.v, b.v); }
+SIMD_INLINE float8v operator-(float8v a, float8v b) { return _mm256_sub_ps(a.v, b.v); }
+SIMD_INLINE float8v operator*(float8v a, float8v b) { return _mm256_mul_ps(a.v, b.v); }
+SIMD_INLINE float8v operator/(float8v a, float8v b) { return _mm256_div_ps(a.v, b.v); }
+SIMD_INLINE float8v operator-(float8v a) { return _mm256_xor_ps(a.v, _mm256_set1_ps(-0.0f)); }
+#ifdef __FMA__
+SIMD_INLINE float8v fmadd(float8v a, float8v b, float8v c) { return _mm256_fmadd_ps(a.v, b.v, c.v); }
+#else
+SIMD_INLINE float8v fmadd(float8v a, float8v b, float8v c) { return a * b + c; }
+#endif
+SIMD_INLINE float8v vmin(float8v a, float8v b) { return _mm256_min_ps(a.v, b.v); }
+SIMD_INLINE float8v vmax(float8v a, float8v b) { return _mm256_max_ps(a.v, b.v); }
+SIMD_INLINE float8v vabs(float8v a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v); }
+SIMD_INLINE float8v vsqrt(float8v a) { return _mm256_sqrt_ps(a.v); }
+SIMD_INLINE float8v::mask operator<(float8v a, float8v b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ); }
+SIMD_INLINE float8v::mask operator<=(float8v a, float8v b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ); }
+SIMD_INLINE float8v::mask operator>(float8v a, float8v b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ); }
+SIMD_INLINE float8v::mask operator>=(float8v a, float8v b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ); }
+SIMD_INLINE float8v::mask operator==(float8v a, float8v b) { return _mm256_cmp_ps(a.v, b.v, _CMP_EQ_OQ); }
+SIMD_INLINE float8v::mask operator&(float8v::mask a, float8v::mask b) { return _mm256_and_ps(a.m, b.m); }
+SIMD_INLINE float8v::mask operator|(float8v::mask a, float8v::mask b) { return _mm256_or_ps(a.m, b.m); }
+SIMD_INLINE float8v::mask andnot(float8v::mask a, float8v::mask b) { return _mm256_andnot_ps(a.m, b.m); }
+SIMD_INLINE float8v select(float8v::mask m, float8v a, float8v b) { return _mm256_blendv_ps(b.v, a.v, m.m); }
+SIMD_INLINE bool any(float8v::mask m) { return _mm256_movemask_ps(m.m) != 0; }
+SIMD_INLINE int bits(float8v::mask m) { return _mm256_movemask_ps(m.m); }
+#endif
+
+//////////////////////////////// AVX512 ////////////////////////////////
+
+#ifdef SIMD_HAS_AVX512
+struct float16v {
+	static const int width = 16;
+	struct mask {
+		__mmask16 m;
+		mask() {}
+		mask(__mmask16 x) : m(x) {}
+	};
+
+	__m512 v;
+
+	float16v() {}
+	float16v(__m512 x) : v(x) {}
+	float16v(float f) : v(_mm512_set1_ps(f)) {}
+
+	static float16v load(const float* p) { return _mm512_loadu_ps(p); }
+	void store(float* p) const { _mm512_storeu_ps(p, v); }
+};
+
+SIMD_INLINE float16v operator+(float16v a, float16v b) { return _mm512_add_ps(a.v, b.v); }
+SIMD_INLINE float16v operator-(float16v a, float16v b) { return _mm512_sub_ps(a.v, b.v); }
+SIMD_INLINE float16v operator*(float16v a, float16v b) { return _mm512_mul_ps(a.v, b.v); }
+SIMD_INLINE float16v operator/(float16v a, float16v b) { return _mm512_div_ps(a.v, b.v); }
+SIMD_INLINE float16v operator-(float16v a) { return _mm512_sub_ps(_mm512_setzero_ps(), a.v); }
+SIMD_INLINE float16v fmadd(float16v a, float16v b, float16v c) { return _mm512_fmadd_ps(a.v, b.v, c.v); }
+SIMD_INLINE float16v vmin(float16v a, float16v b) { return _mm512_min_ps(a.v, b.v); }
+SIMD_INLINE float16v vmax(float16v a, float16v b) { return _mm512_max_ps(a.v, b.v); }
+SIMD_INLINE float16v vabs(float16v a) { return _mm512_abs_ps(a.v); }
+SIMD_INLINE float16v vsqrt(float16v a) { return _mm512_sqrt_ps(a.v); }
+SIMD_INLINE float16v::mask operator<(float16v a, float16v b) { return _mm512_cmp_ps_mask(a.v, b.v, _CMP_LT_OQ); }
+SIMD_INLINE float16v::mask operator<=(float16v a, float16v b) { return _mm512_cmp_ps_mask(a.v, b.v, _CMP_LE_OQ); }
+SIMD_INLINE float16v::mask operator>(float16v a, float16v b) { return _mm512_cmp_ps_mask(a.v, b.v, _CMP_GT_OQ); }
+SIMD_INLINE float16v::mask operator>=(float16v a, float16v b) { return _mm512_cmp_ps_mask(a.v, b.v, _CMP_GE_OQ); }
+SIMD_INLINE float16v::mask operator==(float16v a, float16v b) { return _mm512_cmp_ps_mask(a.v, b.v, _CMP_EQ_OQ); }
+SIMD_INLINE float16v::mask operator&(float16v::mask a, float16v::mask b) { return (__mmask16)(a.m & b.m); }
+SIMD_INLINE float16v::mask operator|(float16v::mask a, float16v::mask b) { return (__mmask16)(a.m | b.m); }
+SIMD_INLINE float16v::mask andnot(float16v::mask a, float16v::mask b) { return (__mmask16)(~a.m & b.m); }
+SIMD_INLINE float16v select(float16v::mask m, float16v a, float16v b) { return _mm512_mask_blend_ps(m.m, b.v, a.v); }
+SIMD_INLINE bool any(float16v::mask m) { return m.m != 0; }
+SIMD_INLINE int bits(float16v::mask m) { return (int)m.m; }
+#endif
+
+#if defined(SIMD_HAS_AVX512)
+typedef float16v floatv;
+#elif defined(SIMD_HAS_AVX)
+typedef float8v floatv;
+#elif defined(SIMD_HAS_SSE)
+typedef float4v floatv;
+#else
+typedef float1v floatv;
+#endif
+
+/////////////////////////////// FUNCTIONS ///////////////////////////////
+
+/** Number of set lanes in the result of bits(). */
+SIMD_INLINE int popcount(int laneBits) {
+	int count = 0;
+	for (; laneBits != 0; laneBits &= laneBits - 1) {
+		count++;
+	}
+	return count;
+}
+
+/** atan() for any width, after Cephes' atanf: about 2 ulp on the full float range. */
+template<class V>
+SIMD_INLINE V vatan(V x) {
+	const float TAN_3PI_8 = 2.414213562373095f;
+	const float TAN_PI_8 = 0.4142135623730950f;
+
+	typename V::mask negative = x < V(0.0f);
+	V ax = vabs(x);
+
+	// Reduce to |x| <= tan(pi/8)
+	typename V::mask big = ax > V(TAN_3PI_8);
+	typename V::mask medium = andnot(big, ax > V(TAN_PI_8));
+	V offset = select(big, V(1.5707963267948966f), select(medium, V(0.7853981633974483f), V(0.0f)));
+	V reduced = select(big, V(-1.0f) / ax, select(medium, (ax - V(1.0f)) / (ax + V(1.0f)), ax));
+
+	V z = reduced * reduced;
+	V poly = fmadd(fmadd(fmadd(V(8.05374449538e-2f), z, V(-1.38776856032e-1f)), z, V(1.99777106478e-1f)), z, V(-3.33329491539e-1f));
+	V result = offset + fmadd(poly * z, reduced, reduced);
+
+	return select(negative, -result, result);
+}
+
+/** atan2(y, x) with the same quadrant conventions as GLSL atan(y, x). */
+template<class V>
+SIMD_INLINE V vatan2(V y, V x) {
+	const float PI_F = 3.14159265358979f;
+
+	V result = vatan(y / x);
+	typename V::mask xNegative = x < V(0.0f);
+	typename V::mask yNegative = y < V(0.0f);
+	V correction = select(yNegative, V(-PI_F), V(PI_F));
+	return select(xNegative, result + correction, result);
+}
+
+/** asin() for inputs in [-1, 1]. */
+template<class V>
+SIMD_INLINE V vasin(V x) {
+	V cosine = vsqrt(vmax(V(1.0f) - x * x, V(0.0f)));
+	return vatan2(x, cosine);
+}
+
+#endif /* SIMD_H_ */
@@ -0,0 +1,170 @@
+#ifndef SO4_H_
+#define SO4_H_
+
+#include "4DUtils.h"
+
+/**
+ * A rotation of 4D space, stored as a pair of unit quaternions (the isoclinic decomposition).
+ *
+ * Points of R^4 are read as quaternions, (x, y, z, w) -> x + y i + z j + w k, and the rotation
+ * maps p to left * p * conjugate(right). Every rotation has exactly two such pairs, (l, r) and
+ * (-l, -r). Eight floats instead of a 4x4 matrix means composing two rotations is two quaternion
+ * products, inverting is two conjugates, and putting a drifted rotation back onto SO(4) is two
+ * normalizes, which is what keeps a camera stored this way orthonormal indefinitely.
+ */
+struct SO4 {
+	quat left;
+	quat right;
+
+	static SO4 identity() {
+		return { quat(1, 0, 0, 0), quat(1, 0, 0, 0) };
+	}
+};
+
+inline quat quatFromVec4(vec4 v) {
+	return quat(v.x, v.y, v.z, v.w);
+}
+
+inline vec4 vec4FromQuat(quat q) {
+	return vec4(q.w, q.x, q.y, q.z);
+}
+
+/** a * b applies b first, then a. */
+inline SO4 operator*(const SO4& a, const SO4& b) {
+	return { a.left * b.left, a.right * b.right };
+}
+
+inline SO4 inverse(const SO4& rotation) {
+	return { conjugate(rotation.left), conjugate(rotation.right) };
+}
+
+inline SO4 normalize(const SO4& rotation) {
+	return { normalize(rotation.left), normalize(rotation.right) };
+}
+
+inline vec4 apply(const SO4& rotation, vec4 p) {
+	return vec4FromQuat(rotation.left * quatFromVec4(p) * conjugate(rotation.right));
+}
+
+/** Spherical interpolation from a (t = 0) to b (t = 1), the short way round. */
+inline SO4 slerp(const SO4& a, SO4 b, float t) {
+	// (l, r) and (-l, -r) are the same rotation, but only flipping both keeps it that way
+	if (dot(a.left, b.left) + dot(a.right, b.right) < 0.0f) {
+		b.left = -b.left;
+		b.right = -b.right;
+	}
+	// glm::mix is slerp without glm::slerp's flip of each quaternion on its own
+	return normalize(SO4{ mix(a.left, b.left, t), mix(a.right, b.right, t) });
+}
+
+/**
+ * Rotation by angle in the plane of from and towards (orthonormal), turning from towards
+ * towards, and leaving the orthogonal plane alone. Same as rotate4DSinglePlaneSpecificAngle.
+ */
+inline SO4 planeRotation(vec4 from, vec4 towards, float angle) {
+	// With a = from and b = towards, the rotation is p -> (c + s b a*) p (c - s a* b)
+	quat a = quatFromVec4(from);
+	quat b = quatFromVec4(towards);
+	float c = cos(angle * 0.5f);
+	float s = sin(angle * 0.5f);
+	return { quat(c, 0, 0, 0) + s * (b * conjugate(a)), quat(c, 0, 0, 0) - s * (conjugate(a) * b) };
+}
+
+/** The columns of the matrix are the images of the axes. */
+inline mat4 toMat4(const SO4& rotation) {
+	mat4 m;
+	for (int i = 0; i < 4; i++) {
+		vec4 axis(0);
+		axis[i] = 1.0f;
+		m[i] = apply(rotation, axis);
+	}
+	return m;
+}
+
+/**
+ * The rotation closest to m, which should be in SO(4) (orthonormal, determinant +1). Not meant
+ * for per-frame use; keep rotations as SO4 and only convert at the edges.
+ */
+inline SO4 fromMat4(const mat4& m) {
+	// m = sum over p, q of l_p r_q B_pq, where B_pq is the rotation x -> e_p x conjugate(e_q) of
+	// the quaternion basis e_0..e_3. The B_pq are orthogonal to each other with squared norm 4,
+	// so the "associate matrix" A_pq = <m, B_pq> / 4 = l_p r_q is the outer product of l and r.
+	const quat basis[4] = { quat(1, 0, 0, 0), quat(0, 1, 0, 0), quat(0, 0, 1, 0), quat(0, 0, 0, 1) };
+	float associate[4][4] = {};
+	for (int j = 0; j < 4; j++) {
+		quat column = quatFromVec4(m[j]);
+		for (int p = 0; p < 4; p++) {
+			for (int q = 0; q < 4; q++) {
+				// <m e_j, e_p e_j e_q*> summed over j
+				associate[p][q] += dot(column, basis[p] * basis[j] * conjugate(basis[q])) * 0.25f;
+			}
+		}
+	}
+
+	// l is the column with the largest entry, and r = A^T l once l is normalized
+	int bestP = 0, bestQ = 0;
+	for (int p = 0; p < 4; p++) {
+		for (int q = 0; q < 4; q++) {
+			if (abs(associate[p][q]) > abs(associate[bestP][bestQ])) {
+				bestP = p;
+				bestQ = q;
+			}
+		}
+	}
+	vec4 left(associate[0][bestQ], associate[1][bestQ], associate[2][bestQ], associate[3][bestQ]);
+	left = normalize(left);
+	vec4 right(0);
+	for (int q = 0; q < 4; q++) {
+		right[q] = dot(left, vec4(associate[0][q], associate[1][q], associate[2][q], associate[3][q]));
+	}
+	right = normalize(right);
+
+	return { quat(left[0], left[1], left[2], left[3]), quat(right[0], right[1], right[2], right[3]) };
+}
+
+/////////////////////////////// CAMERA ///////////////////////////////
+
+// A camera is the rotation that takes the axes to pos, forwardDir, upDir and rightDir, in that
+// order (the order of CurvedWorldPosAndRot, which makes the starting camera a rotation rather
+// than a reflection).
+
+inline CurvedWorldPosAndRot toPosAndRot(const SO4& camera) {
+	return { apply(camera, vec4(1, 0, 0, 0)), apply(camera, vec4(0, 1, 0, 0)),
+		apply(camera, vec4(0, 0, 1, 0)), apply(camera, vec4(0, 0, 0, 1)) };
+}
+
+inline SO4 fromPosAndRot(const CurvedWorldPosAndRot& posAndRot) {
+	return fromMat4(mat4(posAndRot.pos, posAndRot.forwardDir, posAndRot.upDir, posAndRot.rightDir));
+}
+
+/**
+ * changeByMatrixDifference for a camera kept as an SO4: the same move and turn, as two rotor
+ * products, followed by a renormalize so the camera can't drift off SO(4).
+ */
+inline void changeByMatrixDifference(const mat4& fromMat, const mat4& toMat, float movement_scale, SO4* camera) {
+	mat3 fromRotationInverse = transpose(mat3(fromMat));
+	mat3 changeMat_rotation = fromRotationInverse * mat3(toMat);
+	vec3 changeMat_translation = fromRotationInverse * (vec3(toMat[3]) - vec3(fromMat[3]));
+
+	// Turning happens in the camera's own frame. In it the axes are (pos, forward, up, right),
+	// i.e. the quaternion units (1, i, j, k), and a turn that keeps pos fixed is p -> q p q* for
+	// the unit quaternion q of the 3D rotation of (forward, up, right). The tracker's rotation
+	// works on (right, up, forward), so swap x and z, which keeps it a rotation.
+	mat3 swapXZ(vec3(0, 0, 1), vec3(0, 1, 0), vec3(1, 0, 0));
+	quat turn = quat_cast(swapXZ * changeMat_rotation * swapXZ);
+	SO4 localTurn = { turn, turn };
+
+	float translationLength = length(changeMat_translation);
+	if (translationLength > 0.0f) {
+		// Moving is a rotation in the plane of pos and the move direction, also in the camera's
+		// frame: pos is (1, 0, 0, 0) there and the direction is (0, z, y, x) / length
+		vec4 moveDirection = vec4(0, changeMat_translation.z, changeMat_translation.y, changeMat_translation.x) / translationLength;
+		SO4 localMove = planeRotation(vec4(1, 0, 0, 0), moveDirection, movement_scale * translationLength);
+		*camera = normalize(*camera * localMove * localTurn);
+	}
+	else {
+		*camera = normalize(*camera * localTurn);
+	}
+}
+
+#endif /* SO4_H_ */
@@ -0,0 +1,188 @@
+#include "SO4Batch.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#include "Parallel.h"
+#include "SIMD.h"
+
+namespace {
+
+// Below this many objects per thread, starting the thread costs more than it saves
+const size_t MIN_OBJECTS_PER_THREAD = 1 << 15;
+
+/** A quaternion per lane, w being the real part. */
+template<class V>
+struct QuatV {
+	V w, x, y, z;
+};
+
+template<class V>
+SIMD_INLINE QuatV<V> broadcast(quat q) {
+	return { V(q.w), V(q.x), V(q.y), V(q.z) };
+}
+
+// Arrays hold quaternions the way vec4FromQuat lays them out, so points and rotors load the same way
+template<class V>
+SIMD_INLINE QuatV<V> load(const Vec4Array& array, size_t i) {
+	return { V::load(&array.x[i]), V::load(&array.y[i]), V::load(&array.z[i]), V::load(&array.w[i]) };
+}
+
+template<class V>
+SIMD_INLINE void store(const QuatV<V>& q, Vec4Array& array, size_t i) {
+	q.w.store(&array.x[i]);
+	q.x.store(&array.y[i]);
+	q.y.store(&array.z[i]);
+	q.z.store(&array.w[i]);
+}
+
+template<class V>
+SIMD_INLINE QuatV<V> conjugate(const QuatV<V>& q) {
+	return { q.w, -q.x, -q.y, -q.z };
+}
+
+template<class V>
+SIMD_INLINE QuatV<V> operator*(const QuatV<V>& a, const QuatV<V>& b) {
+	return {
+		fmadd(a.w, b.w, -fmadd(a.x, b.x, fmadd(a.y, b.y, a.z * b.z))),
+		fmadd(a.w, b.x, fmadd(a.x, b.w, fmadd(a.y, b.z, -(a.z * b.y)))),
+		fmadd(a.w, b.y, fmadd(a.z, b.x, fmadd(a.y, b.w, -(a.x * b.z)))),
+		fmadd(a.w, b.z, fmadd(a.x, b.y, fmadd(a.z, b.w, -(a.y * b.x))))
+	};
+}
+
+template<class V>
+SIMD_INLINE QuatV<V> normalize(const QuatV<V>& q) {
+	V scale = V(1.0f) / vsqrt(fmadd(q.w, q.w, fmadd(q.x, q.x, fmadd(q.y, q.y, q.z * q.z))));
+	return { q.w * scale, q.x * scale, q.y * scale, q.z * scale };
+}
+
+// Each operation works on object i at width V; runBatch picks the widths
+
+struct RotatePointsShared {
+	mat4 matrix; // one rotation for everything is cheaper as a matrix: 16 multiply-adds per point
+	Vec4Array& points;
+
+	template<class V>
+	SIMD_INLINE void apply(size_t i) const {
+		QuatV<V> p = load<V>(points, i);
+		V out[4];
+		for (int row = 0; row < 4; row++) {
+			out[row] = fmadd(V(matrix[0][row]), p.w, fmadd(V(matrix[1][row]), p.x, fmadd(V(matrix[2][row]), p.y, V(matrix[3][row]) * p.z)));
+		}
+		store(normalize(QuatV<V>{ out[0], out[1], out[2], out[3] }), points, i);
+	}
+};
+
+struct RotatePointsEach {
+	const SO4Array& rotations;
+	Vec4Array& points;
+
+	template<class V>
+	SIMD_INLINE void apply(size_t i) const {
+		QuatV<V> p = load<V>(points, i);
+		QuatV<V> rotated = load<V>(rotations.left, i) * p * conjugate(load<V>(rotations.right, i));
+		store(normalize(rotated), points, i);
+	}
+};
+
+struct ComposeShared {
+	SO4 step;
+	SO4Array& rotations;
+
+	template<class V>
+	SIMD_INLINE void apply(size_t i) const {
+		store(normalize(broadcast<V>(step.left) * load<V>(rotations.left, i)), rotations.left, i);
+		store(normalize(broadcast<V>(step.right) * load<V>(rotations.right, i)), rotations.right, i);
+	}
+};
+
+struct ComposeEach {
+	const SO4Array& steps;
+	SO4Array& rotations;
+
+	template<class V>
+	SIMD_INLINE void apply(size_t i) const {
+		store(normalize(load<V>(steps.left, i) * load<V>(rotations.left, i)), rotations.left, i);
+		store(normalize(load<V>(steps.right, i) * load<V>(rotations.right, i)), rotations.right, i);
+	}
+};
+
+/** Runs op over count objects, floatv::width at a time and the leftovers one at a time. */
+template<class Op>
+void runBatch(size_t count, int numThreads, const Op& op) {
+	const int width = floatv::width;
+	numThreads = batchThreadCount(count, numThreads);
+
+	// Chunks are whole registers, so only the very last one has leftovers
+	int numBlocks = (int)((count + width - 1) / width);
+	parallelChunks(0, numBlocks, numThreads, [&](int blockBegin, int blockEnd, int) {
+		size_t i = (size_t)blockBegin * width;
+		size_t end = std::min(count, (size_t)blockEnd * width);
+		for (; i + width <= end; i += width) {
+			op.template apply<floatv>(i);
+		}
+		for (; i < end; i++) {
+			op.template apply<float1v>(i);
+		}
+	});
+}
+
+void checkSameSize(size_t a, size_t b) {
+	if (a != b) {
+		throw std::runtime_error("SO(4) batch: " + std::to_string(a) + " rotations for " + std::to_string(b) + " objects");
+	}
+}
+
+}
+
+int batchThreadCount(size_t count, int numThreads) {
+	if (numThreads <= 0) {
+		numThreads = std::max(1u, std::thread::hardware_concurrency());
+	}
+	return (int)std::max<size_t>(1, std::min<size_t>(numThreads, count / MIN_OBJECTS_PER_THREAD));
+}
+
+void Vec4Array::resize(size_t size) {
+	x.resize(size);
+	y.resize(size);
+	z.resize(size);
+	w.resize(size);
+}
+
+void Vec4Array::set(size_t i, vec4 v) {
+	x[i] = v.x;
+	y[i] = v.y;
+	z[i] = v.z;
+	w[i] = v.w;
+}
+
+void SO4Array::resize(size_t size) {
+	left.resize(size);
+	right.resize(size);
+}
+
+void SO4Array::set(size_t i, const SO4& rotation) {
+	left.set(i, vec4FromQuat(rotation.left));
+	right.set(i, vec4FromQuat(rotation.right));
+}
+
+void rotatePoints(const SO4& rotation, Vec4Array& points, int numThreads) {
+	runBatch(points.size(), numThreads, RotatePointsShared{ toMat4(rotation), points });
+}
+
+void rotatePoints(const SO4Array& rotations, Vec4Array& points, int numThreads) {
+	checkSameSize(rotations.size(), points.size());
+	runBatch(points.size(), numThreads, RotatePointsEach{ rotations, points });
+}
+
+void composeRotations(const SO4& step, SO4Array& rotations, int numThreads) {
+	runBatch(rotations.size(), numThreads, ComposeShared{ step, rotations });
+}
+
+void composeRotations(const SO4Array& steps, SO4Array& rotations, int numThreads) {
+	checkSameSize(steps.size(), rotations.size());
+	runBatch(rotations.size(), numThreads, ComposeEach{ steps, rotations });
+}
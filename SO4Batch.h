@@ -0,0 +1,62 @@
+#ifndef SO4BATCH_H_
+#define SO4BATCH_H_
+
+#include <cstddef>
+#include <vector>
+
+#include "SO4.h"
+
+/**
+ * SO(4) rotations applied to many objects at once, for animating spheres and lights along
+ * geodesics every frame.
+ *
+ * Everything is stored structure-of-arrays so a SIMD register holds the same component of
+ * floatv::width objects, and every pass also renormalizes what it writes: points go back onto
+ * the 3-sphere and rotors back onto SO(4), so objects can be moved forever without drifting.
+ *
+ * An object moving along a geodesic at angular speed s in direction d (tangent at p) is
+ * rotated each step by planeRotation(p, d, s * dt); keeping its frame as an SO4 and composing
+ * the steps onto it is what keeps the direction tangent.
+ *
+ * numThreads = 0 uses every core. Small batches use fewer threads, since starting one costs
+ * about as much as rotating tens of thousands of points.
+ */
+
+/** The threads the functions below actually use for count objects when asked for numThreads. */
+int batchThreadCount(size_t count, int numThreads = 0);
+
+/** vec4s, one array per component. */
+struct Vec4Array {
+	std::vector<float> x, y, z, w;
+
+	size_t size() const { return x.size(); }
+	void resize(size_t size);
+
+	vec4 get(size_t i) const { return vec4(x[i], y[i], z[i], w[i]); }
+	void set(size_t i, vec4 v);
+};
+
+/** SO4s, with each quaternion stored like vec4FromQuat (x is the real part). */
+struct SO4Array {
+	Vec4Array left, right;
+
+	size_t size() const { return left.size(); }
+	void resize(size_t size);
+
+	SO4 get(size_t i) const { return { quatFromVec4(left.get(i)), quatFromVec4(right.get(i)) }; }
+	void set(size_t i, const SO4& rotation);
+};
+
+/** points[i] = normalize(apply(rotation, points[i])) */
+void rotatePoints(const SO4& rotation, Vec4Array& points, int numThreads = 0);
+
+/** points[i] = normalize(apply(rotations[i], points[i])). Both must be the same size. */
+void rotatePoints(const SO4Array& rotations, Vec4Array& points, int numThreads = 0);
+
+/** rotations[i] = normalize(step * rotations[i]) */
+void composeRotations(const SO4& step, SO4Array& rotations, int numThreads = 0);
+
+/** rotations[i] = normalize(steps[i] * rotations[i]). Both must be the same size. */
+void composeRotations(const SO4Array& steps, SO4Array& rotations, int numThreads = 0);
+
+#endif /* SO4BATCH_H_ */
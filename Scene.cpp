@@ -0,0 +1,302 @@
+#include "Scene.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <map>
+#include <random>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+
+static const Material PLAYER_MATERIAL = { vec3(0.8, 0.5, 0.5), false, false };
+static const float PLAYER_RADIUS = 0.1f;
+
+Scene makeDefaultScene() {
+	Scene scene;
+
+	//bools are in this order: checkerboard, reflective.
+	scene.materials = {
+		PLAYER_MATERIAL,
+		{ vec3(1.0, 1.0, 1.0), true, false },
+		{ vec3(0.0, 0.0, 0.0), false, true },
+		{ vec3(1.0, 0.0, 0.0), true, false },
+		{ vec3(1.0, 0.0, 1.0), true, false },
+		{ vec3(0.0, 1.0, 0.0), true, false },
+		{ vec3(1.0, 1.0, 0.0), true, false },
+		{ vec3(0.0, 0.0, 1.0), true, false },
+		{ vec3(1.0, 1.0, 1.0), false, false }, //light object
+		{ vec3(0.4, 0.2, 0.9), true, false },
+	};
+
+	vec4 lightPosition = normalize(vec4(1., 0., 0., 0.25));
+
+	//the bool is visible from inside.
+	scene.spheres = {
+		{ vec4(0), PLAYER_RADIUS, 0, false }, //This spot reserved for the player sphere
+
+		{ normalize(vec4(1., 0., 0., 0.)),   0.1f, 1, true },
+		{ normalize(vec4(1., 0.5, 0., 0.)),  0.1f, 2, true },
+		{ normalize(vec4(1., -0.5, 0., 0.)), 0.1f, 3, true },
+		{ normalize(vec4(1., 0., 0.5, 0.)),  0.1f, 4, true },
+		{ normalize(vec4(1., 0., -0.5, 0.)), 0.1f, 5, true },
+		{ normalize(vec4(1., 0., 0., 0.5)),  0.1f, 6, true },
+		{ normalize(vec4(1., 0., 0., -0.5)), 0.1f, 7, true },
+
+		{ lightPosition, 0.05f, 8, false }, //light object
+
+		//almost-plane at the bottom
+		{ normalize(vec4(0.0, 0.0, 0.0, -1.)), (PI / 2.0f) - 0.15f, 9, true },
+	};
+
+	scene.lights = { { lightPosition, 0.5f, 8 } };
+
+	return scene;
+}
+
+Scene makeRandomScene(int numSpheres, unsigned seed) {
+	Scene scene = makeDefaultScene();
+
+	std::mt19937 rng(seed);
+	std::normal_distribution<float> gaussian;
+	std::uniform_real_distribution<float> uniform;
+
+	// Sized so the spheres fill about 5% of the volume of the 3-sphere (2 pi^2)
+	float radius = std::min(0.1f, (float)std::cbrt(1.5 * 0.05 * PI / std::max(1, numSpheres)));
+
+	scene.materials.reserve(scene.materials.size() + numSpheres);
+	scene.spheres.reserve(scene.spheres.size() + numSpheres);
+	for (int i = 0; i < numSpheres; i++) {
+		Material material;
+		material.color = vec3(uniform(rng), uniform(rng), uniform(rng));
+		material.hasCheckerboardPattern = uniform(rng) < 0.5f;
+		material.isReflective = uniform(rng) < 0.1f;
+
+		Sphere sphere;
+		sphere.center = normalize(vec4(gaussian(rng), gaussian(rng), gaussian(rng), gaussian(rng)));
+		sphere.radius = radius * (0.5f + uniform(rng));
+		sphere.material = (int)scene.materials.size();
+		sphere.visibleFromInside = true;
+
+		scene.materials.push_back(material);
+		scene.spheres.push_back(sphere);
+	}
+
+	return scene;
+}
+
+/////////////////////////////// SCENE FILES ///////////////////////////////
+
+namespace {
+
+class SceneParser {
+public:
+	SceneParser(const std::string& path) : _path(path) {
+		// Slot 0 is the player sphere; its material can be replaced by a "player" line
+		_scene.materials.push_back(PLAYER_MATERIAL);
+		_scene.spheres.push_back({ vec4(0), PLAYER_RADIUS, 0, false });
+	}
+
+	Scene parse(std::istream& in) {
+		std::string line;
+		while (std::getline(in, line)) {
+			_lineNumber++;
+			line = line.substr(0, line.find('#'));
+
+			std::istringstream words(line);
+			std::string keyword;
+			if (!(words >> keyword)) {
+				continue;
+			}
+
+			if (keyword == "material") {
+				parseMaterial(words);
+			}
+			else if (keyword == "player") {
+				_scene.spheres[0].radius = readFloat(words);
+				_scene.spheres[0].material = readMaterial(words);
+			}
+			else if (keyword == "sphere") {
+				parseSphere(words);
+			}
+			else if (keyword == "light") {
+				parseLight(words);
+			}
+			else if (keyword == "motion") {
+				parseMotion(words);
+			}
+			else {
+				fail("unknown keyword '" + keyword + "'");
+			}
+		}
+
+		if (_scene.lights.empty()) {
+			fail("the scene has no lights");
+		}
+		return _scene;
+	}
+
+private:
+	void parseMaterial(std::istringstream& words) {
+		std::string name = readWord(words);
+		if (_materialIndices.count(name)) {
+			fail("material '" + name + "' is defined twice");
+		}
+
+		Material material = { readVec3(words), false, false };
+		for (std::string flag; words >> flag;) {
+			if (flag == "checkerboard") {
+				material.hasCheckerboardPattern = true;
+			}
+			else if (flag == "reflective") {
+				material.isReflective = true;
+			}
+			else {
+				fail("unknown material flag '" + flag + "'");
+			}
+		}
+
+		_materialIndices[name] = (int)_scene.materials.size();
+		_scene.materials.push_back(material);
+	}
+
+	void parseSphere(std::istringstream& words) {
+		Sphere sphere;
+		sphere.center = readPosition(words);
+		sphere.radius = readFloat(words);
+		sphere.material = readMaterial(words);
+		sphere.visibleFromInside = true;
+		for (std::string flag; words >> flag;) {
+			if (flag == "hidden-from-inside") {
+				sphere.visibleFromInside = false;
+			}
+			else {
+				fail("unknown sphere flag '" + flag + "'");
+			}
+		}
+		_lastSphereLine = (int)_scene.spheres.size();
+		_scene.spheres.push_back(sphere);
+	}
+
+	void parseMotion(std::istringstream& words) {
+		if (_lastSphereLine < 0) {
+			fail("motion without a sphere before it");
+		}
+		if (_movingSpheres.count(_lastSphereLine)) {
+			fail("the sphere already has a motion");
+		}
+
+		SphereMotion motion;
+		motion.sphereIndex = _lastSphereLine;
+		motion.start = _scene.spheres[_lastSphereLine].center;
+		vec4 direction = readVec4(words);
+		direction -= dot(direction, motion.start) * motion.start;
+		if (length(direction) < 1e-6f) {
+			fail("the motion direction has to point away from the sphere's center");
+		}
+		motion.direction = normalize(direction);
+		motion.speed = readFloat(words);
+		std::string extra;
+		if (words >> extra) {
+			fail("unexpected '" + extra + "' after the motion speed");
+		}
+
+		_movingSpheres.insert(_lastSphereLine);
+		_scene.motions.push_back(motion);
+	}
+
+	void parseLight(std::istringstream& words) {
+		Light light;
+		light.position = readPosition(words);
+		light.intensity = readFloat(words);
+		light.sphereIndex = -1;
+
+		std::string radius;
+		if (words >> radius) {
+			Sphere sphere;
+			sphere.center = light.position;
+			sphere.radius = toFloat(radius);
+			sphere.material = readMaterial(words);
+			sphere.visibleFromInside = false;
+
+			light.sphereIndex = (int)_scene.spheres.size();
+			_scene.spheres.push_back(sphere);
+		}
+		_scene.lights.push_back(light);
+	}
+
+	std::string readWord(std::istringstream& words) {
+		std::string word;
+		if (!(words >> word)) {
+			fail("missing value");
+		}
+		return word;
+	}
+
+	float toFloat(const std::string& word) {
+		std::istringstream in(word);
+		float value;
+		if (!(in >> value) || !in.eof()) {
+			fail("expected a number, got '" + word + "'");
+		}
+		return value;
+	}
+
+	float readFloat(std::istringstream& words) {
+		return toFloat(readWord(words));
+	}
+
+	vec3 readVec3(std::istringstream& words) {
+		vec3 v;
+		for (int i = 0; i < 3; i++) {
+			v[i] = readFloat(words);
+		}
+		return v;
+	}
+
+	vec4 readVec4(std::istringstream& words) {
+		vec4 v;
+		for (int i = 0; i < 4; i++) {
+			v[i] = readFloat(words);
+		}
+		return v;
+	}
+
+	vec4 readPosition(std::istringstream& words) {
+		vec4 v = readVec4(words);
+		if (length(v) == 0.0f) {
+			fail("position (0, 0, 0, 0) is not on the 3-sphere");
+		}
+		return normalize(v);
+	}
+
+	int readMaterial(std::istringstream& words) {
+		std::string name = readWord(words);
+		auto found = _materialIndices.find(name);
+		if (found == _materialIndices.end()) {
+			fail("unknown material '" + name + "'");
+		}
+		return found->second;
+	}
+
+	void fail(const std::string& message) {
+		throw std::runtime_error(_path + ":" + std::to_string(_lineNumber) + ": " + message);
+	}
+
+	std::string _path;
+	int _lineNumber = 0;
+	Scene _scene;
+	std::map<std::string, int> _materialIndices;
+	int _lastSphereLine = -1; // the sphere a motion line applies to
+	std::set<int> _movingSpheres;
+};
+
+}
+
+Scene loadScene(const std::string& path) {
+	std::ifstream inFile(path, std::ios::in);
+	if (!inFile) {
+		throw std::runtime_error("could not load scene file " + path);
+	}
+	return SceneParser(path).parse(inFile);
+}
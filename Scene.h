@@ -0,0 +1,86 @@
+#ifndef SCENE_H_
+#define SCENE_H_
+
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "4DUtils.h"
+
+//Note: the containing 3-sphere always has a radius of 1
+
+const float PI = 3.1415926535897932384626433832795f;
+const float TWO_PI = 2.f * PI;
+
+struct Material {
+	vec3 color;
+
+	bool hasCheckerboardPattern;
+	bool isReflective;
+};
+
+struct Sphere {
+	vec4 center;
+	float radius;
+	int material; // index into Scene::materials
+
+	bool visibleFromInside;
+};
+
+struct Light {
+	vec4 position;
+	float intensity;
+	int sphereIndex; // the sphere drawn at the light, which is always fully lit, or -1
+};
+
+/** A sphere that moves along a great circle at a constant speed. */
+struct SphereMotion {
+	int sphereIndex;
+	vec4 start;     // the sphere's center at time 0
+	vec4 direction; // unit tangent at start
+	float speed;    // radians per second
+
+	vec4 centerAt(double time) const {
+		// Evaluated from the start rather than stepped, so it can't drift off the 3-sphere
+		float angle = (float)std::fmod(speed * time, (double)TWO_PI);
+		return cos(angle) * start + sin(angle) * direction;
+	}
+};
+
+/** Everything that describes *what* is drawn. */
+struct Scene {
+	std::vector<Material> materials;
+
+	// spheres[0] is reserved for the player sphere, same as in the shader.
+	std::vector<Sphere> spheres;
+
+	std::vector<Light> lights;
+
+	std::vector<SphereMotion> motions;
+};
+
+/** Parameters that describe *how* the scene is drawn (the RAYTRACER PARAMS block of shader.frag). */
+struct RaytracerParams {
+	int reflectionCount = 4;
+	float reflectance = 0.6f;
+
+	bool lightingEnabled = true;
+	float ambientLight = 0.1f;
+
+	vec3 backgroundColor = vec3(0);
+	bool userSphereVisible = false;
+};
+
+/** The scene that used to be hardcoded in shader.frag (also in scenes/default.scene). */
+Scene makeDefaultScene();
+
+/** The default scene plus numSpheres randomly placed spheres, for testing with large scenes. */
+Scene makeRandomScene(int numSpheres, unsigned seed);
+
+/**
+ * Reads a scene file; see scenes/default.scene for the format. The player sphere is added
+ * as spheres[0]. Throws std::runtime_error on unreadable files and malformed lines.
+ */
+Scene loadScene(const std::string& path);
+
+#endif /* SCENE_H_ */
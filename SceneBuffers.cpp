@@ -0,0 +1,90 @@
+#include "SceneBuffers.h"
+
+#include "CPURaytracer.h"
+
+SceneBuffers packSceneBuffers(const Scene& scene) {
+	SceneBuffers buffers;
+
+	buffers.spheres.reserve(scene.spheres.size());
+	for (const Sphere& sphere : scene.spheres) {
+		GPUSphere packed;
+		packed.center = sphere.center;
+		packed.radius = sphere.radius;
+		packed.cosRadius = cos(sphere.radius);
+		packed.material = sphere.material;
+		packed.flags = sphere.visibleFromInside ? SPHERE_VISIBLE_FROM_INSIDE : 0;
+		buffers.spheres.push_back(packed);
+	}
+
+	buffers.materials.reserve(scene.materials.size());
+	for (const Material& material : scene.materials) {
+		GPUMaterial packed;
+		packed.color = material.color;
+		packed.flags = (material.hasCheckerboardPattern ? MATERIAL_CHECKERBOARD : 0)
+			| (material.isReflective ? MATERIAL_REFLECTIVE : 0);
+		buffers.materials.push_back(packed);
+	}
+
+	buffers.lights.reserve(scene.lights.size());
+	for (const Light& light : scene.lights) {
+		GPULight packed = {};
+		packed.position = light.position;
+		packed.intensity = light.intensity;
+		packed.sphereIndex = light.sphereIndex;
+		buffers.lights.push_back(packed);
+	}
+
+	return buffers;
+}
+
+Scene unpackSceneBuffers(const SceneBuffers& buffers) {
+	Scene scene;
+
+	scene.spheres.reserve(buffers.spheres.size());
+	for (const GPUSphere& packed : buffers.spheres) {
+		Sphere sphere;
+		sphere.center = packed.center;
+		sphere.radius = packed.radius;
+		sphere.material = packed.material;
+		sphere.visibleFromInside = (packed.flags & SPHERE_VISIBLE_FROM_INSIDE) != 0;
+		scene.spheres.push_back(sphere);
+	}
+
+	scene.materials.reserve(buffers.materials.size());
+	for (const GPUMaterial& packed : buffers.materials) {
+		Material material;
+		material.color = packed.color;
+		material.hasCheckerboardPattern = (packed.flags & MATERIAL_CHECKERBOARD) != 0;
+		material.isReflective = (packed.flags & MATERIAL_REFLECTIVE) != 0;
+		scene.materials.push_back(material);
+	}
+
+	scene.lights.reserve(buffers.lights.size());
+	for (const GPULight& packed : buffers.lights) {
+		scene.lights.push_back({ packed.position, packed.intensity, packed.sphereIndex });
+	}
+
+	return scene;
+}
+
+void packCameraFrameSpheres(const std::vector<GPUSphere>& spheres, vec4 userPos, const mat4& toCameraFrame,
+	std::vector<GPUCameraFrameSphere>& cameraSpheres) {
+	cameraSpheres.resize(spheres.size());
+	for (size_t i = 0; i < spheres.size(); i++) {
+		const GPUSphere& sphere = spheres[i];
+		PackedSphere packed;
+		packed.center = i == 0 ? userPos : sphere.center;
+		packed.cosRadius = sphere.cosRadius;
+		packed.planeOffset = dot(packed.center, packed.center * packed.cosRadius);
+		packed.visibleFromInside = (sphere.flags & SPHERE_VISIBLE_FROM_INSIDE) != 0;
+		CameraFrameSphere cameraSphere = makeCameraFrameSphere(packed, (int)i, toCameraFrame);
+
+		GPUCameraFrameSphere& out = cameraSpheres[i];
+		out.center = cameraSphere.center;
+		out.originDot = cameraSphere.originDot;
+		out.missThreshold = cameraSphere.missThreshold;
+		out.planeOffset = cameraSphere.planeOffset;
+		out.flags = cameraSphere.hiddenFromInside ? CAMERA_FRAME_SPHERE_HIDDEN_FROM_INSIDE : 0;
+		out.padding = 0.0f;
+	}
+}
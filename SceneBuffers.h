@@ -0,0 +1,82 @@
+#ifndef SCENEBUFFERS_H_
+#define SCENEBUFFERS_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "Scene.h"
+
+/**
+ * The scene as shader.frag reads it: one std430 shader storage buffer each for spheres,
+ * materials and lights. The structs below match the GLSL declarations byte for byte, so each
+ * vector can be uploaded with a single glBufferData.
+ */
+
+// Binding points of the buffers (layout(binding = ...) in shader.frag)
+const unsigned SCENE_SPHERES_BINDING = 1;
+const unsigned SCENE_MATERIALS_BINDING = 2;
+const unsigned SCENE_LIGHTS_BINDING = 3;
+const unsigned CAMERA_FRAME_SPHERES_BINDING = 4;
+
+const uint32_t SPHERE_VISIBLE_FROM_INSIDE = 1;
+
+const uint32_t MATERIAL_CHECKERBOARD = 1;
+const uint32_t MATERIAL_REFLECTIVE = 2;
+
+const uint32_t CAMERA_FRAME_SPHERE_HIDDEN_FROM_INSIDE = 1;
+
+struct GPUSphere {
+	vec4 center;
+	float radius;
+	float cosRadius;
+	int32_t material;
+	uint32_t flags;
+};
+
+struct GPUMaterial {
+	vec3 color;
+	uint32_t flags;
+};
+
+struct GPULight {
+	vec4 position;
+	float intensity;
+	int32_t sphereIndex;
+	float padding[2];
+};
+
+/** CameraFrameSphere (CPURaytracer.h) as the shader reads it; filled in per eye. */
+struct GPUCameraFrameSphere {
+	vec3 center;
+	float originDot;
+	float missThreshold;
+	float planeOffset;
+	uint32_t flags;
+	float padding;
+};
+
+static_assert(sizeof(GPUSphere) == 32, "GPUSphere must match the std430 layout in shader.frag");
+static_assert(sizeof(GPUMaterial) == 16, "GPUMaterial must match the std430 layout in shader.frag");
+static_assert(sizeof(GPULight) == 32, "GPULight must match the std430 layout in shader.frag");
+static_assert(sizeof(GPUCameraFrameSphere) == 32, "GPUCameraFrameSphere must match the std430 layout in shader.frag");
+
+struct SceneBuffers {
+	std::vector<GPUSphere> spheres;
+	std::vector<GPUMaterial> materials;
+	std::vector<GPULight> lights;
+};
+
+SceneBuffers packSceneBuffers(const Scene& scene);
+
+/** The inverse of packSceneBuffers, for the CPU raytracer. */
+Scene unpackSceneBuffers(const SceneBuffers& buffers);
+
+/**
+ * Reduces every sphere to its terms for primary rays of one view, the same way the CPU
+ * raytracer does with makeCameraFrameSphere(). spheres[0] is taken to be at userPos, like
+ * GetSphere() in the shader does. cameraSpheres is resized to match spheres.
+ */
+void packCameraFrameSpheres(const std::vector<GPUSphere>& spheres, vec4 userPos, const mat4& toCameraFrame,
+	std::vector<GPUCameraFrameSphere>& cameraSpheres);
+
+#endif /* SCENEBUFFERS_H_ */
@@ -0,0 +1,81 @@
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+#include "BinaryScene.h"
+
+/**
+ * Converts a text scene (or a generated random one) to the memory-mapped binary format, see
+ * BinaryScene.h.
+ */
+
+static void printUsage(const char* exe) {
+	std::cerr << "Usage: " << exe << " (<input.scene> | --random-spheres <n>) -o <output.s3scene> [options]\n"
+		"  --random-spheres <n>       the default scene plus n randomly placed spheres, instead of an input file\n"
+		"  --seed <n>                 random seed for --random-spheres (default: 1)\n"
+		"  --cells <n>                cells per axis of each of the 8 cubes (default: 16)\n"
+		"  --drop-motions             convert scenes with moving spheres anyway; they are written where they start\n";
+}
+
+int main(int argc, char **argv) {
+	std::string inputPath;
+	std::string outputPath;
+	int randomSpheres = 0;
+	unsigned seed = 1;
+	int cellsPerAxis = 16;
+	bool dropMotions = false;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "-o" && i + 1 < argc) {
+			outputPath = argv[++i];
+		}
+		else if (arg == "--random-spheres" && i + 1 < argc) {
+			randomSpheres = std::atoi(argv[++i]);
+		}
+		else if (arg == "--seed" && i + 1 < argc) {
+			seed = (unsigned)std::atoi(argv[++i]);
+		}
+		else if (arg == "--cells" && i + 1 < argc) {
+			cellsPerAxis = std::atoi(argv[++i]);
+		}
+		else if (arg == "--drop-motions") {
+			dropMotions = true;
+		}
+		else if (arg[0] != '-' && inputPath.empty()) {
+			inputPath = arg;
+		}
+		else {
+			printUsage(argv[0]);
+			return 1;
+		}
+	}
+	if (outputPath.empty() || (inputPath.empty() == (randomSpheres <= 0))) {
+		printUsage(argv[0]);
+		return 1;
+	}
+
+	try {
+		auto start = std::chrono::steady_clock::now();
+		Scene scene = inputPath.empty() ? makeRandomScene(randomSpheres, seed) : loadScene(inputPath);
+		// The binary format has no motions, so the output would render differently
+		if (!scene.motions.empty()) {
+			if (!dropMotions) {
+				throw std::runtime_error(inputPath + " has " + std::to_string(scene.motions.size())
+					+ " moving spheres, which the binary format can't hold (pass --drop-motions to convert it anyway)");
+			}
+			std::cerr << "Warning: dropping the motions of " << scene.motions.size() << " moving spheres" << std::endl;
+		}
+		writeBinaryScene(outputPath, scene, cellsPerAxis);
+		std::cout << "Wrote " << scene.spheres.size() << " spheres to " << outputPath << " in "
+			<< std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() * 1000.0 << " ms" << std::endl;
+	}
+	catch (const std::exception& e) {
+		std::cerr << "Error: " << e.what() << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,97 @@
+#include "SceneStreamer.h"
+
+#include <algorithm>
+#include <iterator>
+
+SceneStreamer::SceneStreamer(const MappedScene& scene, float streamRadius, size_t maxResidentSpheres)
+	: _scene(scene), _streamRadius(streamRadius), _maxResidentSpheres(maxResidentSpheres) {
+	_thread = std::thread(&SceneStreamer::run, this);
+}
+
+SceneStreamer::~SceneStreamer() {
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_stop = true;
+	}
+	_wake.notify_one();
+	_thread.join();
+}
+
+void SceneStreamer::setViewerPosition(vec4 pos) {
+	{
+		std::lock_guard<std::mutex> lock(_mutex);
+		_viewerPos = pos;
+		_hasNewPosition = true;
+	}
+	_wake.notify_one();
+}
+
+bool SceneStreamer::takeUpdate(std::vector<GPUSphere>& spheres) {
+	std::lock_guard<std::mutex> lock(_mutex);
+	if (_error) {
+		std::rethrow_exception(_error);
+	}
+	if (!_hasUpdate) {
+		return false;
+	}
+	spheres.swap(_latestSpheres);
+	_hasUpdate = false;
+	return true;
+}
+
+void SceneStreamer::waitUntilStreamed() {
+	std::unique_lock<std::mutex> lock(_mutex);
+	_streamed.wait(lock, [&] { return _stop || _error || (!_hasNewPosition && !_isStreaming); });
+}
+
+void SceneStreamer::run() {
+	const SceneBuffers fixedBuffers = _scene.getFixedBuffers();
+	std::vector<GPUSphere> spheres;
+
+	std::unique_lock<std::mutex> lock(_mutex);
+	while (true) {
+		_wake.wait(lock, [&] { return _stop || _hasNewPosition; });
+		if (_stop) {
+			break;
+		}
+		vec4 pos = _viewerPos;
+		_hasNewPosition = false;
+		_isStreaming = true;
+		lock.unlock();
+
+		try {
+			// Selecting cells only reads the cell table, which stays resident
+			std::vector<uint32_t> cells = _scene.selectCells(pos, _streamRadius, _maxResidentSpheres);
+			std::sort(cells.begin(), cells.end());
+			bool changed = cells != _residentCells;
+
+			if (changed) {
+				spheres.assign(fixedBuffers.spheres.begin(), fixedBuffers.spheres.end());
+				_scene.appendCellSpheres(cells, spheres);
+
+				std::vector<uint32_t> released;
+				std::set_difference(_residentCells.begin(), _residentCells.end(), cells.begin(), cells.end(), std::back_inserter(released));
+				for (uint32_t cell : released) {
+					_scene.releaseCell(cell);
+				}
+				_residentCells.swap(cells);
+			}
+
+			lock.lock();
+			if (changed) {
+				// If the last list was never taken it is dropped here, so memory stays bounded
+				_latestSpheres.swap(spheres);
+				_hasUpdate = true;
+			}
+		}
+		catch (...) {
+			lock.lock();
+			_error = std::current_exception();
+			_isStreaming = false;
+			_streamed.notify_all();
+			break;
+		}
+		_isStreaming = false;
+		_streamed.notify_all();
+	}
+}
@@ -0,0 +1,71 @@
+#ifndef SCENESTREAMER_H_
+#define SCENESTREAMER_H_
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "BinaryScene.h"
+
+const float DEFAULT_STREAM_RADIUS = 1.0f;
+const size_t DEFAULT_MAX_RESIDENT_SPHERES = 1 << 20;
+
+/**
+ * Keeps the spheres near the user of a MappedScene resident, on a thread of its own.
+ *
+ * The render thread reports where the user is with setViewerPosition and picks up a new sphere
+ * list with takeUpdate; neither waits for any file reading, which all happens on the streaming
+ * thread. Each sphere list holds at most maxResidentSpheres cell spheres (plus the fixed
+ * spheres), and there are never more than three of them: the one being built, the latest one
+ * not yet taken, and the caller's. Cells that drop out are released back to the OS.
+ */
+class SceneStreamer {
+public:
+	SceneStreamer(const MappedScene& scene, float streamRadius = DEFAULT_STREAM_RADIUS,
+		size_t maxResidentSpheres = DEFAULT_MAX_RESIDENT_SPHERES);
+	~SceneStreamer();
+
+	SceneStreamer(const SceneStreamer&) = delete;
+	SceneStreamer& operator=(const SceneStreamer&) = delete;
+
+	void setViewerPosition(vec4 pos);
+
+	/**
+	 * If the resident cells changed since the last call, swaps the new sphere list (fixed
+	 * spheres first, same as MappedScene::getFixedBuffers) into spheres and returns true.
+	 * Rethrows any error the streaming thread ran into.
+	 */
+	bool takeUpdate(std::vector<GPUSphere>& spheres);
+
+	/** Blocks until the cells for the latest viewer position are resident. */
+	void waitUntilStreamed();
+
+private:
+	void run();
+
+	const MappedScene& _scene;
+	const float _streamRadius;
+	const size_t _maxResidentSpheres;
+
+	std::mutex _mutex;
+	std::condition_variable _wake;
+	std::condition_variable _streamed;
+	vec4 _viewerPos;
+	bool _hasNewPosition = false;
+	bool _isStreaming = false;
+	bool _stop = false;
+	std::vector<GPUSphere> _latestSpheres;
+	bool _hasUpdate = false;
+	std::exception_ptr _error;
+
+	// Only touched by the streaming thread
+	std::vector<uint32_t> _residentCells;
+
+	std::thread _thread;
+};
+
+#endif /* SCENESTREAMER_H_ */
@@ -0,0 +1,197 @@
+#include <algorithm>
+#include <cstddef>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#define GL_GLEXT_PROTOTYPES
+#include <GL/glcorearb.h>
+
+#include "SceneBuffers.h"
+#include "TestSupport.h"
+#include "ViewConstants.h"
+
+/**
+ * Compiles and links shaders/shader.vert and shader.frag in a headless OpenGL 4.3 core context
+ * (EGL, no window or display needed), then checks that the blocks the shader reads are laid out
+ * the way ViewConstants and the GPU structs in SceneBuffers.h are, offset by offset. Run by
+ * ctest where EGL is found; the GLSL is otherwise only compiled once the VR app runs.
+ *
+ * Usage: 4d-raytracer-shader-check <shader.vert> <shader.frag>
+ */
+
+// The exit code when there's no OpenGL 4.3 to check with (ctest's SKIP_RETURN_CODE)
+static const int SKIPPED = 77;
+
+static bool makeHeadlessContext() {
+	// Surfaceless if the driver has it, so there doesn't have to be an X server
+	EGLDisplay display = EGL_NO_DISPLAY;
+	PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if (getPlatformDisplay) {
+		display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+	}
+	if (display == EGL_NO_DISPLAY) {
+		display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+	}
+	EGLint major, minor;
+	if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor) || !eglBindAPI(EGL_OPENGL_API)) {
+		std::cerr << "Could not initialize EGL for OpenGL" << std::endl;
+		return false;
+	}
+
+	const EGLint contextAttributes[] = {
+		EGL_CONTEXT_MAJOR_VERSION, 4,
+		EGL_CONTEXT_MINOR_VERSION, 3,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+		EGL_NONE
+	};
+	EGLContext context = eglCreateContext(display, (EGLConfig)0, EGL_NO_CONTEXT, contextAttributes);
+	if (context == EGL_NO_CONTEXT || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+		std::cerr << "Could not make an OpenGL 4.3 core context without a surface" << std::endl;
+		return false;
+	}
+	std::cout << glGetString(GL_RENDERER) << ", OpenGL " << glGetString(GL_VERSION) << std::endl;
+	return true;
+}
+
+static GLuint compileShader(const std::string& path, GLenum type) {
+	std::ifstream inFile(path);
+	if (!inFile) {
+		expect(false, "could not load " + path);
+		return 0;
+	}
+	std::stringstream code;
+	code << inFile.rdbuf();
+	std::string text = code.str();
+	const char* source = text.c_str();
+
+	GLuint shader = glCreateShader(type);
+	glShaderSource(shader, 1, &source, nullptr);
+	glCompileShader(shader);
+	GLint status, logLength;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+	glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &logLength);
+	if (logLength > 1) {
+		std::vector<char> log(logLength);
+		glGetShaderInfoLog(shader, logLength, nullptr, &log[0]);
+		std::cerr << path << ":\n" << &log[0] << std::endl;
+	}
+	expect(status != GL_FALSE, path + " does not compile");
+	return shader;
+}
+
+static GLint resourceProperty(GLuint program, GLenum interface, const std::string& name, GLenum property) {
+	GLuint index = glGetProgramResourceIndex(program, interface, name.c_str());
+	if (index == GL_INVALID_INDEX) {
+		expect(false, name + " is not in the linked program");
+		return -1;
+	}
+	GLint value = -1;
+	glGetProgramResourceiv(program, interface, index, 1, &property, 1, nullptr, &value);
+	return value;
+}
+
+struct Member {
+	const char* name; // in the shader
+	size_t offset;    // in the C++ struct
+};
+
+static void expectOffset(GLint actual, size_t expected, const std::string& what) {
+	expect(actual < 0 || (size_t)actual == expected,
+		what + " is at offset " + std::to_string(actual) + " in the shader but " + std::to_string(expected) + " in C++");
+}
+
+/** A std430 array of structs against the C++ struct uploaded into it. */
+static void checkArrayOfStructs(GLuint program, const std::string& array, size_t stride, const std::vector<Member>& members) {
+	for (const Member& member : members) {
+		std::string name = array + "[0]." + member.name;
+		expectOffset(resourceProperty(program, GL_BUFFER_VARIABLE, name, GL_OFFSET), member.offset, name);
+		GLint actualStride = resourceProperty(program, GL_BUFFER_VARIABLE, name, GL_TOP_LEVEL_ARRAY_STRIDE);
+		expect(actualStride < 0 || (size_t)actualStride == stride,
+			array + " has a stride of " + std::to_string(actualStride) + " in the shader but " + std::to_string(stride) + " in C++");
+	}
+}
+
+int main(int argc, char **argv) {
+	if (argc != 3) {
+		std::cerr << "Usage: " << argv[0] << " <shader.vert> <shader.frag>" << std::endl;
+		return 1;
+	}
+	if (!makeHeadlessContext()) {
+		// Not the shaders' fault; ctest reports it as skipped
+		return SKIPPED;
+	}
+
+	GLuint program = glCreateProgram();
+	glAttachShader(program, compileShader(argv[1], GL_VERTEX_SHADER));
+	glAttachShader(program, compileShader(argv[2], GL_FRAGMENT_SHADER));
+	if (testFailures() > 0) {
+		return 1;
+	}
+	glLinkProgram(program);
+	GLint status;
+	glGetProgramiv(program, GL_LINK_STATUS, &status);
+	if (status == GL_FALSE) {
+		GLint logLength;
+		glGetProgramiv(program, GL_INFO_LOG_LENGTH, &logLength);
+		std::vector<char> log(std::max(logLength, 1));
+		glGetProgramInfoLog(program, (GLsizei)log.size(), nullptr, &log[0]);
+		std::cerr << &log[0] << std::endl;
+		expect(false, "the shaders do not link");
+		return 1;
+	}
+
+	GLint viewConstantsSize = resourceProperty(program, GL_UNIFORM_BLOCK, "ViewConstants", GL_BUFFER_DATA_SIZE);
+	expect(viewConstantsSize < 0 || (size_t)viewConstantsSize == sizeof(ViewConstants),
+		"ViewConstants is " + std::to_string(viewConstantsSize) + " bytes in the shader but " + std::to_string(sizeof(ViewConstants)) + " in C++");
+	const Member viewConstants[] = {
+		{ "userPos", offsetof(ViewConstants, userPos) },
+		{ "rayDirAtOrigin", offsetof(ViewConstants, rayDirAtOrigin) },
+		{ "rayDirPerPixelX", offsetof(ViewConstants, rayDirPerPixelX) },
+		{ "rayDirPerPixelY", offsetof(ViewConstants, rayDirPerPixelY) },
+		{ "viewportResolution", offsetof(ViewConstants, viewportResolution) },
+		{ "primaryRaysInCameraFrame", offsetof(ViewConstants, primaryRaysInCameraFrame) },
+		{ "fromCameraFrame", offsetof(ViewConstants, fromCameraFrame) },
+		{ "cameraRayDirAtOrigin", offsetof(ViewConstants, cameraRayDirAtOrigin) },
+		{ "cameraRayDirPerPixelX", offsetof(ViewConstants, cameraRayDirPerPixelX) },
+		{ "cameraRayDirPerPixelY", offsetof(ViewConstants, cameraRayDirPerPixelY) },
+	};
+	for (const Member& member : viewConstants) {
+		expectOffset(resourceProperty(program, GL_UNIFORM, member.name, GL_OFFSET), member.offset, std::string("ViewConstants.") + member.name);
+	}
+
+	checkArrayOfStructs(program, "spheres", sizeof(GPUSphere), {
+		{ "center", offsetof(GPUSphere, center) },
+		{ "radius", offsetof(GPUSphere, radius) },
+		{ "cosRadius", offsetof(GPUSphere, cosRadius) },
+		{ "materialIndex", offsetof(GPUSphere, material) },
+		{ "flags", offsetof(GPUSphere, flags) },
+	});
+	checkArrayOfStructs(program, "materials", sizeof(GPUMaterial), {
+		{ "color", offsetof(GPUMaterial, color) },
+		{ "flags", offsetof(GPUMaterial, flags) },
+	});
+	checkArrayOfStructs(program, "lights", sizeof(GPULight), {
+		{ "position", offsetof(GPULight, position) },
+		{ "intensity", offsetof(GPULight, intensity) },
+		{ "sphereIndex", offsetof(GPULight, sphereIndex) },
+	});
+	checkArrayOfStructs(program, "cameraSpheres", sizeof(GPUCameraFrameSphere), {
+		{ "center", offsetof(GPUCameraFrameSphere, center) },
+		{ "originDot", offsetof(GPUCameraFrameSphere, originDot) },
+		{ "missThreshold", offsetof(GPUCameraFrameSphere, missThreshold) },
+		{ "planeOffset", offsetof(GPUCameraFrameSphere, planeOffset) },
+		{ "flags", offsetof(GPUCameraFrameSphere, flags) },
+	});
+
+	if (testFailures() > 0) {
+		std::cerr << testFailures() << " checks failed" << std::endl;
+		return 1;
+	}
+	std::cout << "shaders compile and link, and their blocks match the C++ layouts" << std::endl;
+	return 0;
+}
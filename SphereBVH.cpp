@@ -0,0 +1,577 @@
+#include "SphereBVH.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <thread>
+
+#include "Parallel.h"
+
+namespace {
+
+const int NUM_BINS = 16;
+const int MAX_LEAF_SIZE = 4;
+const float TRAVERSAL_COST = 1.0f;  // relative to one sphere test
+
+// Spheres below this many are built on the calling thread
+const int PARALLEL_SUBTREE_THRESHOLD = 4096;
+const int PARALLEL_BINNING_THRESHOLD = 1 << 16;
+
+// Refits keep the tree's shape, which gets worse as spheres wander away from their neighbours.
+// A subtree is rebuilt once its area is this many times what it was when it was built, and the
+// whole tree once its cost is this many times its cost when it was built.
+const float SUBTREE_REBUILD_GROWTH = 2.0f;
+const float REBUILD_COST_RATIO = 1.2f;
+
+// Slack added to every cap so float error in the cap and sphere tests can't cull a real hit
+const float CAP_EPSILON = 1e-4f;
+
+struct Cap {
+	vec4 center;
+	float radius;
+};
+
+const Cap EMPTY_CAP = { vec4(1, 0, 0, 0), -1.0f };
+
+float angleBetween(vec4 a, vec4 b) {
+	return acos(clamp(dot(a, b), -1.0f, 1.0f));
+}
+
+/** Smallest cap containing both caps. */
+Cap capUnion(const Cap& a, const Cap& b) {
+	if (a.radius < 0) {
+		return b;
+	}
+	if (b.radius < 0) {
+		return a;
+	}
+
+	float theta = angleBetween(a.center, b.center);
+	if (theta + b.radius <= a.radius) {
+		return a;
+	}
+	if (theta + a.radius <= b.radius) {
+		return b;
+	}
+
+	float radius = (theta + a.radius + b.radius) / 2.0f;
+	if (radius >= PI) {
+		return { a.center, PI };
+	}
+
+	// Walk from a's center towards b's until a's far edge is on the new cap's boundary
+	vec4 towardsB = b.center - dot(b.center, a.center) * a.center;
+	if (length(towardsB) < 1e-6f) {
+		return { a.center, std::max(a.radius, b.radius) };
+	}
+	float shift = radius - a.radius;
+	vec4 center = normalize(cos(shift) * a.center + sin(shift) * normalize(towardsB));
+	return { center, radius };
+}
+
+/**
+ * The chance that a uniformly random great circle meets a cap of this radius.
+ * The squared length of a unit vector's projection onto a random 2-plane in R^4 is
+ * uniform on [0, 1], so the circle passes within the radius with probability sin^2(r).
+ */
+float capArea(const Cap& cap) {
+	if (cap.radius < 0) {
+		return 0.0f;
+	}
+	if (cap.radius >= PI / 2.0f) {
+		return 1.0f;
+	}
+	float s = sin(cap.radius);
+	return s * s;
+}
+
+struct BuildItem {
+	Cap cap;
+	int sphereIndex;
+};
+
+/** Cap around the normalized mean of the centers of capAt(0..count-1). */
+template<class CapAt>
+Cap boundingCap(int count, CapAt capAt) {
+	vec4 sum(0);
+	for (int i = 0; i < count; i++) {
+		sum += capAt(i).center;
+	}
+	if (length(sum) < 1e-6f) {
+		return { capAt(0).center, PI };
+	}
+
+	Cap cap = { normalize(sum), 0.0f };
+	for (int i = 0; i < count; i++) {
+		Cap other = capAt(i);
+		cap.radius = std::max(cap.radius, angleBetween(cap.center, other.center) + other.radius);
+	}
+	cap.radius = std::min(cap.radius, PI);
+	return cap;
+}
+
+struct BuildNode {
+	Cap cap;
+	std::unique_ptr<BuildNode> children[2];
+	int first;
+	int count;
+};
+
+/**
+ * Bins track the box (in R^4) around their centers instead of a cap: boxes merge exactly, while
+ * folding caps together one at a time drifts far from the smallest cap and misleads the heuristic.
+ */
+struct Bin {
+	vec4 boxMin = vec4(99999.f);
+	vec4 boxMax = vec4(-99999.f);
+	float maxRadius = 0.0f;
+	int count = 0;
+
+	void add(const Cap& cap) {
+		boxMin = min(boxMin, cap.center);
+		boxMax = max(boxMax, cap.center);
+		maxRadius = std::max(maxRadius, cap.radius);
+		count++;
+	}
+
+	void add(const Bin& other) {
+		boxMin = min(boxMin, other.boxMin);
+		boxMax = max(boxMax, other.boxMax);
+		maxRadius = std::max(maxRadius, other.maxRadius);
+		count += other.count;
+	}
+
+	/**
+	 * capArea() of a cap around the normalized box center that holds everything in the bin.
+	 * Every center is within h (half the box diagonal) of the box center, which is itself within
+	 * h of the unit sphere, so the chord to the cap center is at most 2h, i.e. 2 asin(h) radians.
+	 */
+	float area() const {
+		if (count == 0) {
+			return 0.0f;
+		}
+		float halfDiagonal = length(boxMax - boxMin) / 2.0f;
+		float radius = 2.0f * asin(std::min(1.0f, halfDiagonal)) + maxRadius;
+		return capArea({ vec4(0), std::min(radius, PI) });
+	}
+};
+
+class Builder {
+public:
+	Builder(std::vector<BuildItem>& items, int numThreads)
+		: _items(items), _numThreads(numThreads), _spareThreads(numThreads - 1) {
+	}
+
+	std::unique_ptr<BuildNode> buildRange(int begin, int end, int depth) {
+		std::unique_ptr<BuildNode> node(new BuildNode());
+		node->first = begin;
+		node->count = end - begin;
+		int count = end - begin;
+
+		vec4 centroidMin(99999.f), centroidMax(-99999.f);
+		computeCentroidBounds(begin, end, centroidMin, centroidMax);
+		node->cap = boundingCap(count, [&](int i) { return _items[begin + i].cap; });
+
+		if (count <= MAX_LEAF_SIZE || depth >= SphereBVH::MAX_DEPTH - 1) {
+			return node;
+		}
+
+		// Split along the axis (of R^4) the centers are most spread out on
+		vec4 extent = centroidMax - centroidMin;
+		int axis = 0;
+		for (int i = 1; i < 4; i++) {
+			if (extent[i] > extent[axis]) {
+				axis = i;
+			}
+		}
+
+		int mid;
+		if (extent[axis] <= 1e-7f) {
+			mid = begin + count / 2;
+		}
+		else {
+			mid = binnedSplit(begin, end, axis, centroidMin[axis], extent[axis]);
+			if (mid < 0) {
+				return node;
+			}
+		}
+
+		node->count = 0;
+		bool spawned = false;
+		if (count >= PARALLEL_SUBTREE_THRESHOLD && _spareThreads.fetch_sub(1) > 0) {
+			spawned = true;
+			std::thread rightThread([&]() { node->children[1] = buildRange(mid, end, depth + 1); });
+			node->children[0] = buildRange(begin, mid, depth + 1);
+			rightThread.join();
+			_spareThreads++;
+		}
+		if (!spawned) {
+			if (count >= PARALLEL_SUBTREE_THRESHOLD) {
+				_spareThreads++;
+			}
+			node->children[0] = buildRange(begin, mid, depth + 1);
+			node->children[1] = buildRange(mid, end, depth + 1);
+		}
+
+		// The children's union is sometimes tighter than the cap around the mean center
+		Cap childUnion = capUnion(node->children[0]->cap, node->children[1]->cap);
+		if (childUnion.radius < node->cap.radius) {
+			node->cap = childUnion;
+		}
+		return node;
+	}
+
+private:
+	void computeCentroidBounds(int begin, int end, vec4& centroidMin, vec4& centroidMax) {
+		for (int i = begin; i < end; i++) {
+			centroidMin = min(centroidMin, _items[i].cap.center);
+			centroidMax = max(centroidMax, _items[i].cap.center);
+		}
+	}
+
+	/** Partitions [begin, end) at the cheapest bin boundary and returns it, or -1 if a leaf is cheaper. */
+	int binnedSplit(int begin, int end, int axis, float axisMin, float axisExtent) {
+		const float binScale = NUM_BINS * (1.0f - 1e-5f) / axisExtent;
+		auto binOf = [=](const BuildItem& item) {
+			return std::min(NUM_BINS - 1, (int)((item.cap.center[axis] - axisMin) * binScale));
+		};
+
+		Bin bins[NUM_BINS];
+		int count = end - begin;
+		if (count >= PARALLEL_BINNING_THRESHOLD && _numThreads > 1) {
+			std::vector<std::vector<Bin>> threadBins(_numThreads, std::vector<Bin>(NUM_BINS));
+			parallelChunks(begin, end, _numThreads, [&](int chunkBegin, int chunkEnd, int thread) {
+				std::vector<Bin>& localBins = threadBins[thread];
+				for (int i = chunkBegin; i < chunkEnd; i++) {
+					localBins[binOf(_items[i])].add(_items[i].cap);
+				}
+			});
+			for (const std::vector<Bin>& localBins : threadBins) {
+				for (int b = 0; b < NUM_BINS; b++) {
+					bins[b].add(localBins[b]);
+				}
+			}
+		}
+		else {
+			for (int i = begin; i < end; i++) {
+				bins[binOf(_items[i])].add(_items[i].cap);
+			}
+		}
+
+		// Sweep from the right to get the cost of everything right of each boundary
+		float rightArea[NUM_BINS];
+		int rightCount[NUM_BINS];
+		Bin right;
+		for (int b = NUM_BINS - 1; b > 0; b--) {
+			right.add(bins[b]);
+			rightArea[b] = right.area();
+			rightCount[b] = right.count;
+		}
+		Bin parent = right;
+		parent.add(bins[0]);
+
+		float parentArea = std::max(parent.area(), 1e-12f);
+		float bestCost = (float)count;
+		int bestBoundary = -1;
+		Bin left;
+		for (int b = 1; b < NUM_BINS; b++) {
+			left.add(bins[b - 1]);
+			if (left.count == 0 || rightCount[b] == 0) {
+				continue;
+			}
+			float cost = TRAVERSAL_COST + (left.area() * left.count + rightArea[b] * rightCount[b]) / parentArea;
+			if (cost < bestCost) {
+				bestCost = cost;
+				bestBoundary = b;
+			}
+		}
+
+		if (bestBoundary < 0) {
+			if (count <= MAX_LEAF_SIZE * 4) {
+				return -1;
+			}
+			// Nothing beats a leaf, but a leaf this big would be worse to traverse than a median split
+			int mid = begin + count / 2;
+			std::nth_element(_items.begin() + begin, _items.begin() + mid, _items.begin() + end,
+				[axis](const BuildItem& a, const BuildItem& b) { return a.cap.center[axis] < b.cap.center[axis]; });
+			return mid;
+		}
+
+		BuildItem* middle = std::partition(&_items[begin], &_items[begin] + count,
+			[&](const BuildItem& item) { return binOf(item) < bestBoundary; });
+		return (int)(middle - &_items[0]);
+	}
+
+	std::vector<BuildItem>& _items;
+	int _numThreads;
+	std::atomic<int> _spareThreads;
+};
+
+/**
+ * Writes the tree under root into nodes, with root itself at rootIndex. Siblings go in free pairs
+ * first, then at the end. Leaf firsts are offset by sphereOffset.
+ */
+void flattenInto(const BuildNode* root, int rootIndex, int sphereOffset, std::vector<SphereBVH::Node>& nodes, std::vector<int>& freePairs) {
+	std::vector<std::pair<const BuildNode*, int>> pending;
+	pending.push_back({ root, rootIndex });
+	while (!pending.empty()) {
+		const BuildNode* buildNode = pending.back().first;
+		int index = pending.back().second;
+		pending.pop_back();
+
+		SphereBVH::Node node;
+		float radius = std::min(buildNode->cap.radius + CAP_EPSILON, PI);
+		node.center = buildNode->cap.center;
+		node.radius = radius;
+		node.cosRadius = radius >= PI ? -2.0f : cos(radius);
+		node.first = buildNode->first + sphereOffset;
+		node.count = buildNode->count;
+
+		if (buildNode->children[0]) {
+			if (freePairs.empty()) {
+				node.first = (int)nodes.size();
+				nodes.push_back(SphereBVH::Node());
+				nodes.push_back(SphereBVH::Node());
+			}
+			else {
+				node.first = freePairs.back();
+				freePairs.pop_back();
+			}
+			node.count = 0;
+			pending.push_back({ buildNode->children[0].get(), node.first });
+			pending.push_back({ buildNode->children[1].get(), node.first + 1 });
+		}
+		nodes[index] = node;
+	}
+}
+
+float nodeCost(const SphereBVH::Node& node) {
+	float area = capArea({ node.center, node.radius });
+	return node.count > 0 ? area * node.count : area * TRAVERSAL_COST * 2.0f;
+}
+
+} // namespace
+
+void SphereBVH::build(const std::vector<Sphere>& spheres, int firstSphere, int numThreads) {
+	_nodes.clear();
+	_sphereIndices.clear();
+	_parents.clear();
+	_depths.clear();
+	_builtAreas.clear();
+	_refitStamps.clear();
+	_freePairs.clear();
+	_leafOfSphere.assign(spheres.size(), -1);
+	_costSum = 0;
+	_builtCost = 0;
+	_firstSphere = firstSphere;
+	if ((int)spheres.size() <= firstSphere) {
+		return;
+	}
+
+	if (numThreads <= 0) {
+		numThreads = std::max(1u, std::thread::hardware_concurrency());
+	}
+	_numThreads = numThreads;
+
+	std::vector<BuildItem> items;
+	items.reserve(spheres.size() - firstSphere);
+	for (int i = firstSphere; i < (int)spheres.size(); i++) {
+		items.push_back({ { normalize(spheres[i].center), spheres[i].radius }, i });
+	}
+
+	Builder builder(items, numThreads);
+	std::unique_ptr<BuildNode> root = builder.buildRange(0, (int)items.size(), 0);
+
+	_sphereIndices.resize(items.size());
+	for (size_t i = 0; i < items.size(); i++) {
+		_sphereIndices[i] = items[i].sphereIndex;
+	}
+
+	// Flatten so that siblings are adjacent
+	_nodes.push_back(Node());
+	flattenInto(root.get(), 0, 0, _nodes, _freePairs);
+	indexSubtree(0, -1);
+	_builtCost = computeCost();
+}
+
+SphereBVH::RefitStats SphereBVH::refit(const std::vector<Sphere>& spheres, const std::vector<int>& movedSpheres) {
+	RefitStats stats;
+	if (_nodes.empty()) {
+		return stats;
+	}
+
+	// A cap only has to change if a sphere that moved is no longer inside it; everything else
+	// still is. Going by the spheres rather than the children's caps keeps the caps build() made
+	// tighter than the union of the children's, so a frame where nothing moved changes nothing.
+	_refitQueues.resize(MAX_DEPTH);
+	_refitStamps.resize(_nodes.size(), 0);
+	_refitStamp++;
+	for (int sphereIndex : movedSpheres) {
+		if (sphereIndex < 0 || sphereIndex >= (int)_leafOfSphere.size() || _leafOfSphere[sphereIndex] < 0) {
+			continue;
+		}
+		const Sphere& sphere = spheres[sphereIndex];
+		vec4 center = normalize(sphere.center);
+		for (int node = _leafOfSphere[sphereIndex]; node >= 0; node = _parents[node]) {
+			if (_refitStamps[node] != _refitStamp
+				&& angleBetween(_nodes[node].center, center) + sphere.radius > _nodes[node].radius - CAP_EPSILON) {
+				_refitStamps[node] = _refitStamp;
+				_refitQueues[_depths[node]].push_back(node);
+			}
+		}
+	}
+
+	// Deepest first, so inner nodes are refitted around children that already were
+	std::vector<int> degraded;
+	for (int depth = MAX_DEPTH - 1; depth >= 0; depth--) {
+		for (int node : _refitQueues[depth]) {
+			refitNode(node, spheres);
+			stats.refittedNodes++;
+			if (_nodes[node].count == 0 && capArea({ _nodes[node].center, _nodes[node].radius }) > _builtAreas[node] * SUBTREE_REBUILD_GROWTH) {
+				degraded.push_back(node);
+			}
+		}
+		_refitQueues[depth].clear();
+	}
+
+	if (computeCost() > _builtCost * REBUILD_COST_RATIO) {
+		build(spheres, _firstSphere, _numThreads);
+		stats.fullRebuild = true;
+		return stats;
+	}
+
+	// Only the topmost degraded subtrees are rebuilt; the ones inside them go along
+	std::sort(degraded.begin(), degraded.end());
+	degraded.erase(std::unique(degraded.begin(), degraded.end()), degraded.end());
+	std::vector<int> rebuildRoots;
+	for (int node : degraded) {
+		bool insideAnother = false;
+		for (int ancestor = _parents[node]; ancestor >= 0 && !insideAnother; ancestor = _parents[ancestor]) {
+			insideAnother = std::binary_search(degraded.begin(), degraded.end(), ancestor);
+		}
+		if (!insideAnother) {
+			rebuildRoots.push_back(node);
+		}
+	}
+	for (int node : rebuildRoots) {
+		if (node == 0) {
+			build(spheres, _firstSphere, _numThreads);
+			stats.fullRebuild = true;
+			return stats;
+		}
+		rebuildSubtree(node, spheres);
+		stats.rebuiltSubtrees++;
+	}
+	return stats;
+}
+
+void SphereBVH::refitNode(int index, const std::vector<Sphere>& spheres) {
+	const Node& node = _nodes[index];
+	Cap cap;
+	if (node.count > 0) {
+		cap = boundingCap(node.count, [&](int i) {
+			const Sphere& sphere = spheres[_sphereIndices[node.first + i]];
+			return Cap{ normalize(sphere.center), sphere.radius };
+		});
+		cap.radius = std::min(cap.radius + CAP_EPSILON, PI);
+	}
+	else {
+		// The children's caps already have the slack in them
+		const Node& left = _nodes[node.first];
+		const Node& right = _nodes[node.first + 1];
+		cap = capUnion({ left.center, left.radius }, { right.center, right.radius });
+	}
+	setNodeCap(index, cap.center, cap.radius);
+}
+
+void SphereBVH::setNodeCap(int index, vec4 center, float radius) {
+	Node& node = _nodes[index];
+	_costSum -= nodeCost(node);
+	node.center = center;
+	node.radius = radius;
+	node.cosRadius = radius >= PI ? -2.0f : cos(radius);
+	_costSum += nodeCost(node);
+}
+
+void SphereBVH::rebuildSubtree(int index, const std::vector<Sphere>& spheres) {
+	// Every subtree covers a contiguous run of the sphere index list
+	int leftmost = index, rightmost = index;
+	while (_nodes[leftmost].count == 0) {
+		leftmost = _nodes[leftmost].first;
+	}
+	while (_nodes[rightmost].count == 0) {
+		rightmost = _nodes[rightmost].first + 1;
+	}
+	int begin = _nodes[leftmost].first;
+	int end = _nodes[rightmost].first + _nodes[rightmost].count;
+
+	int depth = _depths[index];
+
+	std::vector<BuildItem> items;
+	items.reserve(end - begin);
+	for (int i = begin; i < end; i++) {
+		const Sphere& sphere = spheres[_sphereIndices[i]];
+		items.push_back({ { normalize(sphere.center), sphere.radius }, _sphereIndices[i] });
+	}
+	Builder builder(items, _numThreads);
+	std::unique_ptr<BuildNode> root = builder.buildRange(0, (int)items.size(), depth);
+	for (size_t i = 0; i < items.size(); i++) {
+		_sphereIndices[begin + i] = items[i].sphereIndex;
+	}
+
+	int parent = _parents[index];
+	unindexSubtree(index);
+	flattenInto(root.get(), index, begin, _nodes, _freePairs);
+	indexSubtree(index, parent);
+}
+
+void SphereBVH::indexSubtree(int root, int parent) {
+	_parents.resize(_nodes.size(), -1);
+	_depths.resize(_nodes.size(), 0);
+	_builtAreas.resize(_nodes.size(), 0.0f);
+
+	std::vector<std::pair<int, int>> pending = { { root, parent } };
+	while (!pending.empty()) {
+		int index = pending.back().first;
+		int parentIndex = pending.back().second;
+		pending.pop_back();
+		_parents[index] = parentIndex;
+		_depths[index] = parentIndex >= 0 ? _depths[parentIndex] + 1 : 0;
+
+		const Node& node = _nodes[index];
+		_builtAreas[index] = capArea({ node.center, node.radius });
+		_costSum += nodeCost(node);
+		if (node.count > 0) {
+			for (int i = node.first; i < node.first + node.count; i++) {
+				_leafOfSphere[_sphereIndices[i]] = index;
+			}
+		}
+		else {
+			pending.push_back({ node.first, index });
+			pending.push_back({ node.first + 1, index });
+		}
+	}
+}
+
+void SphereBVH::unindexSubtree(int root) {
+	std::vector<int> pending = { root };
+	while (!pending.empty()) {
+		int index = pending.back();
+		pending.pop_back();
+
+		const Node& node = _nodes[index];
+		_costSum -= nodeCost(node);
+		if (node.count == 0) {
+			_freePairs.push_back(node.first);
+			pending.push_back(node.first);
+			pending.push_back(node.first + 1);
+		}
+	}
+}
+
+float SphereBVH::computeCost() const {
+	if (_nodes.empty()) {
+		return 0.0f;
+	}
+	return (float)(_costSum / capArea({ _nodes[0].center, _nodes[0].radius }));
+}
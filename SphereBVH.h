@@ -0,0 +1,257 @@
+#ifndef SPHEREBVH_H_
+#define SPHEREBVH_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "CPURaytracer.h"
+#include "RayPacket.h"
+
+/**
+ * Bounding volume hierarchy for spheres on S^3, where every node is bounded by a spherical
+ * cap (the set of points within some geodesic radius of a center).
+ *
+ * A ray is a whole great circle, t in [0, 2pi). The points of the ray that lie in a cap form
+ * a single arc, so each node yields one entry parameter tEnter (0 if the ray starts inside
+ * the cap). A hit at t can only be inside a node if tEnter <= t, which is what lets the
+ * closest-hit traversal skip nodes the same way an ordinary BVH does.
+ */
+class SphereBVH {
+public:
+	struct Node {
+		vec4 center;
+		float cosRadius;
+		float radius;
+		int first;  // leaves: first entry in the sphere index list, inner nodes: left child (right is first + 1)
+		int count;  // number of spheres in a leaf, 0 for inner nodes
+	};
+
+	static const int MAX_DEPTH = 64;
+
+	struct RefitStats {
+		int refittedNodes = 0;
+		int rebuiltSubtrees = 0;
+		bool fullRebuild = false;
+	};
+
+	/**
+	 * Builds over spheres[firstSphere..] with a binned surface-area heuristic.
+	 * numThreads = 0 uses every core.
+	 */
+	void build(const std::vector<Sphere>& spheres, int firstSphere, int numThreads = 0);
+
+	/**
+	 * Brings the caps up to date after the spheres in movedSpheres moved or changed radius.
+	 * Only the leaves holding them and the nodes above those are touched, so the cost follows
+	 * the number of moved spheres rather than the size of the scene. The tree keeps its shape,
+	 * so subtrees that have grown a lot since they were built are rebuilt, and the whole tree
+	 * is once its cost is well past what it was after build().
+	 */
+	RefitStats refit(const std::vector<Sphere>& spheres, const std::vector<int>& movedSpheres);
+
+	bool empty() const { return _nodes.empty(); }
+	const std::vector<Node>& getNodes() const { return _nodes; }
+	const std::vector<int>& getSphereIndices() const { return _sphereIndices; }
+
+	/** Expected number of node + sphere tests per random ray, by the S^3 surface-area heuristic. */
+	float computeCost() const;
+
+	/** computeCost() right after the last build(). */
+	float getBuildCost() const { return _builtCost; }
+
+	/** Same contract as findClosestHitPacket(), for the spheres in this hierarchy. */
+	template<class V>
+	void findClosestHit(const std::vector<PackedSphere>& spheres, const RayPacketT<V>& rays, V& closestT, V& closestIndex) const;
+
+	/**
+	 * The same for primary rays, whose spheres are tested in the camera frame (cameraSpheres[i] is
+	 * sphere i; see RayPacket.h). The caps are still tested against rays, the same rays in world space.
+	 */
+	template<class V>
+	void findClosestHit(const std::vector<CameraFrameSphere>& cameraSpheres, const RayPacketT<V>& rays,
+		const CameraRayPacketT<V>& cameraRays, V& closestT, V& closestIndex) const;
+
+	/**
+	 * Lanes for which some sphere other than ignoredIndex is hit before tMax. Returns as soon as
+	 * every lane is blocked, and nodes are visited in whatever order is cheapest.
+	 */
+	template<class V>
+	typename V::mask anyHit(const std::vector<PackedSphere>& spheres, const RayPacketT<V>& rays, const V& tMax, const V& ignoredIndex) const;
+
+private:
+	/** Closest-hit traversal that calls intersectLeafSphere(sphereIndex) for the spheres of every leaf reached. */
+	template<class V, class IntersectLeafSphere>
+	void traverseClosest(const RayPacketT<V>& rays, const V& closestT, IntersectLeafSphere intersectLeafSphere) const;
+
+	/** Recomputes the cap of a node from its spheres (leaves) or its children's caps. */
+	void refitNode(int index, const std::vector<Sphere>& spheres);
+	void setNodeCap(int index, vec4 center, float radius);
+	void rebuildSubtree(int index, const std::vector<Sphere>& spheres);
+
+	// Bookkeeping for the nodes under root (parents, leaf of each sphere, areas, cost), added or removed
+	void indexSubtree(int root, int parent);
+	void unindexSubtree(int root);
+
+	std::vector<Node> _nodes;
+	std::vector<int> _sphereIndices;
+
+	// For refit()
+	std::vector<int> _parents;       // per node, -1 for the root
+	std::vector<uint8_t> _depths;    // per node
+	std::vector<float> _builtAreas;  // per node, capArea() when it was built
+	std::vector<int> _leafOfSphere;  // per sphere, -1 if not in the hierarchy
+	std::vector<int> _freePairs;     // sibling pairs left over from rebuilt subtrees
+	std::vector<std::vector<int>> _refitQueues; // nodes to refit, by depth
+	std::vector<uint32_t> _refitStamps; // per node, _refitStamp if already queued
+	uint32_t _refitStamp = 0;
+	double _costSum = 0;             // computeCost() before dividing by the root's area
+	float _builtCost = 0;
+	int _firstSphere = 0;
+	int _numThreads = 1;
+};
+
+/** Lanes for which the ray passes through the node's cap, and where it first enters it. */
+template<class V>
+SIMD_INLINE typename V::mask intersectCapPacket(const SphereBVH::Node& node, const RayPacketT<V>& rays, V& tEnter) {
+	const V cx(node.center.x), cy(node.center.y), cz(node.center.z), cw(node.center.w);
+	const V cosRadius(node.cosRadius);
+
+	V A = fmadd(cx, rays.dx, fmadd(cy, rays.dy, fmadd(cz, rays.dz, cw * rays.dw)));
+	V B = fmadd(cx, rays.ox, fmadd(cy, rays.oy, fmadd(cz, rays.oz, cw * rays.ow)));
+
+	// dot(PointAlongRay(t), center) = amplitude * sin(t + phaseShift), which is >= cosRadius inside the cap
+	typename V::mask originInside = B >= cosRadius;
+	V amplitude = vsqrt(fmadd(A, A, B * B));
+	V asinInput = cosRadius / amplitude;
+	typename V::mask hit = originInside | (asinInput <= V(1.0f));
+	if (!any(hit)) {
+		tEnter = V(99999999999999.f);
+		return hit;
+	}
+
+	V entry = vasin(vmin(vmax(asinInput, V(-1.0f)), V(1.0f))) - vatan2(B, A);
+	entry = select(entry < V(0.0f), entry + V(TWO_PI), entry);
+	tEnter = select(originInside, V(0.0f), entry);
+	return hit;
+}
+
+template<class V>
+void SphereBVH::findClosestHit(const std::vector<PackedSphere>& spheres, const RayPacketT<V>& rays, V& closestT, V& closestIndex) const {
+	traverseClosest(rays, closestT, [&](int sphereIndex) {
+		intersectSpherePacket(spheres[sphereIndex], (float)sphereIndex, rays, closestT, closestIndex);
+	});
+}
+
+template<class V>
+void SphereBVH::findClosestHit(const std::vector<CameraFrameSphere>& cameraSpheres, const RayPacketT<V>& rays,
+	const CameraRayPacketT<V>& cameraRays, V& closestT, V& closestIndex) const {
+	traverseClosest(rays, closestT, [&](int sphereIndex) {
+		intersectCameraFrameSpherePacket(cameraSpheres[sphereIndex], cameraRays, closestT, closestIndex);
+	});
+}
+
+template<class V, class IntersectLeafSphere>
+void SphereBVH::traverseClosest(const RayPacketT<V>& rays, const V& closestT, IntersectLeafSphere intersectLeafSphere) const {
+	if (_nodes.empty()) {
+		return;
+	}
+
+	struct StackEntry {
+		int node;
+		V tEnter;
+	};
+	// Every visit pops one entry and pushes at most two, so depth + 1 entries are enough.
+	StackEntry stack[MAX_DEPTH + 1];
+	int stackSize = 0;
+
+	V rootEnter;
+	typename V::mask rootHit = intersectCapPacket(_nodes[0], rays, rootEnter);
+	if (!any(rootHit & (rootEnter < closestT))) {
+		return;
+	}
+	stack[stackSize++] = { 0, rootEnter };
+
+	while (stackSize > 0) {
+		StackEntry entry = stack[--stackSize];
+		if (!any(entry.tEnter < closestT)) {
+			continue;
+		}
+		const Node& node = _nodes[entry.node];
+
+		if (node.count > 0) {
+			for (int i = node.first; i < node.first + node.count; i++) {
+				intersectLeafSphere(_sphereIndices[i]);
+			}
+			continue;
+		}
+
+		V leftEnter, rightEnter;
+		// (separate statements: the entry t has to be written before it is compared)
+		typename V::mask leftHit = intersectCapPacket(_nodes[node.first], rays, leftEnter);
+		typename V::mask rightHit = intersectCapPacket(_nodes[node.first + 1], rays, rightEnter);
+		leftHit = leftHit & (leftEnter < closestT);
+		rightHit = rightHit & (rightEnter < closestT);
+		bool visitLeft = any(leftHit);
+		bool visitRight = any(rightHit);
+
+		// Mask out lanes that miss so they can't keep the child alive when it is popped
+		leftEnter = select(leftHit, leftEnter, V(99999999999999.f));
+		rightEnter = select(rightHit, rightEnter, V(99999999999999.f));
+
+		if (visitLeft && visitRight) {
+			// Visit the child most lanes enter first, first (so it is pushed last)
+			int leftFirstLanes = popcount(bits(leftEnter <= rightEnter));
+			bool leftFirst = leftFirstLanes * 2 >= V::width;
+			stack[stackSize++] = leftFirst ? StackEntry{ node.first + 1, rightEnter } : StackEntry{ node.first, leftEnter };
+			stack[stackSize++] = leftFirst ? StackEntry{ node.first, leftEnter } : StackEntry{ node.first + 1, rightEnter };
+		}
+		else if (visitLeft) {
+			stack[stackSize++] = { node.first, leftEnter };
+		}
+		else if (visitRight) {
+			stack[stackSize++] = { node.first + 1, rightEnter };
+		}
+	}
+}
+
+template<class V>
+typename V::mask SphereBVH::anyHit(const std::vector<PackedSphere>& spheres, const RayPacketT<V>& rays, const V& tMax, const V& ignoredIndex) const {
+	const int allLanes = (1 << V::width) - 1;
+	typename V::mask occluded = V(0.0f) < V(0.0f);
+	if (_nodes.empty()) {
+		return occluded;
+	}
+
+	int stack[MAX_DEPTH + 1];
+	int stackSize = 0;
+	stack[stackSize++] = 0;
+
+	while (stackSize > 0) {
+		const Node& node = _nodes[stack[--stackSize]];
+
+		V tEnter;
+		typename V::mask capHit = intersectCapPacket(node, rays, tEnter);
+		if (!any(andnot(occluded, capHit & (tEnter < tMax)))) {
+			continue;
+		}
+
+		if (node.count > 0) {
+			for (int i = node.first; i < node.first + node.count; i++) {
+				int sphereIndex = _sphereIndices[i];
+				V index((float)sphereIndex);
+				occluded = occluded | andnot(index == ignoredIndex, anyHitSpherePacket(spheres[sphereIndex], rays, tMax));
+			}
+			if (bits(occluded) == allLanes) {
+				return occluded;
+			}
+			continue;
+		}
+
+		stack[stackSize++] = node.first + 1;
+		stack[stackSize++] = node.first;
+	}
+
+	return occluded;
+}
+
+#endif /* SPHEREBVH_H_ */
@@ -0,0 +1,115 @@
+#ifndef TESTSUPPORT_H_
+#define TESTSUPPORT_H_
+
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include "4DUtils.h"
+#include "SO4.h"
+
+/**
+ * What the ctest executables share: counting failed checks, random inputs from one seed, and
+ * a main() that runs the checks.
+ *
+ * The seed is printed with every run; --seed <n> repeats one, and --iterations <n> changes how
+ * many random cases each check gets.
+ */
+
+/** Checks that failed so far in this run. */
+inline int& testFailures() {
+	static int count = 0;
+	return count;
+}
+
+inline bool expect(bool condition, const std::string& message) {
+	if (!condition) {
+		// The first few are enough to go on, and a broken invariant fails on every case
+		if (++testFailures() <= 20) {
+			std::cerr << "FAILED: " << message << std::endl;
+		}
+	}
+	return condition;
+}
+
+inline std::string toString(vec4 v) {
+	std::ostringstream out;
+	out << "(" << v.x << ", " << v.y << ", " << v.z << ", " << v.w << ")";
+	return out.str();
+}
+
+inline bool expectNear(vec4 actual, vec4 expected, float epsilon, const std::string& what) {
+	bool near = !any(isnan(actual)) && !any(isinf(actual)) && length(actual - expected) <= epsilon;
+	return expect(near, what + ": got " + toString(actual) + ", expected " + toString(expected));
+}
+
+/** Random numbers, vectors and cameras, all from one seed; each test adds its own on top. */
+class TestRandom {
+public:
+	explicit TestRandom(unsigned seed) : _rng(seed) {}
+
+	unsigned seed() { return _rng(); }
+	float uniform() { return std::uniform_real_distribution<float>(0.0f, 1.0f)(_rng); }
+	float angle(float largest) { return std::uniform_real_distribution<float>(-largest, largest)(_rng); }
+	vec4 vector() { return vec4(_gaussian(_rng), _gaussian(_rng), _gaussian(_rng), _gaussian(_rng)); }
+	vec4 unitVector() { return normalize(vector()); }
+
+	/** A unit vector orthogonal to from, so the two span a plane. */
+	vec4 orthogonalTo(vec4 from) {
+		vec4 v = vector();
+		return normalize(v - dot(v, from) * from);
+	}
+
+	CurvedWorldPosAndRot camera() {
+		return toPosAndRot(normalize(SO4{ quat(_gaussian(_rng), _gaussian(_rng), _gaussian(_rng), _gaussian(_rng)),
+			quat(_gaussian(_rng), _gaussian(_rng), _gaussian(_rng), _gaussian(_rng)) }));
+	}
+
+protected:
+	std::mt19937 _rng;
+	std::normal_distribution<float> _gaussian;
+};
+
+/**
+ * The main() of a test executable: reads --seed and --iterations, calls
+ * runChecks(seed, iterations), counts anything it throws as a failure, and returns the exit
+ * code. casesPerCheck says what the iterations are of, for the first line of output.
+ */
+template<class RunChecks>
+int runTests(int argc, char **argv, const std::string& casesPerCheck, RunChecks runChecks) {
+	unsigned seed = std::random_device()();
+	int iterations = 1000;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--seed" && i + 1 < argc) {
+			seed = (unsigned)std::strtoul(argv[++i], nullptr, 10);
+		}
+		else if (arg == "--iterations" && i + 1 < argc) {
+			iterations = std::atoi(argv[++i]);
+		}
+		else {
+			std::cerr << "Usage: " << argv[0] << " [--seed <n>] [--iterations <n>]" << std::endl;
+			return 1;
+		}
+	}
+	std::cout << "seed " << seed << ", " << iterations << " " << casesPerCheck << " per check" << std::endl;
+
+	try {
+		runChecks(seed, iterations);
+	}
+	catch (const std::exception& e) {
+		expect(false, std::string("threw ") + e.what());
+	}
+
+	if (testFailures() > 0) {
+		std::cerr << testFailures() << " checks failed (seed " << seed << ")" << std::endl;
+		return 1;
+	}
+	std::cout << "all passed" << std::endl;
+	return 0;
+}
+
+#endif /* TESTSUPPORT_H_ */
@@ -0,0 +1,199 @@
+#include "Trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+
+std::atomic<bool> g_traceEnabled{ false };
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+const Clock::time_point s_epoch = Clock::now();
+std::atomic<uint32_t> s_frame{ 0 };
+
+/**
+ * One thread's events. Only that thread writes; any thread can copy it out at any time. A copy
+ * checks afterwards which slots could have been reused while it was reading and drops those,
+ * the same way a sequence lock does.
+ */
+class TraceRing {
+public:
+	TraceRing(uint32_t thread) : _thread(thread) {}
+
+	uint32_t getThread() const { return _thread; }
+
+	void push(const char* name, uint64_t begin, uint64_t end, uint32_t frame) {
+		uint64_t head = _head.load(std::memory_order_relaxed);
+		// A copy that sees any of these stores also sees head, and so knows this slot is being reused
+		std::atomic_thread_fence(std::memory_order_release);
+		Slot& slot = _slots[head % TRACE_RING_CAPACITY];
+		slot.name.store(name, std::memory_order_relaxed);
+		slot.begin.store(begin, std::memory_order_relaxed);
+		slot.end.store(end, std::memory_order_relaxed);
+		slot.frame.store(frame, std::memory_order_relaxed);
+		_head.store(head + 1, std::memory_order_release);
+	}
+
+	void copyTo(std::vector<TraceEvent>& events, uint32_t firstFrame, uint32_t lastFrame) const {
+		uint64_t head = _head.load(std::memory_order_acquire);
+		uint64_t first = head > TRACE_RING_CAPACITY ? head - TRACE_RING_CAPACITY : 0;
+		std::vector<TraceEvent> copied;
+		copied.reserve((size_t)(head - first));
+		for (uint64_t i = first; i < head; i++) {
+			const Slot& slot = _slots[i % TRACE_RING_CAPACITY];
+			copied.push_back({ slot.name.load(std::memory_order_relaxed), slot.begin.load(std::memory_order_relaxed),
+				slot.end.load(std::memory_order_relaxed), slot.frame.load(std::memory_order_relaxed), _thread });
+		}
+		std::atomic_thread_fence(std::memory_order_acquire);
+
+		// The event being written now, at headAfter, is overwriting the one TRACE_RING_CAPACITY before it
+		uint64_t headAfter = _head.load(std::memory_order_relaxed);
+		uint64_t firstIntact = headAfter + 1 > TRACE_RING_CAPACITY ? headAfter + 1 - TRACE_RING_CAPACITY : 0;
+		for (uint64_t i = std::max(first, firstIntact); i < head; i++) {
+			const TraceEvent& event = copied[(size_t)(i - first)];
+			if (event.frame >= firstFrame && event.frame <= lastFrame) {
+				events.push_back(event);
+			}
+		}
+	}
+
+private:
+	struct Slot {
+		std::atomic<const char*> name;
+		std::atomic<uint64_t> begin;
+		std::atomic<uint64_t> end;
+		std::atomic<uint32_t> frame;
+	};
+
+	uint32_t _thread;
+	std::atomic<uint64_t> _head{ 0 };
+	Slot _slots[TRACE_RING_CAPACITY];
+};
+
+// Rings are never freed, so a thread's events can still be exported after it exits
+std::mutex s_ringsMutex;
+std::vector<std::unique_ptr<TraceRing>> s_rings;
+std::vector<std::string> s_threadNames;
+
+// A thread only gets a ring once it records something
+thread_local TraceRing* t_ring = nullptr;
+thread_local std::string t_threadName;
+
+TraceRing& threadRing() {
+	if (!t_ring) {
+		std::lock_guard<std::mutex> lock(s_ringsMutex);
+		uint32_t thread = (uint32_t)s_rings.size();
+		s_rings.emplace_back(new TraceRing(thread));
+		s_threadNames.push_back(t_threadName);
+		t_ring = s_rings.back().get();
+	}
+	return *t_ring;
+}
+
+void writeJsonString(std::ostream& out, const std::string& text) {
+	out << '"';
+	for (char c : text) {
+		if (c == '"' || c == '\\') {
+			out << '\\' << c;
+		}
+		else if ((unsigned char)c < 0x20) {
+			out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << (int)c << std::dec << std::setfill(' ');
+		}
+		else {
+			out << c;
+		}
+	}
+	out << '"';
+}
+
+}
+
+void setTraceEnabled(bool enabled) {
+	g_traceEnabled.store(enabled, std::memory_order_relaxed);
+}
+
+uint64_t traceNow() {
+	// Never 0, which ScopedTimer takes to mean tracing was off when it started
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - s_epoch).count() + 1;
+}
+
+void recordTraceEvent(const char* name, uint64_t begin, uint64_t end) {
+	threadRing().push(name, begin, end, s_frame.load(std::memory_order_relaxed));
+}
+
+uint32_t beginTraceFrame() {
+	return s_frame.fetch_add(1, std::memory_order_relaxed) + 1;
+}
+
+uint32_t getTraceFrame() {
+	return s_frame.load(std::memory_order_relaxed);
+}
+
+void nameTraceThread(const std::string& name) {
+	if (!t_threadName.empty()) {
+		return;
+	}
+	t_threadName = name;
+	if (t_ring) {
+		std::lock_guard<std::mutex> lock(s_ringsMutex);
+		s_threadNames[t_ring->getThread()] = name;
+	}
+}
+
+std::vector<std::string> getTraceThreadNames() {
+	std::lock_guard<std::mutex> lock(s_ringsMutex);
+	return s_threadNames;
+}
+
+std::vector<TraceEvent> snapshotTrace(uint32_t firstFrame, uint32_t lastFrame) {
+	std::vector<const TraceRing*> rings;
+	{
+		std::lock_guard<std::mutex> lock(s_ringsMutex);
+		for (const std::unique_ptr<TraceRing>& ring : s_rings) {
+			rings.push_back(ring.get());
+		}
+	}
+
+	std::vector<TraceEvent> events;
+	for (const TraceRing* ring : rings) {
+		ring->copyTo(events, firstFrame, lastFrame);
+	}
+	return events;
+}
+
+void writeChromeTrace(const std::string& path, const std::vector<TraceEvent>& events) {
+	std::ofstream outFile(path, std::ios::out | std::ios::binary);
+	if (!outFile) {
+		throw std::runtime_error("could not open " + path + " for writing");
+	}
+
+	// Complete ("X") events in microseconds, plus the thread names as metadata
+	outFile << "{\"traceEvents\":[\n";
+	std::vector<std::string> threadNames = getTraceThreadNames();
+	for (size_t thread = 0; thread < threadNames.size(); thread++) {
+		std::string name = threadNames[thread].empty() ? "thread " + std::to_string(thread) : threadNames[thread];
+		outFile << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << thread << ",\"args\":{\"name\":";
+		writeJsonString(outFile, name);
+		outFile << "}},\n";
+	}
+	outFile << std::fixed << std::setprecision(3);
+	for (const TraceEvent& event : events) {
+		outFile << "{\"name\":";
+		writeJsonString(outFile, event.name);
+		outFile << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << event.thread
+			<< ",\"ts\":" << event.begin / 1000.0 << ",\"dur\":" << (event.end - event.begin) / 1000.0
+			<< ",\"args\":{\"frame\":" << event.frame << "}},\n";
+	}
+	// The format allows a trailing comma, but not every viewer does
+	outFile << "{\"name\":\"end\",\"ph\":\"i\",\"pid\":1,\"tid\":0,\"ts\":0,\"s\":\"g\"}\n]}\n";
+
+	if (!outFile) {
+		throw std::runtime_error("could not write " + path);
+	}
+}
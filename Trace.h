@@ -0,0 +1,81 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * Scoped timers for finding out where a frame went. Each thread records into a ring of its own,
+ * without locks, so timers cost two clock reads and a few stores while tracing is on and a
+ * single load while it's off. The rings keep the last TRACE_RING_CAPACITY events of each
+ * thread; snapshotTrace() can copy them out from any thread while they're being written, and
+ * writeChromeTrace() saves them for chrome://tracing or Perfetto.
+ *
+ * Events are tagged with the frame they happened in (beginTraceFrame()), so the last few frames
+ * can be picked out of the rings when one of them was slow.
+ */
+
+const size_t TRACE_RING_CAPACITY = 1 << 15;
+
+struct TraceEvent {
+	const char* name; // a string literal, or anything else that outlives the trace
+	uint64_t begin;   // nanoseconds since the trace started
+	uint64_t end;
+	uint32_t frame;
+	uint32_t thread;  // index into getTraceThreadNames()
+};
+
+extern std::atomic<bool> g_traceEnabled;
+
+inline bool isTraceEnabled() {
+	return g_traceEnabled.load(std::memory_order_relaxed);
+}
+
+void setTraceEnabled(bool enabled);
+
+/** Nanoseconds since the trace started. */
+uint64_t traceNow();
+
+/** Records a scope that has already ended, on the calling thread's ring. */
+void recordTraceEvent(const char* name, uint64_t begin, uint64_t end);
+
+/** Starts the next frame and returns its number. Events recorded from now on belong to it. */
+uint32_t beginTraceFrame();
+uint32_t getTraceFrame();
+
+/** Names the calling thread in exported traces, unless it already has a name. */
+void nameTraceThread(const std::string& name);
+std::vector<std::string> getTraceThreadNames();
+
+/** The events of frames firstFrame..lastFrame still in the rings, by thread and then by time. */
+std::vector<TraceEvent> snapshotTrace(uint32_t firstFrame = 0, uint32_t lastFrame = UINT32_MAX);
+
+/** Writes events in the Chrome trace event format. Throws std::runtime_error if it can't. */
+void writeChromeTrace(const std::string& path, const std::vector<TraceEvent>& events);
+
+/** Times the scope it's declared in. */
+class ScopedTimer {
+public:
+	explicit ScopedTimer(const char* name) : _name(name), _begin(isTraceEnabled() ? traceNow() : 0) {}
+
+	~ScopedTimer() {
+		if (_begin != 0 && isTraceEnabled()) {
+			recordTraceEvent(_name, _begin, traceNow());
+		}
+	}
+
+	ScopedTimer(const ScopedTimer&) = delete;
+	ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+private:
+	const char* _name;
+	uint64_t _begin;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) ScopedTimer TRACE_CONCAT(traceScope, __LINE__)(name)
+
+#endif /* TRACE_H_ */
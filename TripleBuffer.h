@@ -0,0 +1,65 @@
+#ifndef TRIPLEBUFFER_H_
+#define TRIPLEBUFFER_H_
+
+#include <atomic>
+#include <cstdint>
+
+/**
+ * Hands the latest value of T from one producer thread to one consumer thread without locks.
+ * Neither side ever waits: the producer always has a buffer of its own to write into, the
+ * consumer keeps reading its buffer until it calls update(), and the third buffer in the middle
+ * is swapped between them with a single atomic exchange. Values the consumer never picked up
+ * are simply overwritten.
+ */
+template <typename T>
+class TripleBuffer {
+public:
+	TripleBuffer(const T& initial = T()) {
+		for (int i = 0; i < 3; i++) {
+			_buffers[i] = initial;
+		}
+	}
+
+	TripleBuffer(const TripleBuffer&) = delete;
+	TripleBuffer& operator=(const TripleBuffer&) = delete;
+
+	/** Producer only: the buffer to fill in before publish(). */
+	T& writeBuffer() {
+		return _buffers[_writeIndex];
+	}
+
+	/** Producer only: makes the write buffer the latest value. */
+	void publish() {
+		_writeIndex = _middle.exchange(_writeIndex | FRESH, std::memory_order_acq_rel) & INDEX_MASK;
+	}
+
+	void write(const T& value) {
+		writeBuffer() = value;
+		publish();
+	}
+
+	/** Consumer only: picks up the latest published value. Returns false if there was none since the last call. */
+	bool update() {
+		if ((_middle.load(std::memory_order_relaxed) & FRESH) == 0) {
+			return false;
+		}
+		_readIndex = _middle.exchange(_readIndex, std::memory_order_acq_rel) & INDEX_MASK;
+		return true;
+	}
+
+	/** Consumer only: the value picked up by the last update(). Stays valid until the next update(). */
+	const T& readBuffer() const {
+		return _buffers[_readIndex];
+	}
+
+private:
+	static const uint8_t INDEX_MASK = 3;
+	static const uint8_t FRESH = 4;
+
+	T _buffers[3];
+	uint8_t _writeIndex = 0;
+	std::atomic<uint8_t> _middle{ 1 };
+	uint8_t _readIndex = 2;
+};
+
+#endif /* TRIPLEBUFFER_H_ */
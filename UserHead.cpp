@@ -0,0 +1,18 @@
+#include "UserHead.h"
+
+UserHead::UserHead(const CurvedWorldPosAndRot& initialState, float movementScale, double predictionHorizon)
+	: _movementScale(movementScale), _predictionHorizon(predictionHorizon), _camera(fromPosAndRot(initialState)) {
+}
+
+void UserHead::addSample(double time, const mat4& headMatrix) {
+	// The first pose is where the user starts, so it doesn't move them
+	if (_hasSample) {
+		changeByMatrixDifference(_headMatrix, headMatrix, _movementScale, &_camera);
+	}
+	_hasSample = true;
+	_headMatrix = headMatrix;
+
+	// The camera only ever follows real samples; the prediction goes on top when drawing
+	_predictor.addSample(time, headMatrix);
+	_headPrediction = _predictor.predict(time + _predictionHorizon) * rigidInverse(headMatrix);
+}
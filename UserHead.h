@@ -0,0 +1,43 @@
+#ifndef USERHEAD_H_
+#define USERHEAD_H_
+
+#include "PosePredictor.h"
+#include "SO4.h"
+
+/**
+ * Where the user is in the curved world, driven by the head tracker: every head pose moves and
+ * turns the camera by the change since the previous one (changeByMatrixDifference), and the
+ * head is predicted ahead for drawing. MyVRApp runs this on its simulation thread, and the
+ * headless replay runs the same thing on recorded tracker moves, so the two agree exactly.
+ */
+class UserHead {
+public:
+	/** predictionHorizon is how far past each head pose to predict, in seconds. */
+	UserHead(const CurvedWorldPosAndRot& initialState, float movementScale, double predictionHorizon);
+
+	/** A head tracker pose taken at time (seconds). */
+	void addSample(double time, const mat4& headMatrix);
+
+	CurvedWorldPosAndRot getUserState() const { return toPosAndRot(_camera); }
+
+	/** The head pose getUserState() was worked out from; each eye's view is relative to it. */
+	const mat4& getHeadMatrix() const { return _headMatrix; }
+
+	/**
+	 * How the head is expected to move from getHeadMatrix() by the time the frame is on screen,
+	 * as predicted pose * inverse(getHeadMatrix()); applied to each eye in room space.
+	 */
+	const mat4& getHeadPrediction() const { return _headPrediction; }
+
+private:
+	float _movementScale;
+	double _predictionHorizon;
+	bool _hasSample = false;
+	mat4 _headMatrix = mat4(1.0f);
+	mat4 _headPrediction = mat4(1.0f);
+	// Kept as a rotor rather than four vectors so it stays orthonormal however long the session
+	SO4 _camera;
+	PosePredictor _predictor;
+};
+
+#endif /* USERHEAD_H_ */
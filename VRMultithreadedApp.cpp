@@ -9,17 +9,80 @@
 #include "VRMultithreadedApp.h"
 #include <main/VRMain.h>
 
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+
 
 namespace MinVR {
 
-	VRMultithreadedApp::VRMultithreadedApp(int argc, char** argv) {
+	thread_local VRMultithreadedApp::RenderThreadState VRMultithreadedApp::t_renderThread;
+
+	const VRMultithreadedApp::EventHandler VRMultithreadedApp::EVENT_HANDLERS[NUM_EVENT_TYPES] = {
+		&VRMultithreadedApp::handleAnalogUpdate,
+		&VRMultithreadedApp::handleButtonDown,
+		&VRMultithreadedApp::handleButtonUp,
+		&VRMultithreadedApp::handleButtonRepeat,
+		&VRMultithreadedApp::handleCursorMove,
+		&VRMultithreadedApp::handleTrackerMove,
+	};
+
+	VRMultithreadedApp::VRMultithreadedApp(int argc, char** argv) : _trackerFlusher(this),
+		_framesMetric(_metrics.addCounter("raytracer_frames", "Frames rendered")),
+		_droppedFramesMetric(_metrics.addCounter("raytracer_dropped_frames", "Display refreshes that a frame missed")),
+		_frameTimeMetric(_metrics.addHistogram("raytracer_frame_seconds", "Time from one frame's start to the next")) {
+		const char* eyes[NUM_EYES] = { "left", "right", "other" };
+		for (int eye = 0; eye < NUM_EYES; eye++) {
+			_eyeSubmitTimeMetrics[eye] = &_metrics.addHistogram("raytracer_eye_cpu_submit_seconds",
+				"CPU time spent in onRenderGraphicsScene for one eye of one window; the GPU draws it later",
+				std::string("eye=\"") + eyes[eye] + "\"");
+		}
+
+		_createdTime = std::chrono::steady_clock::now();
+		_eventTypes["AnalogUpdate"] = ANALOG_UPDATE;
+		_eventTypes["ButtonDown"] = BUTTON_DOWN;
+		_eventTypes["ButtonUp"] = BUTTON_UP;
+		_eventTypes["ButtonRepeat"] = BUTTON_REPEAT;
+		_eventTypes["CursorMove"] = CURSOR_MOVE;
+		_eventTypes["TrackerMove"] = TRACKER_MOVE;
+
 		_main = new VRMain();
 
 		_main->addEventHandler(this);
 		_main->addRenderHandler(this);
-		_main->addModelHandler(this);
+		_main->addModelHandler(&_trackerFlusher);
 		_main->initialize(argc, argv);
 		headTrackingEventName = _main->getConfig()->getValueWithDefault<std::string>("MinVR/HeadTrackingEvent", "Head_Move");
+		_simulationRate = std::max(1, (int)_main->getConfig()->getValueWithDefault("MinVR/SimulationRate", 120));
+		headPredictionHorizon = std::max(0.0f, (float)_main->getConfig()->getValueWithDefault("MinVR/HeadPredictionMs", 0.0f)) / 1000.0;
+
+		// Either can be used without a headset; see EventRecording.h
+		std::string recordPath = _main->getConfig()->getValueWithDefault<std::string>("MinVR/RecordEvents", "");
+		if (!recordPath.empty()) {
+			_eventRecorder.reset(new EventRecorder(recordPath));
+		}
+		std::string replayPath = _main->getConfig()->getValueWithDefault<std::string>("MinVR/ReplayEvents", "");
+		if (!replayPath.empty()) {
+			_replay = loadEventRecording(replayPath);
+		}
+
+		_reportStartupTime = _main->getConfig()->getValueWithDefault("MinVR/ReportStartupTime", 0) != 0;
+		_traceFile = _main->getConfig()->getValueWithDefault<std::string>("MinVR/TraceFile", "");
+		_frameBudget = (uint64_t)(std::max(0.0f, (float)_main->getConfig()->getValueWithDefault("MinVR/FrameBudgetMs", 0.0f)) * 1e6);
+		_flightRecorderFrames = (uint32_t)std::max(1, (int)_main->getConfig()->getValueWithDefault("MinVR/FlightRecorderFrames", 30));
+		if (!_traceFile.empty() || _frameBudget != 0) {
+			setTraceEnabled(true);
+		}
+
+		_refreshPeriod = 1.0 / std::max(1.0f, (float)_main->getConfig()->getValueWithDefault("MinVR/RefreshRate", 90.0f));
+		std::string metricsSocket = _main->getConfig()->getValueWithDefault<std::string>("MinVR/MetricsSocket", "");
+		if (!metricsSocket.empty()) {
+			int windowSeconds = _main->getConfig()->getValueWithDefault("MinVR/MetricsWindowSeconds", 10);
+			_metricsServer.reset(new MetricsServer(_metrics, metricsSocket, windowSeconds));
+		}
+		_startTime = std::chrono::steady_clock::now();
+		_simulationRunning = false;
 	}
 
 	VRMultithreadedApp::~VRMultithreadedApp() {
@@ -28,7 +91,109 @@ namespace MinVR {
 	}
 
 	void VRMultithreadedApp::run() {
-		while (_main->mainloop()) {}
+		_startTime = std::chrono::steady_clock::now();
+		_simulationRunning = true;
+		_simulationThread = std::thread(&VRMultithreadedApp::runSimulation, this);
+		nameTraceThread("main");
+
+		// mainloop() returns once every window has rendered and swapped
+		bool running;
+		bool firstFrame = true;
+		do {
+			uint32_t frame = beginTraceFrame();
+			uint64_t frameBegin = traceNow();
+			{
+				TRACE_SCOPE("onFrameBegin");
+				onFrameBegin();
+			}
+			{
+				TRACE_SCOPE("mainloop");
+				_renderFrame++;
+				running = _main->mainloop();
+			}
+			if (_eventRecorder) {
+				// This frame's events, so a crash loses at most the frame it happened in
+				_eventRecorder->flush();
+			}
+			uint64_t frameEnd = traceNow();
+			if (firstFrame) {
+				firstFrame = false;
+				uint64_t sinceCreated = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+					std::chrono::steady_clock::now() - _createdTime).count();
+				if (isTraceEnabled()) {
+					recordTraceEvent("startup", frameEnd > sinceCreated ? frameEnd - sinceCreated : 1, frameEnd);
+				}
+				if (_reportStartupTime) {
+					std::cout << "First frame done " << sinceCreated / 1e6 << " ms after startup" << std::endl;
+				}
+			}
+			double frameSeconds = (frameEnd - frameBegin) / 1e9;
+			_framesMetric.add();
+			_frameTimeMetric.observe(frameSeconds);
+			// With vsync, a late frame takes a whole number of refreshes
+			int missedRefreshes = (int)(frameSeconds / _refreshPeriod + 0.5) - 1;
+			if (missedRefreshes > 0) {
+				_droppedFramesMetric.add(missedRefreshes);
+			}
+
+			if (isTraceEnabled()) {
+				recordTraceEvent("frame", frameBegin, frameEnd);
+				if (_frameBudget != 0 && frameEnd - frameBegin > _frameBudget) {
+					saveFlightRecording(frame);
+				}
+			}
+		} while (running);
+
+		_simulationRunning = false;
+		_simulationThread.join();
+		if (_flightRecorderThread.joinable()) {
+			_flightRecorderThread.join();
+		}
+		if (!_traceFile.empty()) {
+			writeChromeTrace(_traceFile, snapshotTrace());
+		}
+	}
+
+	void VRMultithreadedApp::saveFlightRecording(uint32_t slowFrame) {
+		// At most one recording per window of frames, so a run of slow frames doesn't turn into a
+		// run of files, and the copying and writing happens off the main thread
+		if (slowFrame < _nextFlightRecording) {
+			return;
+		}
+		_nextFlightRecording = slowFrame + _flightRecorderFrames;
+		if (_flightRecorderThread.joinable()) {
+			_flightRecorderThread.join();
+		}
+
+		uint32_t firstFrame = slowFrame >= _flightRecorderFrames ? slowFrame - _flightRecorderFrames + 1 : 0;
+		_flightRecorderThread = std::thread([firstFrame, slowFrame]() {
+			std::string path = "flight-recorder-" + std::to_string(slowFrame) + ".json";
+			try {
+				writeChromeTrace(path, snapshotTrace(firstFrame, slowFrame));
+			}
+			catch (const std::runtime_error& e) {
+				std::cerr << e.what() << std::endl;
+			}
+		});
+	}
+
+	void VRMultithreadedApp::runSimulation() {
+		typedef std::chrono::steady_clock Clock;
+		const Clock::duration step = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / _simulationRate));
+		const Clock::time_point start = _startTime;
+
+		// Ticks are scheduled from the previous tick rather than from when it finished, so the
+		// rate doesn't drift. If a tick runs long, the ticks it missed are dropped.
+		Clock::time_point nextTick = start;
+		nameTraceThread("simulation");
+		while (_simulationRunning) {
+			{
+				TRACE_SCOPE("updateWorld");
+				updateWorld(std::chrono::duration<double>(Clock::now() - start).count());
+			}
+			nextTick = std::max(nextTick + step, Clock::now());
+			std::this_thread::sleep_until(nextTick);
+		}
 	}
 
 	void VRMultithreadedApp::shutdown() {
@@ -49,43 +214,136 @@ namespace MinVR {
 
 
 	void VRMultithreadedApp::onVREvent(const VRDataIndex &eventData) {
-		std::string type;
-		if (eventData.exists("EventType")) {
-			type = (VRString)eventData.getValue("EventType");
-		}
-		else {
+		TRACE_SCOPE("onVREvent");
+		if (!eventData.exists("EventType")) {
 			VRERROR("VRMultithreadedAppInternal::onVREvent() received an event named " + eventData.getName() + " of unknown type.",
 				"All events should have a data field named EventType but none was found for this event.");
+			return;
 		}
 
-		if (type == "AnalogUpdate") {
-			onAnalogChange(VRAnalogEvent(eventData));
+		std::string type = (VRString)eventData.getValue("EventType");
+		std::unordered_map<std::string, EventType>::const_iterator found = _eventTypes.find(type);
+		if (found == _eventTypes.end()) {
+			VRERROR("VRMultithreadedApp::onVREvent() received an event of unknown type: " + type,
+				"Perhaps an input device that sends a new type of event was rencently added.");
+			return;
 		}
-		else if (type == "ButtonDown") {
-			onButtonDown(VRButtonEvent(eventData));
+		(this->*EVENT_HANDLERS[found->second])(eventData);
+	}
+
+	void VRMultithreadedApp::handleAnalogUpdate(const VRDataIndex &eventData) {
+		VRAnalogEvent event(eventData);
+		if (_eventRecorder) {
+			float value = event.getValue();
+			_eventRecorder->record(getTime(), RecordedEvent::ANALOG_UPDATE, eventData.getName(), false, &value);
 		}
-		else if (type == "ButtonUp") {
-			onButtonUp(VRButtonEvent(eventData));
+		onAnalogChange(event);
+	}
+
+	void VRMultithreadedApp::handleButtonDown(const VRDataIndex &eventData) {
+		if (_eventRecorder) {
+			_eventRecorder->record(getTime(), RecordedEvent::BUTTON_DOWN, eventData.getName(), false, nullptr);
 		}
-		else if (type == "ButtonRepeat") {
-			// intentionally not forwarding ButtonRepeat events since repeats are
-			// not reported consistently on all systems and for VR apps we generally
-			// just listen for downs and ups, it's an automatic repeat if you
-			// have received a down and have not received a corresponding up.
+		onButtonDown(VRButtonEvent(eventData));
+	}
+
+	void VRMultithreadedApp::handleButtonUp(const VRDataIndex &eventData) {
+		if (_eventRecorder) {
+			_eventRecorder->record(getTime(), RecordedEvent::BUTTON_UP, eventData.getName(), false, nullptr);
 		}
-		else if (type == "CursorMove") {
-			onCursorMove(VRCursorEvent(eventData));
+		onButtonUp(VRButtonEvent(eventData));
+	}
+
+	void VRMultithreadedApp::handleButtonRepeat(const VRDataIndex &eventData) {
+		// intentionally not forwarding ButtonRepeat events since repeats are
+		// not reported consistently on all systems and for VR apps we generally
+		// just listen for downs and ups, it's an automatic repeat if you
+		// have received a down and have not received a corresponding up.
+	}
+
+	void VRMultithreadedApp::handleCursorMove(const VRDataIndex &eventData) {
+		onCursorMove(VRCursorEvent(eventData));
+	}
+
+	void VRMultithreadedApp::handleTrackerMove(const VRDataIndex &eventData) {
+		// Stamped on arrival, which is the closest thing to when it was sampled that every device has
+		double time = getTime();
+		std::string name = eventData.getName();
+		const float* transform = VRTrackerEvent(eventData).getTransform();
+		if (_eventRecorder) {
+			_eventRecorder->record(time, RecordedEvent::TRACKER_MOVE, name, isHeadTracker(name), transform);
 		}
-		else if (type == "TrackerMove") {
-			onTrackerMove(VRTrackerEvent(eventData));
+		queueTrackerMove(name, time, transform);
+	}
+
+	void VRMultithreadedApp::queueTrackerMove(const std::string &name, double time, const float* transform) {
+		// Only the newest pose of each tracker is kept until flushTrackerMoves()
+		std::unordered_map<std::string, int>::const_iterator found = _trackerIds.find(name);
+		int id;
+		if (found == _trackerIds.end()) {
+			id = (int)_trackers.size();
+			_trackerIds[name] = id;
+			TrackerState tracker;
+			tracker.id = id;
+			tracker.name = name;
+			tracker.isHead = isHeadTracker(name);
+			_trackers.push_back(tracker);
+			_trackerMoved.push_back(false);
 		}
 		else {
-			VRERROR("VRMultithreadedApp::onVREvent() received an event of unknown type: " + type,
-				"Perhaps an input device that sends a new type of event was rencently added.");
+			id = found->second;
 		}
+
+		_trackers[id].time = time;
+		std::copy(transform, transform + 16, _trackers[id].transform);
+		if (!_trackerMoved[id]) {
+			_trackerMoved[id] = true;
+			_movedTrackers.push_back(id);
+		}
+	}
+
+	bool VRMultithreadedApp::isHeadTracker(const std::string &name) const {
+		return name.substr(0, 4) == headTrackingEventName;
+	}
+
+	double VRMultithreadedApp::getTime() const {
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - _startTime).count();
+	}
+
+	void VRMultithreadedApp::flushTrackerMoves() {
+		TRACE_SCOPE("flushTrackerMoves");
+		// Replayed tracker moves join the live ones once their time has come, with the times
+		// they were recorded at
+		double now = getTime();
+		for (; _nextReplayEvent < _replay.events.size() && _replay.events[_nextReplayEvent].time <= now; _nextReplayEvent++) {
+			const RecordedEvent& event = _replay.events[_nextReplayEvent];
+			if (event.type == RecordedEvent::TRACKER_MOVE) {
+				queueTrackerMove(_replay.names[event.name], event.time, event.data);
+			}
+		}
+
+		for (int id : _movedTrackers) {
+			_trackerMoved[id] = false;
+			onTrackerMove(_trackers[id]);
+		}
+		_movedTrackers.clear();
 	}
 
 	void VRMultithreadedApp::onVRRenderContext(const VRDataIndex &renderData) {
+		nameTraceThread("render");
+		TRACE_SCOPE("onVRRenderContext");
+		RenderThreadState& thread = t_renderThread;
+		uint32_t frame = _renderFrame;
+		if (thread.frame != frame) {
+			thread.frame = frame;
+			thread.context = -1;
+		}
+		thread.context++;
+		thread.scene = -1;
+		if ((int)thread.eyes.size() <= thread.context) {
+			thread.eyes.resize(thread.context + 1);
+		}
+
 		if (renderData.exists("IsGraphics")) {
 			onRenderGraphicsContext(VRGraphicsState(renderData));
 		}
@@ -106,8 +364,20 @@ namespace MinVR {
 
 
 	void VRMultithreadedApp::onVRRenderScene(const VRDataIndex &renderData) {
+		TRACE_SCOPE("onVRRenderScene");
 		if (renderData.exists("IsGraphics")) {
+			RenderThreadState& thread = t_renderThread;
+			std::vector<Eye>& contextEyes = thread.eyes[thread.context];
+			thread.scene++;
+			if ((int)contextEyes.size() <= thread.scene) {
+				std::string eye = renderData.exists("Eye") ? (VRString)renderData.getValue("Eye") : "";
+				contextEyes.push_back(eye == "Left" ? LEFT_EYE : eye == "Right" ? RIGHT_EYE : OTHER_EYE);
+			}
+			thread.eye = contextEyes[thread.scene];
+
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
 			onRenderGraphicsScene(VRGraphicsState(renderData));
+			_eyeSubmitTimeMetrics[thread.eye]->observe(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
 		}
 		else if (renderData.exists("IsAudio")) {
 			// nothing to do, already called onRenderAudio() during onVRRenderContext
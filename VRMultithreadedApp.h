@@ -1,14 +1,59 @@
 #ifndef VRMULTITHREADEDAPP_H_
 #define VRMULTITHREADEDAPP_H_
 
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
 #include <api/MinVR.h>
 #include <main/VRMain.h>
 
-namespace MinVR {
+#include "EventRecording.h"
+#include "Metrics.h"
+#include "MetricsServer.h"
+#include "Trace.h"
 
+namespace MinVR {
 
-/** VRMultithreadedApp is a simple way to create a graphics VR application. */
-class VRMultithreadedApp : public VREventHandler, public VRRenderHandler, public VRModelHandler {
+/** The latest pose of a tracker, as passed to onTrackerMove(). */
+struct TrackerState {
+	int id;              // one per tracker name, the same for the whole run
+	std::string name;
+	bool isHead;         // whether it's the tracker named by MinVR/HeadTrackingEvent
+	double time;         // when the pose arrived, in seconds since run() started
+	float transform[16];
+};
+
+/**
+ * VRMultithreadedApp is a simple way to create a graphics VR application. Input events are
+ * handled on the thread that calls run(), while updateWorld() is called on a simulation thread
+ * of its own at a fixed rate (MinVR/SimulationRate in the config, in Hz), so the cost of one
+ * never shows up in the frame time of the other.
+ *
+ * MinVR owns the graphics contexts and the buffer swap, so the render threads come from the
+ * display graph: put the window nodes under a thread group node and every window renders on
+ * its own thread, with a barrier before the swap. The render callbacks therefore have to be
+ * safe to call for several contexts at once; onFrameBegin() is the place to set up whatever
+ * they share for the frame.
+ *
+ * Frames can be traced (see Trace.h): MinVR/TraceFile in the config saves a Chrome trace of the
+ * last frames when run() returns, and MinVR/FrameBudgetMs saves the last
+ * MinVR/FlightRecorderFrames frames (default 30) to flight-recorder-<frame>.json whenever a
+ * frame takes longer than that. The time from the app being created to its first frame being
+ * done is traced as "startup", and printed if MinVR/ReportStartupTime is 1.
+ *
+ * MinVR/MetricsSocket in the config serves the frame rate, frame times, dropped frames and
+ * the CPU time of each eye's onRenderGraphicsScene(), plus whatever the app adds to
+ * getMetrics(), on a Unix domain socket; see MetricsServer.h. Only the app knows how to time
+ * its draws on the GPU, so that's up to it (getRenderEye() says which eye it's drawing). A frame counts as dropped for every refresh of the display
+ * (MinVR/RefreshRate, in Hz, default 90) it missed.
+ */
+class VRMultithreadedApp : public VREventHandler, public VRRenderHandler {
 	public:
 		/**
 		* VRMultithreadedApp expects command line parameters using the MinVR command line convention.
@@ -33,7 +78,9 @@ class VRMultithreadedApp : public VREventHandler, public VRRenderHandler, public
 
 		virtual void onCursorMove(const VRCursorEvent &state) {}
 
-		virtual void onTrackerMove(const VRTrackerEvent &state) {}
+		/** Called once per frame for each tracker that moved, with only its newest pose, after
+		the frame's other events. Trackers can send far more often than the frame rate. */
+		virtual void onTrackerMove(const TrackerState &state) {}
 
 
 		/** RENDERING CALLBACKS **/
@@ -76,6 +123,11 @@ class VRMultithreadedApp : public VREventHandler, public VRRenderHandler, public
 
 		virtual void onRenderHaptics(const VRHapticsState& state) {}
 
+		/** Called on the thread that calls run() before each frame, while no render callbacks are
+		running. Anything the windows read while rendering should only change here. */
+		virtual void onFrameBegin() {}
+
+		/** Called on the simulation thread, with the time in seconds since run() started. */
 		virtual void updateWorld(double currentTime) {}
 
 
@@ -107,9 +159,100 @@ class VRMultithreadedApp : public VREventHandler, public VRRenderHandler, public
 
 	protected:
 		std::string headTrackingEventName;
+		// How far past the newest head tracker sample to predict the head, roughly the time from
+		// a sample to the photons showing it (MinVR/HeadPredictionMs in the config, default 0)
+		double headPredictionHorizon;
+
+		/** For the app's own metrics, which should be added in its constructor. */
+		MetricsRegistry& getMetrics() { return _metrics; }
+
+		enum Eye { LEFT_EYE, RIGHT_EYE, OTHER_EYE, NUM_EYES }; // OTHER_EYE is anything not stereo
+
+		/** The eye the current onRenderGraphicsScene() call draws. */
+		static Eye getRenderEye() { return t_renderThread.eye; }
+
+		/** Which of its window's onRenderGraphicsScene() calls this frame the current one is. The
+		same display node gets the same index every frame, so it can key per-eye GL objects. */
+		static int getRenderSceneIndex() { return t_renderThread.scene; }
+
+		/** Seconds since run() started. */
+		double getTime() const;
 
 	private:
+		// The EventType strings are looked up once per event and the ID picks the handler
+		enum EventType { ANALOG_UPDATE, BUTTON_DOWN, BUTTON_UP, BUTTON_REPEAT, CURSOR_MOVE, TRACKER_MOVE, NUM_EVENT_TYPES };
+		typedef void (VRMultithreadedApp::*EventHandler)(const VRDataIndex &eventData);
+		static const EventHandler EVENT_HANDLERS[NUM_EVENT_TYPES];
+
+		void handleAnalogUpdate(const VRDataIndex &eventData);
+		void handleButtonDown(const VRDataIndex &eventData);
+		void handleButtonUp(const VRDataIndex &eventData);
+		void handleButtonRepeat(const VRDataIndex &eventData);
+		void handleCursorMove(const VRDataIndex &eventData);
+		void handleTrackerMove(const VRDataIndex &eventData);
+		void queueTrackerMove(const std::string &name, double time, const float* transform);
+		void flushTrackerMoves();
+		bool isHeadTracker(const std::string &name) const;
+
+		// MinVR updates its models once it has handed out all of a frame's events and before it
+		// renders, on the thread that calls run(), so that's where tracker moves are flushed
+		class TrackerFlusher : public VRModelHandler {
+		public:
+			explicit TrackerFlusher(VRMultithreadedApp* app) : _app(app) {}
+			void updateWorld(double currentTime) { _app->flushTrackerMoves(); }
+		private:
+			VRMultithreadedApp* _app;
+		};
+
+		void runSimulation();
+		void saveFlightRecording(uint32_t slowFrame);
+
+		// Where a render thread is in this frame's walk of the display graph. MinVR walks it in
+		// the same order every frame, so the eye of each scene call is looked up by name the
+		// first time through and afterwards found by its place in the walk
+		struct RenderThreadState {
+			uint32_t frame = UINT32_MAX; // _renderFrame as of the thread's last onVRRenderContext
+			int context = -1;            // of the thread's onVRRenderContext calls this frame
+			int scene = -1;              // of the current context's graphics scene calls
+			Eye eye = OTHER_EYE;
+			std::vector<std::vector<Eye>> eyes; // by context, then scene
+		};
+		static thread_local RenderThreadState t_renderThread;
+		std::atomic<uint32_t> _renderFrame{ 0 };     // counts calls to mainloop()
+
 		VRMain * _main;
+
+		int _simulationRate;
+		std::chrono::steady_clock::time_point _createdTime; // before MinVR set up, for the time to the first frame
+		bool _reportStartupTime;                             // MinVR/ReportStartupTime
+		std::chrono::steady_clock::time_point _startTime;
+		std::atomic<bool> _simulationRunning;
+		std::thread _simulationThread;
+
+		std::unordered_map<std::string, EventType> _eventTypes;
+		std::unordered_map<std::string, int> _trackerIds;
+		std::vector<TrackerState> _trackers;        // by id
+		std::vector<int> _movedTrackers;            // since the last flush, in the order they first moved
+		std::vector<bool> _trackerMoved;            // by id
+		TrackerFlusher _trackerFlusher;
+
+		std::unique_ptr<EventRecorder> _eventRecorder; // MinVR/RecordEvents
+		EventRecording _replay;                        // MinVR/ReplayEvents
+		size_t _nextReplayEvent = 0;
+
+		std::string _traceFile;                        // MinVR/TraceFile
+		uint64_t _frameBudget;                         // MinVR/FrameBudgetMs in nanoseconds, 0 for none
+		uint32_t _flightRecorderFrames;                // MinVR/FlightRecorderFrames
+		uint32_t _nextFlightRecording = 0;             // the first frame that may be saved again
+		std::thread _flightRecorderThread;
+
+		MetricsRegistry _metrics;
+		MetricCounter& _framesMetric;
+		MetricCounter& _droppedFramesMetric;
+		MetricHistogram& _frameTimeMetric;
+		MetricHistogram* _eyeSubmitTimeMetrics[NUM_EYES];
+		double _refreshPeriod;                         // MinVR/RefreshRate
+		std::unique_ptr<MetricsServer> _metricsServer; // MinVR/MetricsSocket
 	};
 
 } /* namespace MinVR */
@@ -0,0 +1,102 @@
+#ifndef VIEWCONSTANTS_H_
+#define VIEWCONSTANTS_H_
+
+#include <cstdint>
+
+#include "4DUtils.h"
+
+/**
+ * Everything ColorAt() needs that is the same for every pixel of one view (one eye).
+ * The layout matches the std140 ViewConstants uniform block in shader.frag, so it can be
+ * uploaded as-is with a single glBufferSubData.
+ *
+ * ColorAt() used to invert the projection matrix per pixel and then turn the unprojected
+ * point into a 4D direction with the camera's right/up/forward vectors. Both steps are
+ * linear in the pixel coordinate, so they fold into
+ *     rayDir = rayDirAtOrigin + pixelCoord.x * rayDirPerPixelX + pixelCoord.y * rayDirPerPixelY
+ * (before normalizing).
+ *
+ * The second half is the same view in the camera frame (see cameraFrameRotation()), where
+ * primary rays are intersected with per-view sphere terms; see the camera-frame section of
+ * RayPacket.h and FindClosestPrimaryHit in shader.frag.
+ */
+struct ViewConstants {
+	vec4 userPos;
+	vec4 rayDirAtOrigin;
+	vec4 rayDirPerPixelX;
+	vec4 rayDirPerPixelY;
+	vec2 viewportResolution;
+	int32_t primaryRaysInCameraFrame; // whether the shader's CameraFrameSpheres hold this view's spheres
+	float padding;
+
+	mat4 fromCameraFrame; // the inverse of cameraFrameRotation(); column 0 is the camera position
+	vec4 cameraRayDirAtOrigin; // rayDirAtOrigin etc. rotated into the camera frame, where only y, z, w are used
+	vec4 cameraRayDirPerPixelX;
+	vec4 cameraRayDirPerPixelY;
+};
+
+static_assert(sizeof(ViewConstants) == 192, "ViewConstants must match the std140 layout in shader.frag");
+
+/**
+ * Rotation of the 3-sphere that takes the view's position to (1, 0, 0, 0) and its right, up and
+ * forward directions to the other three axes. The four vectors are re-orthonormalized first,
+ * since they drift slightly as the user moves.
+ */
+inline mat4 cameraFrameRotation(const CurvedWorldPosAndRot& view) {
+	vec4 axes[4] = { view.pos, view.rightDir, view.upDir, view.forwardDir };
+	for (int i = 0; i < 4; i++) {
+		for (int j = 0; j < i; j++) {
+			axes[i] -= dot(axes[i], axes[j]) * axes[j];
+		}
+		axes[i] = normalize(axes[i]);
+	}
+	// Keep it a rotation (SO(4)) rather than a reflection
+	if (determinant(mat4(axes[0], axes[1], axes[2], axes[3])) < 0.0f) {
+		axes[3] = -axes[3];
+	}
+	// Rows are the new axes, so (toCameraFrame * p)[i] = dot(axes[i], p)
+	return transpose(mat4(axes[0], axes[1], axes[2], axes[3]));
+}
+
+inline ViewConstants makeViewConstants(const CurvedWorldPosAndRot& view, const mat4& projectionMat, float width, float height) {
+	mat4 invProjMat = inverse(projectionMat);
+	float near_z = projectionMat[3][2] / (projectionMat[2][2] - 1.0f);
+
+	// The unprojected point for NDC (x, y) is near_z * invProjMat * (x, y, -1, 1)
+	auto toWorldDir = [&](vec4 unprojected) {
+		return (unprojected.x * view.rightDir) + (unprojected.y * view.upDir) + (-unprojected.z * view.forwardDir);
+	};
+
+	ViewConstants constants;
+	constants.userPos = normalize(view.pos);
+	constants.rayDirAtOrigin = toWorldDir(near_z * (-invProjMat[0] - invProjMat[1] - invProjMat[2] + invProjMat[3]));
+	constants.rayDirPerPixelX = toWorldDir(near_z * (2.0f / width) * invProjMat[0]);
+	constants.rayDirPerPixelY = toWorldDir(near_z * (2.0f / height) * invProjMat[1]);
+	constants.viewportResolution = vec2(width, height);
+	constants.primaryRaysInCameraFrame = 1;
+	constants.padding = 0.0f;
+
+	mat4 toCameraFrame = cameraFrameRotation(view);
+	constants.fromCameraFrame = transpose(toCameraFrame);
+	constants.cameraRayDirAtOrigin = toCameraFrame * constants.rayDirAtOrigin;
+	constants.cameraRayDirPerPixelX = toCameraFrame * constants.rayDirPerPixelX;
+	constants.cameraRayDirPerPixelY = toCameraFrame * constants.rayDirPerPixelY;
+	return constants;
+}
+
+/** Unnormalized direction of the ray through pixelCoord (in gl_FragCoord units). */
+inline vec4 rayDirectionAt(const ViewConstants& constants, vec2 pixelCoord) {
+	return constants.rayDirAtOrigin + (pixelCoord.x * constants.rayDirPerPixelX) + (pixelCoord.y * constants.rayDirPerPixelY);
+}
+
+/**
+ * Direction (y, z, w) of the ray through pixelCoord in the camera frame. Dropping x makes it
+ * exactly tangent at the camera; in world space it is fromCameraFrame * vec4(0, direction).
+ */
+inline vec3 cameraRayDirectionAt(const ViewConstants& constants, vec2 pixelCoord) {
+	vec4 direction = constants.cameraRayDirAtOrigin + (pixelCoord.x * constants.cameraRayDirPerPixelX)
+		+ (pixelCoord.y * constants.cameraRayDirPerPixelY);
+	return normalize(vec3(direction.y, direction.z, direction.w));
+}
+
+#endif /* VIEWCONSTANTS_H_ */
@@ -1,6 +1,10 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
-#include <mutex>  // For std::unique_lock
-#include <shared_mutex>
+#include <map>
+#include <memory>
+#include <mutex>
 
 #ifdef _WIN32
 #include "GL/glew.h"
@@ -16,6 +20,7 @@
 #include <GL/gl.h>
 #elif defined(__APPLE__)
 #define GL_GLEXT_PROTOTYPES
+#include <OpenGL/OpenGL.h>
 #include <OpenGL/gl3.h>
 #include <OpenGL/glext.h>
 #else
@@ -43,6 +48,25 @@ using namespace glm;
 
 #include "VRMultithreadedApp.h"
 #include "4DUtils.h"
+#include "ViewConstants.h"
+#include "BinaryScene.h"
+#include "DirtyRanges.h"
+#include "Scene.h"
+#include "SceneBuffers.h"
+#include "SceneStreamer.h"
+#include "TripleBuffer.h"
+#include "UserHead.h"
+
+// Identifies the GL context that is current on this thread
+static const void* currentGLContext() {
+#if defined(_WIN32)
+	return wglGetCurrentContext();
+#elif defined(__APPLE__)
+	return CGLGetCurrentContext();
+#else
+	return glXGetCurrentContext();
+#endif
+}
 
 struct CameraInfo {
 	mat4 previousRealWorldViewMatrix;
@@ -61,6 +85,31 @@ struct CameraInfo {
 class MyVRApp : public VRMultithreadedApp {
 public:
     MyVRApp(int argc, char** argv) : VRMultithreadedApp(argc, argv) {
+		// MinVR leaves any arguments it doesn't recognize for us
+		int leftoverArgc = getLeftoverArgc();
+		char** leftoverArgv = getLeftoverArgv();
+		_scene = makeDefaultScene();
+		for (int i = 1; i < leftoverArgc; i++) {
+			if (std::string(leftoverArgv[i]) == "--scene" && i + 1 < leftoverArgc) {
+				std::string scenePath = leftoverArgv[++i];
+				if (isBinaryScenePath(scenePath)) {
+					// Too big to load up front; only the cells around the user are streamed in
+					_mappedScene.reset(new MappedScene(scenePath));
+					_sceneStreamer.reset(new SceneStreamer(*_mappedScene));
+					_sceneStreamer->setViewerPosition(initialUserState.pos);
+				}
+				else {
+					_scene = loadScene(scenePath);
+				}
+			}
+		}
+		_sceneSpheres = _mappedScene ? _mappedScene->getFixedBuffers().spheres : packSceneBuffers(_scene).spheres;
+
+		const char* eyes[NUM_EYES] = { "left", "right", "other" };
+		for (int eye = 0; eye < NUM_EYES; eye++) {
+			_eyeGPUTimeMetrics[eye] = &getMetrics().addHistogram("raytracer_eye_gpu_seconds",
+				"GPU time spent drawing one eye of one window, read back a few frames later", std::string("eye=\"") + eyes[eye] + "\"");
+		}
     }
 
 
@@ -76,19 +125,12 @@ public:
     
     void onCursorMove(const VRCursorEvent &state) {}
     
-	bool firstTime = true;
-	bool moved = false;
-
-    void onTrackerMove(const VRTrackerEvent &state) {
-		if (state.getName().substr(0, 4) == headTrackingEventName) {
-			curHeadMatrix = make_mat4(state.getTransform());
-			if (firstTime) {
-				firstTime = false;
-				prevHeadMatrix = curHeadMatrix;
-			}
-			else {
-				moved = true;
-			}
+    void onTrackerMove(const TrackerState &state) {
+		if (state.isHead) {
+			// Picked up by updateWorld on the simulation thread
+			_headSamples.write({ state.time, make_mat4(state.transform) });
+			// MinVR's eyes this frame hang off this same pose
+			_minvrHeadMatrix = make_mat4(state.transform);
 		}
 	}
     
@@ -98,23 +140,84 @@ public:
     
     void onRenderConsole(const VRConsoleState& state) {}
 
+	// Runs on the simulation thread; userHead belongs to it
 	void updateWorld(double currentTime) {
-		if (moved) {
-			changeByMatrixDifference(prevHeadMatrix, curHeadMatrix, USER_SCALE, &userState);
-			prevHeadMatrix = curHeadMatrix;
-			moved = false;
+		bool headMoved = _headSamples.update();
+		if (!headMoved && _scene.motions.empty()) {
+			return;
+		}
+
+		if (headMoved) {
+			const HeadSample& sample = _headSamples.readBuffer();
+			userHead.addSample(sample.time, sample.matrix);
+			CurvedWorldPosAndRot userState = userHead.getUserState();
+			_headPoses.writeBuffer() = { userState, userHead.getHeadMatrix(), userHead.getHeadPrediction(), sample.time };
+			_headPoses.publish();
+			if (_sceneStreamer) {
+				_sceneStreamer->setViewerPosition(userState.pos);
+			}
+		}
+
+		if (!_scene.motions.empty()) {
+			SimulationState& published = _simulationStates.writeBuffer();
+			// The write buffers are reused, so after the first few ticks this doesn't allocate
+			published.movingSphereCenters.resize(_scene.motions.size());
+			for (size_t i = 0; i < _scene.motions.size(); i++) {
+				published.movingSphereCenters[i] = _scene.motions[i].centerAt(currentTime);
+			}
+			_simulationStates.publish();
+		}
+	}
+
+	// Called on the main thread before every frame, while no render callbacks are running.
+	// Everything the windows share during the frame is picked up here, so they all draw the
+	// same frame and only ever read it.
+	void onFrameBegin() {
+		_frameDirtySpheres.clear();
+
+		// Every eye of every window draws from the same head pose
+		if (_headPoses.update()) {
+			_frameHeadPose = _headPoses.readBuffer();
+		}
+
+		if (_simulationStates.update()) {
+			const SimulationState& simulationState = _simulationStates.readBuffer();
+			for (size_t i = 0; i < _scene.motions.size(); i++) {
+				int sphere = _scene.motions[i].sphereIndex;
+				_sceneSpheres[sphere].center = simulationState.movingSphereCenters[i];
+				_frameDirtySpheres.add(sphere, sphere + 1);
+			}
+		}
+
+		// Never waits on the streaming thread; the spheres are swapped in whenever they're ready
+		if (_sceneStreamer && _sceneStreamer->takeUpdate(_sceneSpheres)) {
+			_frameDirtySpheres.add(0, _sceneSpheres.size());
 		}
 	}
 
     void onRenderGraphicsContext(const VRGraphicsState& state) {
+		// With a thread group in the MinVR config every window calls this on a thread of its
+		// own, so all GL objects are per context; see RenderContext
         // If this is the inital call, initialize context variables
 		if (state.isInitialRenderCall()) {
+			{
+				std::lock_guard<std::mutex> lock(_contextsMutex);
+				std::unique_ptr<RenderContext>& context = _contexts[currentGLContext()];
+				context.reset(new RenderContext());
+				t_currentContext = context.get();
+			}
+			RenderContext& context = *t_currentContext;
+
 #ifndef __APPLE__
-			glewExperimental = GL_TRUE;
-			GLenum err = glewInit();
-			if (GLEW_OK != err)
 			{
-				std::cout << "Error initializing GLEW." << std::endl;
+				// glewInit sets global function pointers
+				std::lock_guard<std::mutex> lock(_contextsMutex);
+				glewExperimental = GL_TRUE;
+				GLenum err = glewInit();
+				if (GLEW_OK != err)
+				{
+					std::cout << "Error initializing GLEW." << std::endl;
+				}
 			}
 #endif
 			// Init GL
@@ -135,14 +238,14 @@ public:
 
 			const int cpuVertexByteSize = sizeof(float[3]) * cpuVertexArray.size();
 			const int cpuIndexByteSize = sizeof(int) * cpuIndexArray.size();
-			_numIndices = cpuIndexArray.size();
+			context.numIndices = cpuIndexArray.size();
 
-			glGenVertexArrays(1, &_vaoID);
-			glBindVertexArray(_vaoID);
+			glGenVertexArrays(1, &context.vaoID);
+			glBindVertexArray(context.vaoID);
 
 			// create the vbo
-			glGenBuffers(1, &_vertexVBO);
-			glBindBuffer(GL_ARRAY_BUFFER, _vertexVBO);
+			glGenBuffers(1, &context.vertexVBO);
+			glBindBuffer(GL_ARRAY_BUFFER, context.vertexVBO);
 
 			// initialize size
 			glBufferData(GL_ARRAY_BUFFER, cpuVertexByteSize, NULL, GL_STATIC_DRAW);
@@ -153,8 +256,8 @@ public:
 			glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(float[3]), (void*)0);
 
 			// Create indexstream
-			glGenBuffers(1, &_indexVBO);
-			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _indexVBO);
+			glGenBuffers(1, &context.indexVBO);
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, context.indexVBO);
 
 			// copy data into the buffer object
 			glBufferData(GL_ELEMENT_ARRAY_BUFFER, cpuIndexByteSize, NULL, GL_STATIC_DRAW);
@@ -165,60 +268,114 @@ public:
 			GLuint fshader = loadAndCompileShader("shader.frag", GL_FRAGMENT_SHADER);
             
             // Create shader program
-			_programHandle = glCreateProgram();
-            glAttachShader(_programHandle, vshader);
-            glAttachShader(_programHandle, fshader);
-            linkShaderProgram(_programHandle);
-			glUseProgram(_programHandle);
+			context.programHandle = glCreateProgram();
+            glAttachShader(context.programHandle, vshader);
+            glAttachShader(context.programHandle, fshader);
+            linkShaderProgram(context.programHandle);
+			glUseProgram(context.programHandle);
+
+			// One uniform buffer holds everything per-eye; see ViewConstants.h
+			GLuint viewConstantsIndex = glGetUniformBlockIndex(context.programHandle, "ViewConstants");
+			glUniformBlockBinding(context.programHandle, viewConstantsIndex, VIEW_CONSTANTS_BINDING);
+
+			glGenBuffers(1, &context.viewConstantsUBO);
+			glBindBuffer(GL_UNIFORM_BUFFER, context.viewConstantsUBO);
+			glBufferData(GL_UNIFORM_BUFFER, sizeof(ViewConstants), NULL, GL_DYNAMIC_DRAW);
+			glBindBufferBase(GL_UNIFORM_BUFFER, VIEW_CONSTANTS_BINDING, context.viewConstantsUBO);
+
+			// Materials and lights are uploaded once; spheres can move, so they go in a ring of
+			// buffers that is updated every frame (see updateSphereRing). See SceneBuffers.h
+			SceneBuffers sceneBuffers = _mappedScene ? _mappedScene->getFixedBuffers() : packSceneBuffers(_scene);
+			glGenBuffers(2, context.sceneSSBOs);
+			uploadStorageBuffer(context.sceneSSBOs[0], SCENE_MATERIALS_BINDING, sceneBuffers.materials);
+			uploadStorageBuffer(context.sceneSSBOs[1], SCENE_LIGHTS_BINDING, sceneBuffers.lights);
+#if defined(GL_MAP_PERSISTENT_BIT) && !defined(__APPLE__)
+			context.sphereRing.persistent = GLEW_ARB_buffer_storage;
+#endif
+			createSphereRing(context.sphereRing, _sceneSpheres.size());
 
-			viewportResolutionLocation = glGetUniformLocation(_programHandle, "viewportResolution");
-			projectionMatLocation = glGetUniformLocation(_programHandle, "projectionMat");
+			// Refilled for every eye; see onRenderGraphicsScene
+			glGenBuffers(1, &context.cameraFrameSpheresSSBO);
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CAMERA_FRAME_SPHERES_BINDING, context.cameraFrameSpheresSSBO);
+        }
+		else {
+			std::lock_guard<std::mutex> lock(_contextsMutex);
+			t_currentContext = _contexts[currentGLContext()].get();
+		}
+		RenderContext& context = *t_currentContext;
 
-			userPosLocation = glGetUniformLocation(_programHandle, "userPos");
-			userForwardDirLocation = glGetUniformLocation(_programHandle, "userForwardDir");
-			userUpDirLocation = glGetUniformLocation(_programHandle, "userUpDir");
-			userRightDirLocation = glGetUniformLocation(_programHandle, "userRightDir");
+		// This runs once per window per frame, before the per-eye calls, so it picks up resizes
+		// without a string lookup per eye
+		context.framebufferWidth = state.index().getValue("FramebufferWidth");
+		context.framebufferHeight = state.index().getValue("FramebufferHeight");
 
-			testRotationMethods();
-        }
+		updateSphereRing(context.sphereRing);
+		context.sphereSlotCurrent = context.sphereRing.dirty[context.sphereRing.slot].empty();
     }
     
 	void onRenderGraphicsScene(const VRGraphicsState& state) {
+		RenderContext& context = *t_currentContext;
 
 		//changeMatrix is a view matrix from the old matrix to the new one
 		mat4 viewMatrix = make_mat4(state.getViewMatrix());
-		CurvedWorldPosAndRot thisViewPosAndRot = userState;
-		changeByMatrixDifference(curHeadMatrix, inverse(viewMatrix), USER_SCALE, &thisViewPosAndRot);
+		// MinVR's view is of its own head pose, from this frame's events, while userState was
+		// worked out from the simulation's, which can be older. Only the eye's offset from the head
+		// is taken from MinVR and goes on top of the simulation's pose, so the eye is drawn from
+		// exactly the head pose userState belongs to.
+		const HeadPose& headPose = _frameHeadPose;
+		if (headPose.sampleTime >= 0.0) {
+			_trackerToRenderMetric.observe(getTime() - headPose.sampleTime);
+		}
+		mat4 headToEye = rigidInverse(_minvrHeadMatrix) * rigidInverse(viewMatrix);
+		mat4 eyeMatrix = headPose.headPrediction * headPose.headMatrix * headToEye;
+		CurvedWorldPosAndRot thisViewPosAndRot = headPose.userState;
+		changeByMatrixDifference(headPose.headMatrix, eyeMatrix, USER_SCALE, &thisViewPosAndRot);
 
 		// Setup uniforms
-		GLfloat windowHeight = state.index().getValue("FramebufferHeight");
-		GLfloat windowWidth = state.index().getValue("FramebufferWidth");
-		glUniform2f(viewportResolutionLocation, windowWidth, windowHeight);
-
 		mat4 projectionMat = make_mat4(state.getProjectionMatrix());
-		setUniform(projectionMatLocation, projectionMat, GL_FALSE);
-
-		setUniform(userPosLocation, thisViewPosAndRot.pos);
-		setUniform(userForwardDirLocation, thisViewPosAndRot.forwardDir);
-		setUniform(userUpDirLocation, thisViewPosAndRot.upDir);
-		setUniform(userRightDirLocation, thisViewPosAndRot.rightDir);
+		ViewConstants viewConstants = makeViewConstants(thisViewPosAndRot, projectionMat, context.framebufferWidth, context.framebufferHeight);
+
+		// Primary rays are intersected in the camera frame, with the per-view sphere terms worked
+		// out here once instead of per pixel. They have to match the spheres the shader shades
+		// with, so while the sphere ring is a frame behind the shader stays in world space.
+		viewConstants.primaryRaysInCameraFrame = context.sphereSlotCurrent;
+		if (context.sphereSlotCurrent) {
+			TRACE_SCOPE("cameraFrameSpheres");
+			packCameraFrameSpheres(_sceneSpheres, viewConstants.userPos, transpose(viewConstants.fromCameraFrame), context.cameraFrameSpheres);
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, context.cameraFrameSpheresSSBO);
+			// Orphaned every eye, so this never waits for the GPU to finish with the last eye's
+			glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GPUCameraFrameSphere) * context.cameraFrameSpheres.size(),
+				context.cameraFrameSpheres.data(), GL_STREAM_DRAW);
+		}
+		glBindBuffer(GL_UNIFORM_BUFFER, context.viewConstantsUBO);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(ViewConstants), &viewConstants);
 
 		// Render
-		glDrawElements(GL_TRIANGLE_STRIP, _numIndices, GL_UNSIGNED_INT, 0);
+		{
+			TRACE_SCOPE("draw");
+			GLuint timerQuery = nextEyeTimerQuery(context);
+			if (timerQuery != 0) {
+				glBeginQuery(GL_TIME_ELAPSED, timerQuery);
+			}
+			glDrawElements(GL_TRIANGLE_STRIP, context.numIndices, GL_UNSIGNED_INT, 0);
+			if (timerQuery != 0) {
+				glEndQuery(GL_TIME_ELAPSED);
+			}
+		}
+		_raysMetric.add((uint64_t)context.framebufferWidth * context.framebufferHeight);
 
 	}
     
     
     void onRenderHaptics(const VRHapticsState& state) {}
 
-	void setUniform(GLint location, glm::mat4& matrix, GLboolean transpose) {
-		glUniformMatrix4fv(location, 1, transpose, &(matrix[0][0]));
+	template <typename T>
+	void uploadStorageBuffer(GLuint buffer, GLuint binding, const std::vector<T>& data) {
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(T) * data.size(), data.data(), GL_STATIC_DRAW);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, buffer);
 	}
 
-	void setUniform(GLint location, vec4 vector) {
-		glUniform4f(location, vector.x, vector.y, vector.z, vector.w);
-	}
-    
 	GLuint loadAndCompileShader(const std::string& pathToFile, GLuint shaderType) {
 		std::ifstream inFile(pathToFile, std::ios::in);
 		if (!inFile) {
@@ -269,27 +426,281 @@ public:
 	}
 
 private:
-	GLuint _vaoID;
-	GLuint _vertexVBO;
-	GLuint _indexVBO;
-	GLsizei _numIndices;
-	GLuint _programHandle;
-
-	GLint viewportResolutionLocation;
-	GLint projectionMatLocation;
-	GLint userPosLocation;
-	GLint userForwardDirLocation;
-	GLint userUpDirLocation;
-	GLint userRightDirLocation;
+	// Copying a few spheres that didn't change is cheaper than another flush
+	static const size_t DIRTY_SPHERE_MERGE_GAP = 8;
+
+	// The sphere storage buffer of one context, as a ring of slots; see updateSphereRing
+	struct SphereRing {
+		static const int MAX_SLOTS = 3;
+
+		GLuint buffer = 0;
+		bool persistent = false;
+		unsigned char* mapping = nullptr; // all slots, while persistent
+		size_t capacity = 0; // spheres per slot
+		size_t slotStride = 0; // bytes
+		int numSlots = 1;
+
+		int slot = 0; // the slot being drawn from
+		size_t slotSizes[MAX_SLOTS] = {};
+		GLsync fences[MAX_SLOTS] = {}; // signalled once the GPU is done with a slot we moved off
+		DirtyRanges dirty[MAX_SLOTS] = { DIRTY_SPHERE_MERGE_GAP, DIRTY_SPHERE_MERGE_GAP, DIRTY_SPHERE_MERGE_GAP }; // changed since the slot was written
+	};
+
+	// GL_TIME_ELAPSED queries around one display node's draws, used in turn; see nextEyeTimerQuery
+	struct EyeTimer {
+		static const int NUM_QUERIES = 3;
+
+		GLuint queries[NUM_QUERIES] = {};
+		bool pending[NUM_QUERIES] = {}; // issued and not read back yet
+		int next = 0;
+	};
+
+	// Everything that belongs to one graphics context (window)
+	struct RenderContext {
+		GLuint vaoID;
+		GLuint vertexVBO;
+		GLuint indexVBO;
+		GLsizei numIndices;
+		GLuint programHandle;
+
+		GLuint viewConstantsUBO;
+		GLuint sceneSSBOs[2]; // materials, lights
+		SphereRing sphereRing;
+		bool sphereSlotCurrent = false; // whether the bound sphere slot holds this frame's _sceneSpheres
+
+		GLuint cameraFrameSpheresSSBO;
+		std::vector<GPUCameraFrameSphere> cameraFrameSpheres; // the last eye's; kept to reuse the allocation
+
+		std::vector<EyeTimer> eyeTimers; // by getRenderSceneIndex()
+
+		GLfloat framebufferWidth = 0;
+		GLfloat framebufferHeight = 0;
+	};
+
+	/**
+	 * Makes a sphere ring with room for capacity spheres per slot, all of them dirty. With
+	 * ARB_buffer_storage the slots live in one buffer that stays mapped for good; without it
+	 * there is a single slot updated with glBufferSubData.
+	 */
+	void createSphereRing(SphereRing& ring, size_t capacity) {
+		if (ring.buffer != 0) {
+			// GL keeps the old buffer alive until the GPU is done with it
+			if (ring.mapping) {
+				glBindBuffer(GL_SHADER_STORAGE_BUFFER, ring.buffer);
+				glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+			}
+			glDeleteBuffers(1, &ring.buffer);
+			for (GLsync& fence : ring.fences) {
+				if (fence) {
+					glDeleteSync(fence);
+					fence = 0;
+				}
+			}
+		}
 
-	float USER_SCALE = 1;
+		ring.capacity = std::max<size_t>(capacity, 1);
+		glGenBuffers(1, &ring.buffer);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, ring.buffer);
+#if defined(GL_MAP_PERSISTENT_BIT) && !defined(__APPLE__)
+		if (ring.persistent) {
+			GLint alignment = 1;
+			glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+			ring.slotStride = (ring.capacity * sizeof(GPUSphere) + alignment - 1) / alignment * alignment;
+			ring.numSlots = SphereRing::MAX_SLOTS;
+
+			GLsizeiptr size = ring.slotStride * ring.numSlots;
+			glBufferStorage(GL_SHADER_STORAGE_BUFFER, size, nullptr, GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT);
+			ring.mapping = (unsigned char*)glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, size,
+				GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_FLUSH_EXPLICIT_BIT);
+			if (!ring.mapping) {
+				throw std::runtime_error("could not map the sphere buffer");
+			}
+		}
+		else
+#endif
+		{
+			ring.slotStride = ring.capacity * sizeof(GPUSphere);
+			ring.numSlots = 1;
+			ring.mapping = nullptr;
+			glBufferData(GL_SHADER_STORAGE_BUFFER, ring.slotStride, nullptr, GL_DYNAMIC_DRAW);
+		}
+
+		for (int slot = 0; slot < ring.numSlots; slot++) {
+			ring.dirty[slot].clear();
+			ring.dirty[slot].add(0, _sceneSpheres.size());
+		}
+		writeSphereSlot(ring, 0);
+		ring.slot = 0;
+		bindSphereSlot(ring);
+	}
+
+	/**
+	 * Brings the sphere buffer up to date with _sceneSpheres, copying only what changed. The
+	 * slot the GPU may still be reading is never written: changes go into the next slot, and
+	 * if the GPU hasn't finished with that one either this frame keeps drawing from the
+	 * current slot, one frame behind, rather than waiting.
+	 */
+	void updateSphereRing(SphereRing& ring) {
+		if (_sceneSpheres.size() > ring.capacity) {
+			// Streaming brought in more spheres than fit, so start over with room to grow
+			createSphereRing(ring, _sceneSpheres.size() + _sceneSpheres.size() / 2);
+			return;
+		}
+		for (int slot = 0; slot < ring.numSlots; slot++) {
+			ring.dirty[slot].add(_frameDirtySpheres);
+		}
+
+		if (ring.numSlots == 1) {
+			writeSphereSlot(ring, 0);
+			bindSphereSlot(ring);
+			return;
+		}
+
+		if (ring.dirty[ring.slot].empty()) {
+			return;
+		}
+		int next = (ring.slot + 1) % ring.numSlots;
+		if (ring.fences[next]) {
+			GLenum status = glClientWaitSync(ring.fences[next], 0, 0);
+			if (status == GL_TIMEOUT_EXPIRED) {
+				return;
+			}
+			glDeleteSync(ring.fences[next]);
+			ring.fences[next] = 0;
+		}
+
+		writeSphereSlot(ring, next);
+		// Everything that reads the slot being left has been submitted by now
+		ring.fences[ring.slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		ring.slot = next;
+		bindSphereSlot(ring);
+	}
+
+	void writeSphereSlot(SphereRing& ring, int slot) {
+		size_t slotOffset = ring.slotStride * slot;
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, ring.buffer);
+		for (const DirtyRanges::Range& range : ring.dirty[slot].get()) {
+			size_t end = std::min(range.end, _sceneSpheres.size());
+			if (range.begin >= end) {
+				continue;
+			}
+			size_t offset = slotOffset + range.begin * sizeof(GPUSphere);
+			size_t size = (end - range.begin) * sizeof(GPUSphere);
+			if (ring.mapping) {
+				memcpy(ring.mapping + offset, &_sceneSpheres[range.begin], size);
+				glFlushMappedBufferRange(GL_SHADER_STORAGE_BUFFER, offset, size);
+			}
+			else {
+				glBufferSubData(GL_SHADER_STORAGE_BUFFER, offset, size, &_sceneSpheres[range.begin]);
+			}
+		}
+		ring.dirty[slot].clear();
+		ring.slotSizes[slot] = _sceneSpheres.size();
+	}
+
+	/**
+	 * Reads back whichever of the current eye's earlier draw timings the GPU has finished, and
+	 * returns a query to time this draw with, or 0 if they are all still in flight. Never waits
+	 * for the GPU.
+	 */
+	GLuint nextEyeTimerQuery(RenderContext& context) {
+		size_t scene = (size_t)getRenderSceneIndex();
+		if (context.eyeTimers.size() <= scene) {
+			context.eyeTimers.resize(scene + 1);
+		}
+		EyeTimer& timer = context.eyeTimers[scene];
+		if (timer.queries[0] == 0) {
+			glGenQueries(EyeTimer::NUM_QUERIES, timer.queries);
+		}
+
+		for (int i = 0; i < EyeTimer::NUM_QUERIES; i++) {
+			if (!timer.pending[i]) {
+				continue;
+			}
+			GLint available = GL_FALSE;
+			glGetQueryObjectiv(timer.queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (available) {
+				GLuint64 nanoseconds = 0;
+				glGetQueryObjectui64v(timer.queries[i], GL_QUERY_RESULT, &nanoseconds);
+				_eyeGPUTimeMetrics[getRenderEye()]->observe(nanoseconds / 1e9);
+				timer.pending[i] = false;
+			}
+		}
+
+		// Skipped rather than waited for when the GPU is this far behind
+		if (timer.pending[timer.next]) {
+			return 0;
+		}
+		GLuint query = timer.queries[timer.next];
+		timer.pending[timer.next] = true;
+		timer.next = (timer.next + 1) % EyeTimer::NUM_QUERIES;
+		return query;
+	}
+
+	void bindSphereSlot(const SphereRing& ring) {
+		// The shader gets the sphere count from the size of the bound range
+		glBindBufferRange(GL_SHADER_STORAGE_BUFFER, SCENE_SPHERES_BINDING, ring.buffer,
+			ring.slotStride * ring.slot, std::max<size_t>(ring.slotSizes[ring.slot], 1) * sizeof(GPUSphere));
+	}
 
-	mat4 curHeadMatrix = mat4(1.0);
-	mat4 prevHeadMatrix = mat4(1.0);
+	std::mutex _contextsMutex;
+	std::map<const void*, std::unique_ptr<RenderContext>> _contexts;
+	// The context of this thread's last onRenderGraphicsContext, for the per-eye calls that follow it
+	static thread_local RenderContext* t_currentContext;
 
-	CurvedWorldPosAndRot userState = { vec4(0,1,0,0), vec4(1,0,0,0), vec4(0,0,0,1), vec4(0,0,1,0) };
+	static const GLuint VIEW_CONSTANTS_BINDING = 0;
+
+	// Read-only while rendering; only changed in the constructor and onFrameBegin
+	Scene _scene;
+	std::unique_ptr<MappedScene> _mappedScene;
+	std::unique_ptr<SceneStreamer> _sceneStreamer;
+	// The spheres as the shader sees them. Only changed in onFrameBegin, along with
+	// _frameDirtySpheres, and read by every context while rendering
+	std::vector<GPUSphere> _sceneSpheres;
+	DirtyRanges _frameDirtySpheres{ DIRTY_SPHERE_MERGE_GAP };
+
+	float USER_SCALE = 1;
+
+	const CurvedWorldPosAndRot initialUserState = { vec4(0,1,0,0), vec4(1,0,0,0), vec4(0,0,0,1), vec4(0,0,1,0) };
+	// Simulation thread only
+	UserHead userHead{ initialUserState, USER_SCALE, headPredictionHorizon };
+
+	struct HeadSample {
+		double time; // seconds since run() started
+		mat4 matrix;
+	};
+
+	// What the eyes need of the UserHead, as of the simulation's latest head sample
+	struct HeadPose {
+		CurvedWorldPosAndRot userState;
+		mat4 headMatrix;
+		mat4 headPrediction;
+		double sampleTime; // of the head sample, or negative before the first one
+	};
+
+	// What onFrameBegin picks up from the simulation for the whole frame
+	struct SimulationState {
+		std::vector<vec4> movingSphereCenters; // same order as Scene::motions
+	};
+
+	// Event thread -> simulation thread, and simulation thread -> onFrameBegin
+	TripleBuffer<HeadSample> _headSamples{ { 0.0, mat4(1.0) } };
+	TripleBuffer<HeadPose> _headPoses{ { initialUserState, mat4(1.0), mat4(1.0), -1.0 } };
+	// Only changed in onFrameBegin, and read by every eye while rendering
+	HeadPose _frameHeadPose{ initialUserState, mat4(1.0), mat4(1.0), -1.0 };
+	// The latest head tracker pose, as MinVR sees it; only changed while events are handled,
+	// before the frame is drawn
+	mat4 _minvrHeadMatrix{ 1.0 };
+	TripleBuffer<SimulationState> _simulationStates;
+
+	MetricCounter& _raysMetric{ getMetrics().addCounter("raytracer_rays", "Primary rays traced, one per pixel of each eye") };
+	MetricHistogram& _trackerToRenderMetric{ getMetrics().addHistogram("raytracer_tracker_to_render_seconds",
+		"Time from a head tracker pose arriving to an eye being drawn from it") };
+	MetricHistogram* _eyeGPUTimeMetrics[NUM_EYES];
 };
 
+thread_local MyVRApp::RenderContext* MyVRApp::t_currentContext = nullptr;
+
 /// Main method which creates and calls application
 int main(int argc, char **argv) {
 	MyVRApp app(argc, argv);
@@ -1,12 +1,23 @@
-#version 330
+#version 430
 
-uniform vec2 viewportResolution; // viewport resolution (in pixels)
-uniform mat4 projectionMat;
-
-uniform vec4 userPos;
-uniform vec4 userForwardDir;
-uniform vec4 userUpDir;
-uniform vec4 userRightDir;
+//Everything about the current eye that is the same for every pixel. Filled in on the CPU by
+//makeViewConstants() (ViewConstants.h), which folds the inverse projection and the user's
+//right/up/forward vectors into a direction that is linear in the pixel coordinate.
+layout(std140) uniform ViewConstants
+{
+    vec4 userPos; //already normalized
+    vec4 rayDirAtOrigin;
+    vec4 rayDirPerPixelX;
+    vec4 rayDirPerPixelY;
+    vec2 viewportResolution; // viewport resolution (in pixels)
+    int primaryRaysInCameraFrame; //whether cameraSpheres below hold this view's spheres
+
+    //The same view rotated so the camera is at (1, 0, 0, 0); see FindClosestPrimaryHit
+    mat4 fromCameraFrame;
+    vec4 cameraRayDirAtOrigin; //only y, z and w are used
+    vec4 cameraRayDirPerPixelX;
+    vec4 cameraRayDirPerPixelY;
+};
 
 in vec4 gl_FragCoord;
 out vec4 fragColor;
@@ -29,9 +40,7 @@ const int REFLECTION_COUNT = 4;
 const float REFLECTANCE = 0.6;
 
 const bool LIGHTING_ENABLED = true;
-const float LIGHT_INTENSITY = 0.5;
 const float AMBIENT_LIGHT = 0.1;
-const vec4 LIGHT_POSITION = normalize(vec4(1.,0.,0., 0.25));
 
 const vec3 BACKGROUND_COLOR = vec3(0);
 const bool USER_SPHERE_VISIBLE = false;
@@ -47,11 +56,6 @@ float GeodesicDistance(vec4 p1, vec4 p2)
     return acos(clamp(dotProd, -1.0, 1.0));
 }
 
-float AngleFromGeodesicDistance(float dist)
-{
-    return dist;
-}
-
 vec4 Reflect(vec4 normal, vec4 dir)
 {
     vec4 n = normalize(normal);
@@ -100,63 +104,65 @@ Ray RayFromAToB(vec4 from, vec4 to)
 
 /////////////////////////////////// HIT ///////////////////////////////////
 
+//Intersection only finds out which object is hit and where; everything else about the
+//surface is worked out afterwards, for the closest hit only (see ShadeSphereHit).
 struct Hit
 {
-    bool isHit;
     float dist;
+    int objectIndex; //-1 if nothing was hit
+};
+const Hit NO_HIT = Hit(99999999999999., -1);
+
+struct Surface
+{
+    vec4 position;
     vec4 normal;
     vec3 color;
-    
-    bool hasReflection;
-    Ray reflectedRay;
 };
-Hit NO_HIT = Hit(false, -1., vec4(0.0), vec3(1.0, 0., 1.0), false, Ray(vec4(0), vec4(0)));
-Hit HitWithoutReflection(bool isHit, float dist, vec4 normal, vec3 color)
-{
-    return Hit(isHit, dist, normal, color, false, Ray(vec4(0), vec4(0)));
-}
     
 
 ////////////////////////////////// SPHERE /////////////////////////////////
 
+//The layouts of Sphere, Material and Light match GPUSphere, GPUMaterial and GPULight in
+//SceneBuffers.h, which main.cpp uploads from the loaded scene.
+const uint SPHERE_VISIBLE_FROM_INSIDE = 1u;
+
 struct Sphere
 {
     vec4 center;
     float radius;
+    float cosRadius;
+    int materialIndex;
+    uint flags;
+};
+
+const uint MATERIAL_CHECKERBOARD = 1u;
+const uint MATERIAL_REFLECTIVE = 2u;
+
+struct Material
+{
     vec3 color;
-    
-    bool hasCheckerboardPattern;
-    bool isReflective;
-    bool visibleFromInside;
+    uint flags;
+};
+
+struct Light
+{
+    vec4 position;
+    float intensity;
+    int sphereIndex; //the sphere drawn at the light, which is always fully lit, or -1
 };
    
-Hit SphereHit(Sphere sphere, Ray ray)
+//The part of SphereHitDistance after A, B and C (see below) are known. hiddenFromInside is
+//whether the ray starts inside a sphere that isn't visible from inside.
+float HitDistanceFromPlaneTerms(float A, float B, float C, bool hiddenFromInside)
 {
-    //A circle on the surface of a 3D sphere can be defined as the intersection
-    //of a plane and a sphere (and conversely, the intersection of a plane and a
-    //sphere will always generate a circle on the surface of the sphere)
-    //
-    //Similarly, intersecting a 3-dimensional "hyperplane" with a 4D sphere gets you
-    //a sphere within the surface of the 4D sphere. We can use this to determine intersection.
-    //Instead of trying to calculate the intersection of the ray and the sphere, we calculate
-    //the intersection of the ray and the hyperplane that would generate the sphere if it 
-    //intersected the 4D sphere.
-    
-    float angle = AngleFromGeodesicDistance(sphere.radius);
-    vec4 volumeNormal = sphere.center;
-    vec4 volumeNormalCenter = sphere.center * cos(angle);
-    
-    float A = dot(volumeNormal, ray.direction);
-    float B = dot(volumeNormal, ray.origin);
-    float C = dot(volumeNormal, volumeNormalCenter);
-
     float phaseShift = atan(B, A);
     float amplitude = sqrt((A*A)+(B*B));
 
     float asinInput = C / amplitude;
     if(abs(asinInput) > 1.)
     {
-        return NO_HIT;
+        return -1.;
     }
 
     float asinVal = asin(asinInput);
@@ -170,16 +176,12 @@ Hit SphereHit(Sphere sphere, Ray ray)
     while(t2 < 0.)      { t2 += TWO_PI; }
     while(t2 >= TWO_PI) { t2 -= TWO_PI; }
     
-    //When we're inside a sphere, we can see through it.
-    //(this is mainly to allow the user to have a sphere representing them.)
-    bool rayIsComingFromWithinSphere = GeodesicDistance(ray.origin, sphere.center) <= sphere.radius;
-    
     float t;
     float nearT = min(t1, t2);
     float farT = max(t1, t2);
     if(nearT < MIN_RAY_HIT_THRESHOLD && farT < MIN_RAY_HIT_THRESHOLD)
     {
-        return NO_HIT;
+        return -1.;
     }
     else if(nearT < MIN_RAY_HIT_THRESHOLD)
     {
@@ -187,9 +189,9 @@ Hit SphereHit(Sphere sphere, Ray ray)
     }
     else if(farT < MIN_RAY_HIT_THRESHOLD)
     {
-        if(!sphere.visibleFromInside && rayIsComingFromWithinSphere)
+        if(hiddenFromInside)
         {
-            return NO_HIT;
+            return -1.;
         }
         else
         {
@@ -198,7 +200,7 @@ Hit SphereHit(Sphere sphere, Ray ray)
     }
     else
     {
-        if(!sphere.visibleFromInside && rayIsComingFromWithinSphere)
+        if(hiddenFromInside)
         {
             t = farT;
         }
@@ -208,12 +210,45 @@ Hit SphereHit(Sphere sphere, Ray ray)
         }
     }
     
-    vec3 returnColor = sphere.color;
+    return t;
+}
+
+//Returns the t at which the ray hits the sphere, or -1 if it doesn't
+float SphereHitDistance(Sphere sphere, Ray ray)
+{
+    //A circle on the surface of a 3D sphere can be defined as the intersection
+    //of a plane and a sphere (and conversely, the intersection of a plane and a
+    //sphere will always generate a circle on the surface of the sphere)
+    //
+    //Similarly, intersecting a 3-dimensional "hyperplane" with a 4D sphere gets you
+    //a sphere within the surface of the 4D sphere. We can use this to determine intersection.
+    //Instead of trying to calculate the intersection of the ray and the sphere, we calculate
+    //the intersection of the ray and the hyperplane that would generate the sphere if it 
+    //intersected the 4D sphere.
+    
+    vec4 volumeNormal = sphere.center;
+    vec4 volumeNormalCenter = sphere.center * sphere.cosRadius;
+    
+    float A = dot(volumeNormal, ray.direction);
+    float B = dot(volumeNormal, ray.origin);
+    float C = dot(volumeNormal, volumeNormalCenter);
+
+    //When we're inside a sphere, we can see through it.
+    //(this is mainly to allow the user to have a sphere representing them.)
+    bool rayIsComingFromWithinSphere = GeodesicDistance(ray.origin, sphere.center) <= sphere.radius;
+    bool visibleFromInside = (sphere.flags & SPHERE_VISIBLE_FROM_INSIDE) != 0u;
+
+    return HitDistanceFromPlaneTerms(A, B, C, !visibleFromInside && rayIsComingFromWithinSphere);
+}
+
+Surface ShadeSphereHit(Sphere sphere, Material material, Ray ray, float t)
+{
+    vec3 returnColor = material.color;
     
     vec4 hitPoint = PointAlongRay(ray, t); 
     
     //Draw a grid-like texture on the spheres to let you see how you rotate around them
-    if(sphere.hasCheckerboardPattern)
+    if((material.flags & MATERIAL_CHECKERBOARD) != 0u)
     {  
         ivec4 alternating = ivec4(round(mod(vec4(floor(hitPoint / .06)), 2.)));
         if((alternating.x == 1) ^^ (alternating.y == 1) ^^ (alternating.z == 1) ^^ (alternating.w == 1))
@@ -222,139 +257,200 @@ Hit SphereHit(Sphere sphere, Ray ray)
         }
     }
     
-    vec4 rayDirAtHitPoint = DirectionAtPointAlongRay(ray, t);
     vec4 vecToHitPoint = hitPoint - sphere.center;
     vec4 normal = normalize(vecToHitPoint - Project(vecToHitPoint, hitPoint));
     
-    Ray reflectedRay = Ray(vec4(0), vec4(0));
-    if(sphere.isReflective)
-    {
-        //Calculate reflection
-        vec4 reflection = normalize(Reflect(normal, rayDirAtHitPoint));
-        reflectedRay = Ray(hitPoint, reflection);
-    }
-    
-    return Hit(true, t, normal, returnColor, sphere.isReflective, reflectedRay);  
+    return Surface(hitPoint, normal, returnColor);
 }
 
 
 ////////////////////////////// SCENE OBJECTS //////////////////////////////
 
-const Sphere lightObject = Sphere(LIGHT_POSITION, 0.05, vec3(1.0, 1.0, 1.0), false, false, false);
+//Filled in from the scene file by main.cpp (spheres[0] is reserved for the player sphere).
+//Nothing here is sized at compile time, so the shader compiles the same for any scene.
+layout(std430, binding = 1) readonly buffer SceneSpheres
+{
+    Sphere spheres[];
+};
 
-Sphere[] spheres = Sphere[](
-    //bools are in this order: checkerboard, reflective, visible from inside.
-    
-    Sphere(vec4(0), 0.1, vec3(0.8, 0.5, 0.5), false, false, false) //This spot reserved for the player sphere
-    
-    ,Sphere(normalize(vec4(1., 0., 0., 0.)),  0.1, vec3(1.0, 1.0, 1.0), true, false, true)
-    ,Sphere(normalize(vec4(1., 0.5, 0., 0.)), 0.1, vec3(0.0, 0.0, 0.0), false, true, true)
-    ,Sphere(normalize(vec4(1., -0.5, 0., 0.)),  0.1, vec3(1.0, 0.0, 0.0), true, false, true)
-    ,Sphere(normalize(vec4(1., 0., 0.5, 0.)), 0.1, vec3(1.0, 0.0, 1.0), true, false, true)
-    ,Sphere(normalize(vec4(1., 0., -0.5, 0.)),  0.1, vec3(0.0, 1.0, 0.0), true, false, true)
-    ,Sphere(normalize(vec4(1., 0., 0., 0.5)), 0.1, vec3(1.0, 1.0, 0.0), true, false, true)
-    ,Sphere(normalize(vec4(1., 0., 0., -0.5)),  0.1, vec3(0.0, 0.0, 1.0), true, false, true)
-    
-    ,lightObject
-    
-    //almost-plane at the bottom
-    ,Sphere(normalize(vec4(0.0, 0.0, 0.0, -1.)),  (PI/2.0) - 0.15, vec3(0.4, 0.2, 0.9), true, false, true)
-);
+layout(std430, binding = 2) readonly buffer SceneMaterials
+{
+    Material materials[];
+};
+
+layout(std430, binding = 3) readonly buffer SceneLights
+{
+    Light lights[];
+};
+
+//Every sphere reduced to what primary rays of the current view need, in the frame where the
+//camera is at (1, 0, 0, 0): there B in SphereHitDistance is the center's x, and whether the
+//ray starts inside is the same for every pixel. Filled in per eye by packCameraFrameSpheres()
+//(SceneBuffers.h) from the same spheres as above.
+const uint CAMERA_FRAME_SPHERE_HIDDEN_FROM_INSIDE = 1u;
+
+struct CameraFrameSphere
+{
+    vec3 center; //y, z, w of the center in the camera frame
+    float originDot; //B
+    float missThreshold; //C^2 - B^2; the ray misses the sphere's hyperplane if A^2 < this
+    float planeOffset; //C
+    uint flags;
+};
+
+layout(std430, binding = 4) readonly buffer CameraFrameSpheres
+{
+    CameraFrameSphere cameraSpheres[];
+};
+
+Sphere GetSphere(int i)
+{
+    Sphere sphere = spheres[i];
+    if(i == 0)
+    {
+        //The player sphere follows the user around
+        sphere.center = userPos;
+    }
+    return sphere;
+}
 
 
 ////////////////////////// CORE RENDERING LOGIC ///////////////////////////
 
-Hit FindClosestHit(Ray ray, out int hitObjectIndex)
+Hit FindClosestHit(Ray ray)
 {
-    Hit nearest = HitWithoutReflection(false, 99999999999999., vec4(0), BACKGROUND_COLOR);
-    hitObjectIndex = -1;
+    Hit nearest = NO_HIT;
 
     //Iterate over spheres
     int startingPoint = USER_SPHERE_VISIBLE ? 0 : 1;
     for(int i = startingPoint; i < spheres.length(); i++)
     {            
-        Hit sphereHit = SphereHit(spheres[i], ray);
-        if(sphereHit.isHit && sphereHit.dist < nearest.dist)
+        float t = SphereHitDistance(GetSphere(i), ray);
+        if(t >= 0. && t < nearest.dist)
         {
-            nearest = sphereHit;
-            hitObjectIndex = i;
+            nearest = Hit(t, i);
         }
     }
     
     return nearest;
 }
 
-float CalculateDiffuseLightingAndShadows(vec4 hitPos, Hit nearest, int hitObjectIndex)
+//FindClosestHit for a primary ray, given by its direction in the camera frame. Most spheres are
+//missed, which here costs a 3-component dot product and one compare.
+Hit FindClosestPrimaryHit(vec3 cameraDir)
 {
-    float lightAmnt;
-    if(spheres[hitObjectIndex] == lightObject)
-    {
-        lightAmnt = 1.0;
-    }     
-    else if(PointsAreEqualOrOpposite(hitPos, LIGHT_POSITION))
+    Hit nearest = NO_HIT;
+
+    int startingPoint = USER_SPHERE_VISIBLE ? 0 : 1;
+    for(int i = startingPoint; i < cameraSpheres.length(); i++)
     {
-        if(dot(hitPos, LIGHT_POSITION) == 1.0)
+        CameraFrameSphere sphere = cameraSpheres[i];
+        float A = dot(sphere.center, cameraDir);
+        if(A * A < sphere.missThreshold)
         {
-            lightAmnt = 1.0;
+            continue;
         }
-        else
+
+        bool hiddenFromInside = (sphere.flags & CAMERA_FRAME_SPHERE_HIDDEN_FROM_INSIDE) != 0u;
+        float t = HitDistanceFromPlaneTerms(A, sphere.originDot, sphere.planeOffset, hiddenFromInside);
+        if(t >= 0. && t < nearest.dist)
         {
-            //TODO
-            
-            //It's basically impossible to calclate this in any reasonable timeframe, so we'll just 
-            //call it 1.0 since that's what it will most likely be.
-            lightAmnt = 1.0;
+            nearest = Hit(t, i);
         }
     }
-    else
-    {
-        vec4 lightRayDirAtHitPoint = -normalize(LIGHT_POSITION - Project(LIGHT_POSITION, hitPos));
-        float nearPathDotProduct = dot(-lightRayDirAtHitPoint, nearest.normal);
 
-        Ray lightRayWithPossibilityOfHitting;
-        float hitDotProduct;
-        if(nearPathDotProduct > 0.0)
-        {
-            lightRayWithPossibilityOfHitting = RayFromAToB(LIGHT_POSITION, hitPos);
-            hitDotProduct = nearPathDotProduct;
-        }
-        else if(nearPathDotProduct < 0.0)
-        {
-            Ray closeRay = RayFromAToB(LIGHT_POSITION, hitPos);
-            closeRay.direction = -closeRay.direction;
-            lightRayWithPossibilityOfHitting = closeRay;
+    return nearest;
+}
 
-            hitDotProduct = -nearPathDotProduct;
+//Whether anything other than ignoredObjectIndex is hit before tMax. Unlike FindClosestHit this
+//can stop at the first blocker.
+bool IsOccluded(Ray ray, float tMax, int ignoredObjectIndex)
+{
+    int startingPoint = USER_SPHERE_VISIBLE ? 0 : 1;
+    for(int i = startingPoint; i < spheres.length(); i++)
+    {
+        if(i == ignoredObjectIndex)
+        {
+            continue;
         }
-        else
+        
+        float t = SphereHitDistance(GetSphere(i), ray);
+        if(t >= 0. && t < tMax)
         {
-            // angle is exactly 90deg so it's not lit at all
-            lightAmnt = 0.0;
+            return true;
         }
+    }
+    
+    return false;
+}
 
-        int lightHitObjectIndex;
-        Hit firstHit = FindClosestHit(lightRayWithPossibilityOfHitting, lightHitObjectIndex);
+float CalculateDiffuseLight(Light light, vec4 hitPos, vec4 normal, int hitObjectIndex)
+{
+    vec4 lightPosition = light.position;
+    if(PointsAreEqualOrOpposite(hitPos, lightPosition))
+    {
+        //It's basically impossible to calclate the antipodal case in any reasonable timeframe, so
+        //we'll just call it 1.0 since that's what it will most likely be.
+        return 1.0;
+    }
 
-        //TODO: this only works for convex objects - if concave objects are added this code will need to be updated 
-        if(lightHitObjectIndex == hitObjectIndex)
-        {
-            //Nothing in between!
+    vec4 lightRayDirAtHitPoint = -normalize(lightPosition - Project(lightPosition, hitPos));
+    float nearPathDotProduct = dot(-lightRayDirAtHitPoint, normal);
 
-            //TODO: may want to have sanity check here, compare adjusted geodesic distance to firsthit dist
-            //float dist = GeodesicDistance(lightPos, hitPos);
-            float dist = firstHit.dist;
-            lightAmnt = min(1.0, LIGHT_INTENSITY / (sin(dist) * sin(dist)));
-            lightAmnt *= clamp(hitDotProduct, 0.0, 1.0);
-        }
-        else
+    //The light ray reaches hitPos at t = dist going the short way round, or 2pi - dist going the long way
+    float dist = GeodesicDistance(lightPosition, hitPos);
+
+    Ray lightRayWithPossibilityOfHitting;
+    float hitDotProduct;
+    float tAtHitPos;
+    if(nearPathDotProduct > 0.0)
+    {
+        lightRayWithPossibilityOfHitting = RayFromAToB(lightPosition, hitPos);
+        hitDotProduct = nearPathDotProduct;
+        tAtHitPos = dist;
+    }
+    else if(nearPathDotProduct < 0.0)
+    {
+        Ray closeRay = RayFromAToB(lightPosition, hitPos);
+        closeRay.direction = -closeRay.direction;
+        lightRayWithPossibilityOfHitting = closeRay;
+
+        hitDotProduct = -nearPathDotProduct;
+        tAtHitPos = TWO_PI - dist;
+    }
+    else
+    {
+        // angle is exactly 90deg so it's not lit at all
+        return 0.0;
+    }
+
+    //TODO: this only works for convex objects - if concave objects are added this code will need to be updated 
+    if(IsOccluded(lightRayWithPossibilityOfHitting, tAtHitPos, hitObjectIndex))
+    {
+        return 0.0;
+    }
+
+    //Nothing in between!
+    float lightAmnt = min(1.0, light.intensity / (sin(dist) * sin(dist)));
+    return lightAmnt * clamp(hitDotProduct, 0.0, 1.0);
+}
+
+float CalculateDiffuseLightingAndShadows(vec4 hitPos, vec4 normal, int hitObjectIndex)
+{
+    float lightAmnt = 0.0;
+    for(int i = 0; i < lights.length(); i++)
+    {
+        if(hitObjectIndex == lights[i].sphereIndex)
         {
-            lightAmnt = 0.0;
-        }          
+            return 1.0;
+        }
+        lightAmnt += CalculateDiffuseLight(lights[i], hitPos, normal, hitObjectIndex);
     }
     return lightAmnt;
 }
 
-vec3 RayColor(Ray ray)
+//nearest is the first hit of ray, already found
+vec3 RayColorFromHit(Ray ray, Hit nearest)
 {
     vec3[REFLECTION_COUNT+1] colors;
     
@@ -366,28 +462,35 @@ vec3 RayColor(Ray ray)
     
     for(int reflections = 0; reflections <= REFLECTION_COUNT; reflections++)
     {
-        int hitObjectIndex;
-        Hit nearest = FindClosestHit(ray, hitObjectIndex);
+        if(reflections > 0)
+        {
+            nearest = FindClosestHit(ray);
+        }
         
-        if(!nearest.isHit)
+        if(nearest.objectIndex < 0)
         {
             colors[reflections] = BACKGROUND_COLOR;
             break;
         }
 
+        Sphere sphere = GetSphere(nearest.objectIndex);
+        Material material = materials[sphere.materialIndex];
+        Surface surface = ShadeSphereHit(sphere, material, ray, nearest.dist);
+
         float lightAmnt = 1.0;
         if(LIGHTING_ENABLED)
         {
-            vec4 hitPos = PointAlongRay(ray, nearest.dist);
-            lightAmnt = CalculateDiffuseLightingAndShadows(hitPos, nearest, hitObjectIndex);
+            lightAmnt = CalculateDiffuseLightingAndShadows(surface.position, surface.normal, nearest.objectIndex);
             lightAmnt = min(1.0, lightAmnt + AMBIENT_LIGHT);
         }
              
-        colors[reflections] = nearest.color * lightAmnt;
+        colors[reflections] = surface.color * lightAmnt;
 
-        if(nearest.hasReflection)
+        if((material.flags & MATERIAL_REFLECTIVE) != 0u)
         {
-            ray = nearest.reflectedRay;           
+            //Calculate reflection
+            vec4 rayDirAtHitPoint = DirectionAtPointAlongRay(ray, nearest.dist);
+            ray = Ray(surface.position, normalize(Reflect(surface.normal, rayDirAtHitPoint)));
         }
         else
         {
@@ -414,22 +517,21 @@ vec3 RayColor(Ray ray)
 
 vec4 ColorAt(vec2 pixelCoord)
 {
-    mat4 invProjMat = inverse(projectionMat);
-    float near_z = projectionMat[3][2] / (projectionMat[2][2] - 1.0);
-
-    vec2 pixCoordNDC = (pixelCoord / (viewportResolution / 2.0)) - vec2(1.0);
-	vec4 rev_persp = vec4(pixCoordNDC*near_z, -near_z, near_z);
-    vec4 world_ray = invProjMat * rev_persp;
-    vec4 rayDir = (world_ray.x * userRightDir) + (world_ray.y * userUpDir) + (-world_ray.z * userForwardDir);
-
-    Ray ray = Ray(normalize(userPos), normalize(rayDir));
-    
-    if(USER_SPHERE_VISIBLE)
+    if(primaryRaysInCameraFrame != 0)
     {
-        spheres[0].center = ray.origin;
+        //Dropping x makes the direction exactly tangent at the camera
+        vec4 cameraRayDir = cameraRayDirAtOrigin + (pixelCoord.x * cameraRayDirPerPixelX) + (pixelCoord.y * cameraRayDirPerPixelY);
+        vec3 cameraDir = normalize(cameraRayDir.yzw);
+        Ray ray = Ray(fromCameraFrame[0], fromCameraFrame * vec4(0, cameraDir));
+
+        return vec4(RayColorFromHit(ray, FindClosestPrimaryHit(cameraDir)), 1.0);
     }
 
-    return vec4(RayColor(ray), 1.0);
+    vec4 rayDir = rayDirAtOrigin + (pixelCoord.x * rayDirPerPixelX) + (pixelCoord.y * rayDirPerPixelY);
+
+    Ray ray = Ray(userPos, normalize(rayDir));
+
+    return vec4(RayColorFromHit(ray, FindClosestHit(ray)), 1.0);
 }
 
 void main()